@@ -0,0 +1,523 @@
+#include "ArrayKernels.h"
+
+#include <llvm/ADT/APFloat.h>
+#include <llvm/ADT/APInt.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+
+using namespace llvm;
+
+ArrayKernelBuilder::ArrayKernelBuilder(Module &M, RecordLayout Layout,
+                                       unsigned VectorWidth) :
+    M(M),
+    Ctx(M.getContext()),
+    DL(M.getDataLayout()),
+    Layout(Layout),
+    VectorWidth(VectorWidth),
+    Alignment(0),
+    Signed(true)
+{
+}
+
+Expected<Function *> ArrayKernelBuilder::createMap(StringRef Name,
+                                                   Type *ResultTy, FieldFn Fn)
+{
+    return createKernel(MapKernel, Name, ResultTy, Add, std::move(Fn));
+}
+
+Expected<Function *> ArrayKernelBuilder::createFilter(StringRef Name,
+                                                      FieldFn Pred)
+{
+    return createKernel(FilterKernel, Name, Type::getInt1Ty(Ctx), Add,
+                        std::move(Pred));
+}
+
+Expected<Function *> ArrayKernelBuilder::createReduce(StringRef Name,
+                                                      Type *ResultTy,
+                                                      ReduceOp Op, FieldFn Fn)
+{
+    return createKernel(ReduceKernel, Name, ResultTy, Op, std::move(Fn));
+}
+
+Error ArrayKernelBuilder::checkLayout() const
+{
+    if (!isPowerOf2_32(VectorWidth))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Vector width %u is not a power of two",
+                                 VectorWidth);
+
+    if (!Layout.Record || Layout.Record->isOpaque() ||
+        Layout.Record->getNumElements() == 0)
+        return createStringError(inconvertibleErrorCode(),
+                                 "Record type must be a non-empty struct");
+
+    for (Type *FieldTy : Layout.Record->elements())
+        if (!FieldTy->isIntegerTy() && !FieldTy->isFloatingPointTy())
+            return createStringError(inconvertibleErrorCode(),
+                                     "Record fields must be integers or "
+                                     "floating point values");
+
+    return Error::success();
+}
+
+bool ArrayKernelBuilder::isHomogeneous() const
+{
+    StructType *Record = Layout.Record;
+    Type *FieldTy = Record->getElementType(0);
+
+    for (Type *Ty : Record->elements())
+        if (Ty != FieldTy)
+            return false;
+
+    return DL.getTypeAllocSize(Record) ==
+           Record->getNumElements() * DL.getTypeAllocSize(FieldTy);
+}
+
+unsigned ArrayKernelBuilder::getAccessAlignment(uint64_t Stride, Type *ScalarTy,
+                                                unsigned Lanes) const
+{
+    unsigned Natural = DL.getABITypeAlignment(ScalarTy);
+
+    if (Lanes == 1 || Alignment <= Natural)
+        return Natural;
+
+    return std::max<unsigned>(Natural, MinAlign(Alignment, Stride * Lanes));
+}
+
+std::vector<Value *> ArrayKernelBuilder::loadFields(IRBuilder<> &B,
+                                                    ArrayRef<Value *> Bases,
+                                                    Value *I, unsigned Lanes)
+{
+    StructType *Record = Layout.Record;
+    unsigned NumFields = Record->getNumElements();
+    std::vector<Value *> Fields;
+
+    if (Layout.Kind == RecordLayout::SoA)
+    {
+        for (unsigned F = 0; F < NumFields; F++)
+        {
+            Type *FieldTy = Record->getElementType(F);
+            Value *Ptr = B.CreateInBoundsGEP(FieldTy, Bases[F], I);
+            unsigned Align = getAccessAlignment(DL.getTypeAllocSize(FieldTy),
+                                                FieldTy, Lanes);
+
+            if (Lanes == 1)
+            {
+                Fields.push_back(B.CreateAlignedLoad(FieldTy, Ptr, Align));
+                continue;
+            }
+
+            Type *VecTy = VectorType::get(FieldTy, Lanes);
+            Ptr = B.CreateBitCast(Ptr, PointerType::getUnqual(VecTy));
+            Fields.push_back(B.CreateAlignedLoad(VecTy, Ptr, Align));
+        }
+
+        return Fields;
+    }
+
+    Value *Data = Bases[0];
+    uint64_t Stride = DL.getTypeAllocSize(Record);
+
+    if (Lanes > 1 && isHomogeneous())
+    {
+        // One wide load of Lanes consecutive records, deinterleaved into one
+        // vector per field.
+        Type *FieldTy = Record->getElementType(0);
+        Type *WideTy = VectorType::get(FieldTy, Lanes * NumFields);
+
+        Value *Ptr = B.CreateInBoundsGEP(Record, Data, I);
+        Ptr = B.CreateBitCast(Ptr, PointerType::getUnqual(WideTy));
+        Value *Wide = B.CreateAlignedLoad(
+            WideTy, Ptr, getAccessAlignment(Stride, FieldTy, Lanes), "records");
+
+        for (unsigned F = 0; F < NumFields; F++)
+        {
+            std::vector<uint32_t> Mask;
+            for (unsigned L = 0; L < Lanes; L++)
+                Mask.push_back(L * NumFields + F);
+
+            Fields.push_back(B.CreateShuffleVector(
+                Wide, UndefValue::get(WideTy), Mask));
+        }
+
+        return Fields;
+    }
+
+    for (unsigned F = 0; F < NumFields; F++)
+    {
+        Type *FieldTy = Record->getElementType(F);
+        unsigned Align = MinAlign(DL.getABITypeAlignment(Record),
+                                  DL.getStructLayout(Record)->getElementOffset(F));
+
+        if (Lanes == 1)
+        {
+            Value *Ptr = B.CreateInBoundsGEP(Record, Data,
+                                             {I, B.getInt32(F)});
+            Fields.push_back(B.CreateAlignedLoad(FieldTy, Ptr, Align));
+            continue;
+        }
+
+        // Mixed field types: gather the lanes one record at a time.
+        Value *V = UndefValue::get(VectorType::get(FieldTy, Lanes));
+
+        for (unsigned L = 0; L < Lanes; L++)
+        {
+            Value *Idx = B.CreateAdd(I, B.getInt64(L));
+            Value *Ptr = B.CreateInBoundsGEP(Record, Data,
+                                             {Idx, B.getInt32(F)});
+            V = B.CreateInsertElement(V, B.CreateAlignedLoad(FieldTy, Ptr, Align),
+                                      B.getInt32(L));
+        }
+
+        Fields.push_back(V);
+    }
+
+    return Fields;
+}
+
+void ArrayKernelBuilder::storeResult(IRBuilder<> &B, Value *Out, Value *I,
+                                     Value *V, unsigned Lanes)
+{
+    Type *EltTy = V->getType()->getScalarType();
+    Value *Ptr = B.CreateInBoundsGEP(EltTy, Out, I);
+    unsigned Align = getAccessAlignment(DL.getTypeAllocSize(EltTy), EltTy, Lanes);
+
+    if (Lanes > 1)
+        Ptr = B.CreateBitCast(Ptr, PointerType::getUnqual(V->getType()));
+
+    B.CreateAlignedStore(V, Ptr, Align);
+}
+
+Value *ArrayKernelBuilder::getIdentity(Type *Ty, ReduceOp Op, unsigned Lanes)
+{
+    Constant *C = nullptr;
+
+    if (Ty->isFloatingPointTy())
+    {
+        const fltSemantics &Sem = Ty->getFltSemantics();
+
+        switch (Op)
+        {
+        case Add: C = ConstantFP::get(Ty, 0.0); break;
+        case Mul: C = ConstantFP::get(Ty, 1.0); break;
+        case Min: C = ConstantFP::get(Ctx, APFloat::getInf(Sem, false)); break;
+        case Max: C = ConstantFP::get(Ctx, APFloat::getInf(Sem, true)); break;
+        }
+    }
+    else
+    {
+        unsigned Bits = Ty->getIntegerBitWidth();
+
+        switch (Op)
+        {
+        case Add: C = ConstantInt::get(Ty, 0); break;
+        case Mul: C = ConstantInt::get(Ty, 1); break;
+        case Min:
+            C = ConstantInt::get(Ctx, Signed ? APInt::getSignedMaxValue(Bits)
+                                             : APInt::getMaxValue(Bits));
+            break;
+        case Max:
+            C = ConstantInt::get(Ctx, Signed ? APInt::getSignedMinValue(Bits)
+                                             : APInt::getMinValue(Bits));
+            break;
+        }
+    }
+
+    if (Lanes == 1)
+        return C;
+
+    return ConstantVector::getSplat(Lanes, C);
+}
+
+Value *ArrayKernelBuilder::combine(IRBuilder<> &B, ReduceOp Op, Value *L, Value *R)
+{
+    bool IsFP = L->getType()->isFPOrFPVectorTy();
+
+    switch (Op)
+    {
+    case Add:
+        return IsFP ? B.CreateFAdd(L, R) : B.CreateAdd(L, R);
+    case Mul:
+        return IsFP ? B.CreateFMul(L, R) : B.CreateMul(L, R);
+    case Min:
+        return B.CreateSelect(IsFP ? B.CreateFCmpOLT(L, R)
+                                   : Signed ? B.CreateICmpSLT(L, R)
+                                            : B.CreateICmpULT(L, R),
+                              L, R);
+    case Max:
+        return B.CreateSelect(IsFP ? B.CreateFCmpOGT(L, R)
+                                   : Signed ? B.CreateICmpSGT(L, R)
+                                            : B.CreateICmpUGT(L, R),
+                              L, R);
+    }
+
+    llvm_unreachable("Unknown reduction");
+}
+
+Value *ArrayKernelBuilder::reduceLanes(IRBuilder<> &B, ReduceOp Op, Value *V)
+{
+    unsigned Lanes = V->getType()->getVectorNumElements();
+
+    // Fold the upper half of the vector onto the lower half until a single
+    // lane is left.
+    for (unsigned Half = Lanes / 2; Half > 0; Half /= 2)
+    {
+        std::vector<uint32_t> Mask;
+        for (unsigned L = 0; L < Lanes; L++)
+            Mask.push_back(L < Half ? L + Half : L);
+
+        Value *Upper = B.CreateShuffleVector(V, UndefValue::get(V->getType()), Mask);
+        V = combine(B, Op, V, Upper);
+    }
+
+    return B.CreateExtractElement(V, B.getInt32(0));
+}
+
+Expected<Function *> ArrayKernelBuilder::createKernel(KernelKind Kind,
+                                                      StringRef Name,
+                                                      Type *ResultTy,
+                                                      ReduceOp Op, FieldFn Fn)
+{
+    if (auto Err = checkLayout())
+        return std::move(Err);
+
+    if (!ResultTy->isIntegerTy() && !ResultTy->isFloatingPointTy())
+        return createStringError(inconvertibleErrorCode(),
+                                 "Kernel results must be integers or "
+                                 "floating point values");
+
+    IRBuilder<> B(Ctx);
+
+    Type *I64Ty = B.getInt64Ty();
+    Type *DataTy = Layout.Kind == RecordLayout::AoS
+                       ? PointerType::getUnqual(Layout.Record)
+                       : PointerType::getUnqual(B.getInt8PtrTy());
+
+    std::vector<Type *> ArgTys{DataTy};
+    Type *RetTy = nullptr;
+
+    switch (Kind)
+    {
+    case MapKernel:
+        ArgTys.push_back(PointerType::getUnqual(ResultTy));
+        RetTy = B.getVoidTy();
+        break;
+    case FilterKernel:
+        ArgTys.push_back(PointerType::getUnqual(I64Ty));
+        RetTy = I64Ty;
+        break;
+    case ReduceKernel:
+        RetTy = ResultTy;
+        break;
+    }
+    ArgTys.push_back(I64Ty);
+
+    auto fn = Function::Create(FunctionType::get(RetTy, ArgTys, false),
+                               Function::ExternalLinkage, Name, M);
+
+    Function::arg_iterator args = fn->arg_begin();
+    Value *Data = args++;
+    Data->setName("data");
+    Value *Out = nullptr;
+    if (Kind != ReduceKernel)
+    {
+        Out = args++;
+        Out->setName(Kind == MapKernel ? "out" : "indices");
+    }
+    Value *N = args++;
+    N->setName("n");
+
+    // Records and outputs never overlap, which is what lets the optimizer
+    // keep the vector loop free of runtime alias checks.
+    fn->addParamAttr(0, Attribute::NoAlias);
+    if (Out)
+        fn->addParamAttr(1, Attribute::NoAlias);
+
+    BasicBlock *entry = BasicBlock::Create(Ctx, "entry", fn);
+    BasicBlock *vec_body = BasicBlock::Create(Ctx, "vec.body", fn);
+    BasicBlock *vec_exit = BasicBlock::Create(Ctx, "vec.exit", fn);
+    BasicBlock *rem_body = BasicBlock::Create(Ctx, "rem.body", fn);
+    BasicBlock *exit = BasicBlock::Create(Ctx, "exit", fn);
+
+    B.SetInsertPoint(entry);
+
+    std::vector<Value *> Bases;
+    if (Layout.Kind == RecordLayout::SoA)
+    {
+        for (unsigned F = 0; F < Layout.Record->getNumElements(); F++)
+        {
+            Type *FieldTy = Layout.Record->getElementType(F);
+            Value *Slot = B.CreateInBoundsGEP(B.getInt8PtrTy(), Data, B.getInt64(F));
+            Value *Column = B.CreateLoad(B.getInt8PtrTy(), Slot);
+            Bases.push_back(B.CreateBitCast(Column, PointerType::getUnqual(FieldTy),
+                                            "column"));
+        }
+    }
+    else
+        Bases.push_back(Data);
+
+    // nvec = n & ~(VectorWidth - 1)
+    Value *NVec = B.CreateAnd(N, B.getInt64(~(uint64_t)(VectorWidth - 1)), "nvec");
+    B.CreateCondBr(B.CreateICmpNE(NVec, B.getInt64(0)), vec_body, vec_exit);
+
+    // Vector main loop
+    B.SetInsertPoint(vec_body);
+
+    PHINode *I = B.CreatePHI(I64Ty, 2, "i");
+    I->addIncoming(B.getInt64(0), entry);
+
+    PHINode *Acc = nullptr;
+    if (Kind == ReduceKernel)
+    {
+        Acc = B.CreatePHI(VectorType::get(ResultTy, VectorWidth), 2, "acc");
+        Acc->addIncoming(getIdentity(ResultTy, Op, VectorWidth), entry);
+    }
+
+    PHINode *Count = nullptr;
+    if (Kind == FilterKernel)
+    {
+        Count = B.CreatePHI(I64Ty, 2, "count");
+        Count->addIncoming(B.getInt64(0), entry);
+    }
+
+    Value *V = Fn(B, loadFields(B, Bases, I, VectorWidth));
+
+    if (!V || V->getType() != VectorType::get(ResultTy, VectorWidth))
+    {
+        fn->eraseFromParent();
+        return createStringError(inconvertibleErrorCode(),
+                                 "Kernel '%s': the callback did not produce "
+                                 "a vector of the result type",
+                                 Name.str().c_str());
+    }
+
+    Value *AccNext = nullptr;
+    Value *CountNext = nullptr;
+
+    switch (Kind)
+    {
+    case MapKernel:
+        storeResult(B, Out, I, V, VectorWidth);
+        break;
+    case FilterKernel:
+        // Branch-free compaction: every lane writes its index to the next
+        // free slot, which only advances when the predicate holds.
+        CountNext = Count;
+        for (unsigned L = 0; L < VectorWidth; L++)
+        {
+            Value *Lane = B.CreateExtractElement(V, B.getInt32(L));
+            B.CreateStore(B.CreateAdd(I, B.getInt64(L)),
+                          B.CreateInBoundsGEP(I64Ty, Out, CountNext));
+            CountNext = B.CreateAdd(CountNext, B.CreateZExt(Lane, I64Ty));
+        }
+        Count->addIncoming(CountNext, vec_body);
+        break;
+    case ReduceKernel:
+        AccNext = combine(B, Op, Acc, V);
+        Acc->addIncoming(AccNext, vec_body);
+        break;
+    }
+
+    Value *INext = B.CreateAdd(I, B.getInt64(VectorWidth), "i.next");
+    I->addIncoming(INext, vec_body);
+    B.CreateCondBr(B.CreateICmpULT(INext, NVec), vec_body, vec_exit);
+
+    // Leave the vector loop: reduce the lanes and go on with the remainder
+    B.SetInsertPoint(vec_exit);
+
+    Value *Partial = nullptr;
+    if (Kind == ReduceKernel)
+    {
+        PHINode *AccOut = B.CreatePHI(Acc->getType(), 2, "acc.out");
+        AccOut->addIncoming(Acc->getIncomingValue(0), entry);
+        AccOut->addIncoming(AccNext, vec_body);
+        Partial = reduceLanes(B, Op, AccOut);
+    }
+    else if (Kind == FilterKernel)
+    {
+        PHINode *CountOut = B.CreatePHI(I64Ty, 2, "count.out");
+        CountOut->addIncoming(B.getInt64(0), entry);
+        CountOut->addIncoming(CountNext, vec_body);
+        Partial = CountOut;
+    }
+
+    B.CreateCondBr(B.CreateICmpULT(NVec, N), rem_body, exit);
+
+    // Scalar remainder loop
+    B.SetInsertPoint(rem_body);
+
+    PHINode *J = B.CreatePHI(I64Ty, 2, "j");
+    J->addIncoming(NVec, vec_exit);
+
+    PHINode *Carry = nullptr;
+    if (Partial)
+    {
+        Carry = B.CreatePHI(Partial->getType(), 2, "carry");
+        Carry->addIncoming(Partial, vec_exit);
+    }
+
+    V = Fn(B, loadFields(B, Bases, J, 1));
+
+    if (!V || V->getType() != ResultTy)
+    {
+        fn->eraseFromParent();
+        return createStringError(inconvertibleErrorCode(),
+                                 "Kernel '%s': the callback did not produce "
+                                 "a scalar of the result type",
+                                 Name.str().c_str());
+    }
+
+    Value *CarryNext = nullptr;
+
+    switch (Kind)
+    {
+    case MapKernel:
+        storeResult(B, Out, J, V, 1);
+        break;
+    case FilterKernel:
+        B.CreateStore(J, B.CreateInBoundsGEP(I64Ty, Out, Carry));
+        CarryNext = B.CreateAdd(Carry, B.CreateZExt(V, I64Ty));
+        break;
+    case ReduceKernel:
+        CarryNext = combine(B, Op, Carry, V);
+        break;
+    }
+
+    if (Carry)
+        Carry->addIncoming(CarryNext, rem_body);
+
+    Value *JNext = B.CreateAdd(J, B.getInt64(1), "j.next");
+    J->addIncoming(JNext, rem_body);
+    B.CreateCondBr(B.CreateICmpULT(JNext, N), rem_body, exit);
+
+    // Done
+    B.SetInsertPoint(exit);
+
+    if (Partial)
+    {
+        PHINode *Result = B.CreatePHI(Partial->getType(), 2, "result");
+        Result->addIncoming(Partial, vec_exit);
+        Result->addIncoming(CarryNext, rem_body);
+        B.CreateRet(Result);
+    }
+    else
+        B.CreateRetVoid();
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyFunction(*fn, &es))
+    {
+        fn->eraseFromParent();
+        return createStringError(inconvertibleErrorCode(),
+                                 "Function verification failed: %s",
+                                 es.str().c_str());
+    }
+
+    return fn;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Error.h>
+
+#include <functional>
+#include <vector>
+
+/// Memory layout of the records a kernel iterates over
+///
+/// Both layouts are described by a struct type with scalar fields. With AoS
+/// the kernel receives a pointer to an array of such structs; with SoA it
+/// receives a pointer to an array of column pointers, one per field, and
+/// column i holds the values of field i.
+struct RecordLayout
+{
+    enum LayoutKind { AoS, SoA };
+
+    static RecordLayout aos(llvm::StructType *Record) { return {AoS, Record}; }
+    static RecordLayout soa(llvm::StructType *Record) { return {SoA, Record}; }
+
+    LayoutKind Kind;
+    llvm::StructType *Record;
+};
+
+/// Array kernel builder
+///
+/// Emits map, filter and reduce kernels over runtime-length arrays of host
+/// records. Every kernel has a vector main loop that processes VectorWidth
+/// records per iteration and a scalar loop for the remainder.
+///
+/// The element-wise computation is supplied as a callback that receives one
+/// value per record field. In the main loop those values are vectors of
+/// VectorWidth lanes, in the remainder loop they are scalars, so callbacks
+/// should only use IRBuilder operations that work on both.
+///
+/// Kernel signatures, where Data is `const Record *` for AoS and
+/// `void *const *` for SoA:
+///
+///     void     map(Data data, Result *out, uint64_t n)
+///     uint64_t filter(Data data, uint64_t *indices, uint64_t n)
+///     Result   reduce(Data data, uint64_t n)
+class ArrayKernelBuilder
+{
+
+public:
+    using FieldFn = std::function<llvm::Value *(llvm::IRBuilder<> &B,
+                                                llvm::ArrayRef<llvm::Value *> Fields)>;
+
+    enum ReduceOp { Add, Mul, Min, Max };
+
+    /// VectorWidth must be a power of two.
+    ArrayKernelBuilder(llvm::Module &M, RecordLayout Layout,
+                       unsigned VectorWidth = 8);
+
+    /// Alignment in bytes that the caller guarantees for the record array
+    /// (or every column) and for the output array. Vector accesses are
+    /// emitted with the largest alignment this guarantee implies.
+    void setAlignment(unsigned Bytes) { Alignment = Bytes; }
+
+    /// Signedness of integer comparisons in Min and Max reductions
+    void setSigned(bool IsSigned) { Signed = IsSigned; }
+
+    /// out[i] = Fn(record i)
+    llvm::Expected<llvm::Function *> createMap(llvm::StringRef Name,
+                                               llvm::Type *ResultTy, FieldFn Fn);
+
+    /// Store the index of every record for which Pred is true in indices
+    /// and return how many were stored.
+    llvm::Expected<llvm::Function *> createFilter(llvm::StringRef Name,
+                                                  FieldFn Pred);
+
+    /// Combine Fn(record i) over all records with Op.
+    llvm::Expected<llvm::Function *> createReduce(llvm::StringRef Name,
+                                                  llvm::Type *ResultTy,
+                                                  ReduceOp Op, FieldFn Fn);
+
+private:
+    enum KernelKind { MapKernel, FilterKernel, ReduceKernel };
+
+    llvm::Module &M;
+    llvm::LLVMContext &Ctx;
+    const llvm::DataLayout &DL;
+    RecordLayout Layout;
+    unsigned VectorWidth;
+    unsigned Alignment;
+    bool Signed;
+
+    llvm::Expected<llvm::Function *> createKernel(KernelKind Kind,
+                                                  llvm::StringRef Name,
+                                                  llvm::Type *ResultTy,
+                                                  ReduceOp Op, FieldFn Fn);
+
+    llvm::Error checkLayout() const;
+
+    /// True if the record is a padding-free sequence of fields of one type,
+    /// so that VectorWidth records can be read with one wide load.
+    bool isHomogeneous() const;
+
+    /// Load the fields of the records [I, I + Lanes)
+    std::vector<llvm::Value *> loadFields(llvm::IRBuilder<> &B,
+                                          llvm::ArrayRef<llvm::Value *> Bases,
+                                          llvm::Value *I, unsigned Lanes);
+
+    void storeResult(llvm::IRBuilder<> &B, llvm::Value *Out, llvm::Value *I,
+                     llvm::Value *V, unsigned Lanes);
+
+    llvm::Value *getIdentity(llvm::Type *Ty, ReduceOp Op, unsigned Lanes);
+    llvm::Value *combine(llvm::IRBuilder<> &B, ReduceOp Op,
+                         llvm::Value *L, llvm::Value *R);
+    llvm::Value *reduceLanes(llvm::IRBuilder<> &B, ReduceOp Op, llvm::Value *V);
+
+    /// Alignment of a Lanes-wide access to ScalarTy values laid out Stride
+    /// bytes apart, starting at an element index that is a multiple of Lanes.
+    unsigned getAccessAlignment(uint64_t Stride, llvm::Type *ScalarTy,
+                                unsigned Lanes) const;
+};
@@ -0,0 +1,186 @@
+#include "BatchWrapper.h"
+#include "RetainedIR.h"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+static bool isBatchable(Type *Ty)
+{
+    return Ty->isIntegerTy() || Ty->isFloatingPointTy() || Ty->isPointerTy();
+}
+
+/// Loop metadata that asks for vectorization by Width
+static MDNode *getVectorizeLoopID(LLVMContext &Ctx, unsigned Width)
+{
+    Metadata *Enable[] = {
+        MDString::get(Ctx, "llvm.loop.vectorize.enable"),
+        ConstantAsMetadata::get(ConstantInt::getTrue(Ctx))};
+
+    Metadata *VectorWidth[] = {
+        MDString::get(Ctx, "llvm.loop.vectorize.width"),
+        ConstantAsMetadata::get(ConstantInt::get(Type::getInt32Ty(Ctx), Width))};
+
+    // The first operand of a loop ID refers to itself.
+    Metadata *Ops[] = {nullptr, MDNode::get(Ctx, Enable),
+                       MDNode::get(Ctx, VectorWidth)};
+
+    MDNode *LoopID = MDNode::getDistinct(Ctx, Ops);
+    LoopID->replaceOperandWith(0, LoopID);
+    return LoopID;
+}
+
+Expected<Function *> emitBatchWrapper(Function &Scalar, StringRef Name,
+                                      unsigned VectorBits)
+{
+    Module &M = *Scalar.getParent();
+    LLVMContext &Ctx = M.getContext();
+    const DataLayout &DL = M.getDataLayout();
+
+    FunctionType *FTy = Scalar.getFunctionType();
+    Type *ResultTy = FTy->getReturnType();
+
+    bool Batchable = !FTy->isVarArg() && isBatchable(ResultTy);
+    uint64_t WidestBits = DL.getTypeStoreSizeInBits(ResultTy);
+
+    for (Type *Ty : FTy->params())
+    {
+        Batchable = Batchable && isBatchable(Ty);
+
+        if (Batchable)
+            WidestBits = std::max<uint64_t>(WidestBits, DL.getTypeStoreSizeInBits(Ty));
+    }
+
+    if (!Batchable)
+        return createStringError(inconvertibleErrorCode(),
+                                 "'%s' cannot be batched: it must return a "
+                                 "scalar and take only scalars",
+                                 Scalar.getName().str().c_str());
+
+    Type *SizeTy = DL.getIntPtrType(Ctx);
+
+    std::vector<Type *> Params;
+    for (Type *Ty : FTy->params())
+        Params.push_back(Ty->getPointerTo());
+
+    Params.push_back(ResultTy->getPointerTo());
+    Params.push_back(SizeTy);
+
+    Function *Batch = Function::Create(
+        FunctionType::get(Type::getVoidTy(Ctx), Params, false),
+        GlobalValue::ExternalLinkage, Name, M);
+
+    // Columns are only read, out is only written, and none overlap, so
+    // the vectorizer needs no runtime alias checks.
+    auto Column = Batch->arg_begin();
+
+    for (Argument &A : Scalar.args())
+    {
+        Column->setName(A.getName());
+        Column->addAttr(Attribute::NoAlias);
+        Column->addAttr(Attribute::NoCapture);
+        Column->addAttr(Attribute::ReadOnly);
+        Column++;
+    }
+
+    Argument *Out = &*Column++;
+    Out->setName("out");
+    Out->addAttr(Attribute::NoAlias);
+    Out->addAttr(Attribute::NoCapture);
+
+    Argument *N = &*Column;
+    N->setName("n");
+
+    BasicBlock *Entry = BasicBlock::Create(Ctx, "entry", Batch);
+    BasicBlock *Loop = BasicBlock::Create(Ctx, "loop", Batch);
+    BasicBlock *Exit = BasicBlock::Create(Ctx, "exit", Batch);
+
+    IRBuilder<> B(Entry);
+    B.CreateCondBr(B.CreateICmpEQ(N, ConstantInt::get(SizeTy, 0)), Exit, Loop);
+
+    B.SetInsertPoint(Loop);
+    PHINode *I = B.CreatePHI(SizeTy, 2, "i");
+    I->addIncoming(ConstantInt::get(SizeTy, 0), Entry);
+
+    std::vector<Value *> Args;
+    Column = Batch->arg_begin();
+
+    for (Type *Ty : FTy->params())
+    {
+        Value *Ptr = B.CreateInBoundsGEP(Ty, &*Column++, I);
+        Args.push_back(B.CreateLoad(Ty, Ptr));
+    }
+
+    CallInst *Call = B.CreateCall(&Scalar, Args);
+    B.CreateStore(Call, B.CreateInBoundsGEP(ResultTy, Out, I));
+
+    Value *Next = B.CreateAdd(I, ConstantInt::get(SizeTy, 1), "i.next",
+                              true, true);
+    I->addIncoming(Next, Loop);
+
+    BranchInst *Latch = B.CreateCondBr(B.CreateICmpEQ(Next, N), Exit, Loop);
+
+    // Narrow elements would otherwise ask for absurdly wide vectors, and
+    // odd sizes such as x86_fp80's for widths that are not powers of two.
+    unsigned Width = std::min<uint64_t>(
+        PowerOf2Floor(std::max<uint64_t>(VectorBits / WidestBits, 1)), 64);
+    Latch->setMetadata(LLVMContext::MD_loop, getVectorizeLoopID(Ctx, Width));
+
+    B.SetInsertPoint(Exit);
+    B.CreateRetVoid();
+
+    // Should it fail, the call stays and the wrapper is still correct.
+    InlineFunctionInfo IFI;
+    InlineFunction(Call, IFI);
+
+    return Batch;
+}
+
+Expected<JITTargetAddress> addBatchWrapper(JitEngine &JIT, JITDylib &Tenant,
+                                           StringRef Name, VModuleKey K)
+{
+    // The retained IR is parsed afresh, and the wrapper is compiled from
+    // that copy, so it gets a context of its own.
+    auto Ctx = std::make_unique<LLVMContext>();
+
+    auto M = loadRetainedIR(JIT, Tenant, Name, *Ctx);
+    if (!M)
+        return M.takeError();
+
+    Module &module = **M;
+
+    auto Batch = emitBatchWrapper(*module.getFunction(Name), Name.str() + "_batch");
+    if (!Batch)
+        return Batch.takeError();
+
+    // The module may have had a function of that name already.
+    std::string BatchName = (*Batch)->getName().str();
+
+    if (auto Err = keepOnlyForInlining(module, **Batch))
+        return std::move(Err);
+
+    if (auto Err = JIT.addModule(Tenant,
+                                 ThreadSafeModule(std::move(*M), std::move(Ctx)),
+                                 K))
+        return std::move(Err);
+
+    auto Addr = JIT.getFunctionAddr(Tenant, BatchName);
+    if (!Addr)
+    {
+        consumeError(JIT.removeModule(K));
+        return Addr.takeError();
+    }
+
+    return *Addr;
+}
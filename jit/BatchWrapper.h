@@ -0,0 +1,69 @@
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ExecutionEngine/JITSymbol.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/IR/Function.h>
+#include <llvm/Support/Error.h>
+
+#include "JitEngine.h"
+
+#include <cstddef>
+#include <functional>
+
+/// Batch wrappers
+///
+/// The batch wrapper of a scalar function
+///
+///     R f(A0 a0, A1 a1, ...)
+///
+/// is
+///
+///     void f_batch(const A0 *a0, const A1 *a1, ..., R *out, size_t n)
+///
+/// which sets out[i] = f(a0[i], a1[i], ...) for every i below n, so a
+/// column is processed with one call instead of one per row. The scalar
+/// body is inlined into the loop, and the loop is marked for vectorization
+/// VectorBits wide: the optimizer runs without target information to pick
+/// a width from, and code generation splits vectors that are wider than
+/// the target's registers. The columns and out must not overlap.
+
+/// Emit the batch wrapper of Scalar, called Name, into Scalar's module.
+/// Scalar must return a value, and its parameters and result must be
+/// integers, floating point values or pointers. If the body of Scalar
+/// cannot be inlined, the wrapper calls it.
+llvm::Expected<llvm::Function *> emitBatchWrapper(llvm::Function &Scalar,
+                                                  llvm::StringRef Name,
+                                                  unsigned VectorBits = 256);
+
+/// Compile the batch wrapper of the function Name of Tenant, called
+/// Name_batch, in a module of its own added under K. The wrapper is built
+/// from the retained IR of Name's module (see JitEngine::setRetainIR), and
+/// calls whatever it does not inline in the code already in Tenant.
+llvm::Expected<llvm::JITTargetAddress>
+addBatchWrapper(JitEngine &JIT, llvm::orc::JITDylib &Tenant,
+                llvm::StringRef Name, llvm::orc::VModuleKey K);
+
+/// Signature of the batch wrapper of a function of signature Signature_t
+template <class Signature_t>
+struct BatchSignature;
+
+template <class Result_t, class... Args_t>
+struct BatchSignature<Result_t(Args_t...)>
+{
+    using type = void(const Args_t *..., Result_t *, size_t);
+};
+
+/// Signature_t is the signature of the scalar function.
+template <class Signature_t>
+llvm::Expected<std::function<typename BatchSignature<Signature_t>::type>>
+getBatchFunction(JitEngine &JIT, llvm::orc::JITDylib &Tenant,
+                 llvm::StringRef Name, llvm::orc::VModuleKey K)
+{
+    using Batch_t = typename BatchSignature<Signature_t>::type;
+
+    if (auto A = addBatchWrapper(JIT, Tenant, Name, K))
+        return std::function<Batch_t>(llvm::jitTargetAddressToPointer<Batch_t *>(*A));
+    else
+        return A.takeError();
+}
@@ -0,0 +1,104 @@
+#include "CompileBudget.h"
+
+#include <algorithm>
+
+const unsigned CompileBudget::MaxOptLevel;
+
+/// Weight of the most recent measurement in the cost model
+static const double CostSmoothing = 0.2;
+
+/// Modules this small say more about fixed overhead than about the cost per
+/// instruction, so they do not update the model.
+static const unsigned MinSampleInstructions = 200;
+
+CompileBudget::CompileBudget() :
+    BudgetMs(0),
+    LargeFunctionThreshold(0),
+    MinOptLevel(0),
+    CostPerInstruction{0.0002, 0.0008, 0.0015, 0.002},
+    NumDowngradedModules(0)
+{
+}
+
+void CompileBudget::setBudget(double BudgetMs, unsigned LargeFunctionThreshold,
+                              unsigned MinOptLevel)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    this->BudgetMs = BudgetMs;
+    this->LargeFunctionThreshold = LargeFunctionThreshold;
+    this->MinOptLevel = std::min(MinOptLevel, MaxOptLevel);
+}
+
+void CompileBudget::setReportHandler(ReportHandler Handler)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    this->Handler = std::move(Handler);
+}
+
+bool CompileBudget::isEnabled() const
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return BudgetMs > 0;
+}
+
+unsigned CompileBudget::getLargeFunctionThreshold() const
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return BudgetMs > 0 ? LargeFunctionThreshold : 0;
+}
+
+unsigned CompileBudget::selectOptLevel(unsigned RequestedOptLevel,
+                                       unsigned Instructions,
+                                       double &ProjectedMs) const
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    unsigned OptLevel = std::min(RequestedOptLevel, MaxOptLevel);
+    ProjectedMs = CostPerInstruction[OptLevel] * Instructions;
+
+    if (BudgetMs <= 0)
+        return OptLevel;
+
+    while (OptLevel > MinOptLevel && ProjectedMs > BudgetMs)
+    {
+        OptLevel--;
+        ProjectedMs = CostPerInstruction[OptLevel] * Instructions;
+    }
+
+    return OptLevel;
+}
+
+void CompileBudget::record(const CompileReport &Report)
+{
+    ReportHandler Notify;
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+
+        unsigned Level = std::min(Report.OptLevel, MaxOptLevel);
+
+        if (Report.Instructions >= MinSampleInstructions)
+        {
+            double Measured = Report.ElapsedMs / Report.Instructions;
+            CostPerInstruction[Level] = (1 - CostSmoothing) * CostPerInstruction[Level] +
+                                        CostSmoothing * Measured;
+        }
+
+        if (!Report.isDowngraded())
+            return;
+
+        NumDowngradedModules++;
+        Notify = Handler;
+    }
+
+    // The handler runs outside the lock so that it may query the budget.
+    if (Notify)
+        Notify(Report);
+}
+
+unsigned CompileBudget::getNumDowngradedModules() const
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return NumDowngradedModules;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+
+#include <functional>
+#include <mutex>
+#include <string>
+
+/// What the optimizer decided for one module
+struct CompileReport
+{
+    std::string ModuleName;
+
+    /// Number of IR instructions before optimization
+    unsigned Instructions = 0;
+
+    unsigned RequestedOptLevel = 0;
+    unsigned OptLevel = 0;
+
+    /// Functions above the size threshold, optimized for size instead
+    unsigned ReducedFunctions = 0;
+
+    double ProjectedMs = 0;
+    double ElapsedMs = 0;
+
+    bool isDowngraded() const
+    {
+        return OptLevel < RequestedOptLevel || ReducedFunctions > 0;
+    }
+};
+
+/// Compile budget
+///
+/// Bounds the time spent in the IR optimizer for a single module. The cost
+/// of optimizing one instruction at each opt level is learned from the
+/// modules compiled so far; a module whose projected optimization time
+/// exceeds the budget is compiled at a lower opt level. Independently of
+/// the projection, functions above the size threshold are optimized for
+/// size, which caps inlining into them and disables loop unrolling.
+///
+/// The budget is disabled until setBudget is called. It is shared by every
+/// concurrent invocation of the optimizer and is thread safe.
+class CompileBudget
+{
+
+public:
+    using ReportHandler = std::function<void(const CompileReport &)>;
+
+    CompileBudget();
+
+    /// Enable the budget. A BudgetMs of zero disables it again.
+    void setBudget(double BudgetMs, unsigned LargeFunctionThreshold = 2000,
+                   unsigned MinOptLevel = 1);
+
+    /// Called for every module whose code was downgraded.
+    void setReportHandler(ReportHandler Handler);
+
+    bool isEnabled() const;
+
+    unsigned getLargeFunctionThreshold() const;
+
+    /// Pick the opt level for a module of Instructions IR instructions.
+    unsigned selectOptLevel(unsigned RequestedOptLevel, unsigned Instructions,
+                            double &ProjectedMs) const;
+
+    /// Feed the measured optimization time back into the cost model and
+    /// report the module if it was downgraded.
+    void record(const CompileReport &Report);
+
+    unsigned getNumDowngradedModules() const;
+
+private:
+    static const unsigned MaxOptLevel = 3;
+
+    mutable std::mutex Mutex;
+
+    double BudgetMs;
+    unsigned LargeFunctionThreshold;
+    unsigned MinOptLevel;
+
+    /// Estimated milliseconds per IR instruction, per opt level
+    double CostPerInstruction[MaxOptLevel + 1];
+
+    unsigned NumDowngradedModules;
+
+    ReportHandler Handler;
+};
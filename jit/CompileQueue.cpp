@@ -0,0 +1,82 @@
+#include "CompileQueue.h"
+
+#include <algorithm>
+
+using namespace llvm;
+
+CompileQueue::CompileQueue(unsigned NumThreads, size_t Capacity)
+    : Capacity(std::max<size_t>(Capacity, 1))
+{
+    for (unsigned i = 0; i < std::max(NumThreads, 1u); i++)
+        Workers.emplace_back([this]() { work(); });
+}
+
+CompileQueue::~CompileQueue()
+{
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Stopping = true;
+    }
+
+    Ready.notify_all();
+
+    for (std::thread &Worker : Workers)
+        Worker.join();
+}
+
+Error CompileQueue::submit(CompilePriority Priority, Task T)
+{
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+
+        size_t Pending = Priority == CompilePriority::Interactive
+                             ? Interactive.size()
+                             : Interactive.size() + Background.size();
+
+        if (Stopping || Pending >= Capacity)
+            return createStringError(inconvertibleErrorCode(),
+                                     "compile queue full");
+
+        if (Priority == CompilePriority::Interactive)
+            Interactive.push_back(std::move(T));
+        else
+            Background.push_back(std::move(T));
+    }
+
+    Ready.notify_one();
+    return Error::success();
+}
+
+size_t CompileQueue::getNumPending() const
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return Interactive.size() + Background.size();
+}
+
+void CompileQueue::work()
+{
+    while (true)
+    {
+        Task T;
+
+        {
+            std::unique_lock<std::mutex> Lock(Mutex);
+
+            Ready.wait(Lock, [this]() {
+                return Stopping || !Interactive.empty() || !Background.empty();
+            });
+
+            std::deque<Task> &Queue =
+                !Interactive.empty() ? Interactive : Background;
+
+            // Stopping, and nothing left to drain
+            if (Queue.empty())
+                return;
+
+            T = std::move(Queue.front());
+            Queue.pop_front();
+        }
+
+        T();
+    }
+}
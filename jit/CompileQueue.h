@@ -0,0 +1,65 @@
+#pragma once
+
+#include <llvm/ADT/FunctionExtras.h>
+#include <llvm/Support/Error.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum class CompilePriority
+{
+    /// Someone is waiting for the result, e.g. to run a function.
+    Interactive,
+
+    /// Precompilation and recompilation nobody is waiting for yet.
+    Background
+};
+
+/// Compile queue
+///
+/// A fixed set of worker threads running compile tasks, interactive tasks
+/// first. The queue is bounded: instead of blocking the submitter, submit
+/// fails once Capacity tasks of the same priority are pending, so that the
+/// caller can shed or retry the work. Interactive tasks count against the
+/// background bound, but background tasks do not count against the
+/// interactive one, so a backlog of background work never locks out
+/// interactive requests.
+///
+/// Tasks still queued when the queue is destroyed are run before the
+/// workers are joined.
+class CompileQueue
+{
+
+public:
+    using Task = llvm::unique_function<void()>;
+
+    CompileQueue(unsigned NumThreads, size_t Capacity);
+    ~CompileQueue();
+
+    CompileQueue(const CompileQueue &) = delete;
+    CompileQueue &operator=(const CompileQueue &) = delete;
+
+    /// Queue T, or fail with "compile queue full" without queueing it.
+    llvm::Error submit(CompilePriority Priority, Task T);
+
+    size_t getNumPending() const;
+
+private:
+    size_t Capacity;
+
+    mutable std::mutex Mutex;
+    std::condition_variable Ready;
+
+    std::deque<Task> Interactive;
+    std::deque<Task> Background;
+    bool Stopping = false;
+
+    std::vector<std::thread> Workers;
+
+    void work();
+
+};
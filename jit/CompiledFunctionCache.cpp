@@ -0,0 +1,143 @@
+#include "CompiledFunctionCache.h"
+
+#include <algorithm>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+CompiledFunctionCache::CompiledFunctionCache(JitEngine &JIT, size_t Capacity,
+                                             size_t MaxAliasesPerEntry) :
+    JIT(JIT),
+    Capacity(std::max<size_t>(Capacity, 1)),
+    MaxAliasesPerEntry(MaxAliasesPerEntry)
+{
+}
+
+CompiledFunctionCache::~CompiledFunctionCache()
+{
+    // Whatever cannot be unloaded now goes away with the engine.
+    for (const Entry &E : Entries)
+        consumeError(JIT.removeModule(E.K));
+
+    consumeError(std::move(EvictionError));
+}
+
+Expected<JITTargetAddress>
+CompiledFunctionCache::getOrCompile(StringRef Key, CompileFunction Compile)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    auto I = ByKey.find(Key.str());
+    if (I != ByKey.end())
+    {
+        NumHits++;
+        touch(I->second);
+        return I->second->Addr;
+    }
+
+    NumMisses++;
+
+    VModuleKey K = JIT.createModuleKey();
+
+    auto Addr = Compile(K);
+    if (!Addr)
+        return Addr.takeError();
+
+    Entries.push_front(Entry{Key.str(), {}, *Addr, K});
+    ByKey[Key.str()] = Entries.begin();
+
+    while (Entries.size() > Capacity && evict(Entries.begin()))
+        ;
+
+    return *Addr;
+}
+
+JITTargetAddress CompiledFunctionCache::lookupAlias(StringRef Alias)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    auto A = ByAlias.find(Alias.str());
+    if (A == ByAlias.end())
+        return 0;
+
+    NumHits++;
+    touch(A->second);
+    return A->second->Addr;
+}
+
+void CompiledFunctionCache::addAlias(StringRef Key, StringRef Alias)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    auto I = ByKey.find(Key.str());
+    if (I == ByKey.end() || ByAlias.count(Alias.str()) ||
+        I->second->Aliases.size() >= MaxAliasesPerEntry)
+        return;
+
+    I->second->Aliases.push_back(Alias.str());
+    ByAlias[Alias.str()] = I->second;
+}
+
+void CompiledFunctionCache::touch(EntryList::iterator I)
+{
+    Entries.splice(Entries.begin(), Entries, I);
+}
+
+bool CompiledFunctionCache::evict(EntryList::iterator Keep)
+{
+    for (auto I = Entries.end(); I != Entries.begin();)
+    {
+        --I;
+
+        if (I == Keep)
+            continue;
+
+        // Still being materialized: keep it for a later eviction.
+        if (auto Err = JIT.removeModule(I->K))
+        {
+            consumeError(std::move(EvictionError));
+            EvictionError = std::move(Err);
+            NumEvictionFailures++;
+            continue;
+        }
+
+        for (const std::string &Alias : I->Aliases)
+            ByAlias.erase(Alias);
+        ByKey.erase(I->Key);
+
+        Entries.erase(I);
+        return true;
+    }
+
+    return false;
+}
+
+size_t CompiledFunctionCache::size() const
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return Entries.size();
+}
+
+size_t CompiledFunctionCache::getNumHits() const
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return NumHits;
+}
+
+size_t CompiledFunctionCache::getNumMisses() const
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return NumMisses;
+}
+
+size_t CompiledFunctionCache::getNumEvictionFailures() const
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return NumEvictionFailures;
+}
+
+Error CompiledFunctionCache::takeEvictionError()
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return std::move(EvictionError);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ExecutionEngine/JITSymbol.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/Support/Error.h>
+
+#include "JitEngine.h"
+
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Cache of compiled functions
+///
+/// Maps keys to functions that were compiled into modules of their own,
+/// such as compiled expressions (ExpressionCache.h) or specializations
+/// (JitSpecializer.h). A key may also be reached through a few aliases.
+///
+/// The cache holds at most Capacity functions. Once a new one has been
+/// added, the least recently used ones beyond Capacity are unloaded from
+/// the engine; function pointers obtained for them must no longer be
+/// called after that. A failed compilation evicts nothing. A function that
+/// cannot be unloaded yet, because it is still being materialized, stays
+/// cached and is retried at the next eviction, the next least recently
+/// used one being evicted in its place.
+class CompiledFunctionCache
+{
+
+public:
+    CompiledFunctionCache(JitEngine &JIT, size_t Capacity,
+                          size_t MaxAliasesPerEntry = 0);
+
+    /// Unloads every function it can
+    ~CompiledFunctionCache();
+
+    CompiledFunctionCache(const CompiledFunctionCache &) = delete;
+    CompiledFunctionCache &operator=(const CompiledFunctionCache &) = delete;
+
+    /// Compiles the function of a key into a module added under the given
+    /// key, which is unique to the function and can be used to name it.
+    using CompileFunction =
+        llvm::function_ref<llvm::Expected<llvm::JITTargetAddress>(llvm::orc::VModuleKey)>;
+
+    /// Return the address of the function of Key, calling Compile on a
+    /// miss. Compile runs under the cache's lock, so a function requested
+    /// by several threads at once is compiled once.
+    llvm::Expected<llvm::JITTargetAddress> getOrCompile(llvm::StringRef Key,
+                                                        CompileFunction Compile);
+
+    /// Address of the function Alias was added for, or 0
+    llvm::JITTargetAddress lookupAlias(llvm::StringRef Alias);
+
+    /// Make Alias lead to the function of Key, if it is cached and has
+    /// fewer than MaxAliasesPerEntry aliases.
+    void addAlias(llvm::StringRef Key, llvm::StringRef Alias);
+
+    size_t size() const;
+
+    size_t getNumHits() const;
+    size_t getNumMisses() const;
+
+    /// Number of times an evicted function could not be unloaded
+    size_t getNumEvictionFailures() const;
+
+    /// Why an evicted function could last not be unloaded, if one could not
+    /// since the previous call
+    llvm::Error takeEvictionError();
+
+private:
+    struct Entry
+    {
+        std::string Key;
+        std::vector<std::string> Aliases;
+        llvm::JITTargetAddress Addr;
+        llvm::orc::VModuleKey K;
+    };
+
+    using EntryList = std::list<Entry>;
+
+    JitEngine &JIT;
+    size_t Capacity;
+    size_t MaxAliasesPerEntry;
+
+    mutable std::mutex Mutex;
+
+    /// Most recently used first
+    EntryList Entries;
+    std::unordered_map<std::string, EntryList::iterator> ByKey;
+    std::unordered_map<std::string, EntryList::iterator> ByAlias;
+
+    size_t NumHits = 0;
+    size_t NumMisses = 0;
+    size_t NumEvictionFailures = 0;
+    llvm::Error EvictionError = llvm::Error::success();
+
+    void touch(EntryList::iterator I);
+
+    /// Unload the least recently used function that can be, other than
+    /// Keep. Returns whether one was.
+    bool evict(EntryList::iterator Keep);
+};
@@ -0,0 +1,172 @@
+#include "CoroDriver.h"
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+/// Drivers are marked with the name of the coroutine they drive, so that
+/// they can be found again once the module has been optimized.
+static const char *const DriverAttr = "jit-coro-driver";
+
+static const char *const FrameAllocFn = "malloc";
+static const char *const FrameFreeFn = "free";
+
+Value *emitCoroFrameAlloc(IRBuilder<> &B, Module &M, Value *Id)
+{
+    LLVMContext &ctx = M.getContext();
+    Function *fn = B.GetInsertBlock()->getParent();
+
+    BasicBlock *entry = B.GetInsertBlock();
+    BasicBlock *dynAlloc = BasicBlock::Create(ctx, "coro.dyn.alloc", fn);
+    BasicBlock *begin = BasicBlock::Create(ctx, "coro.alloc.done", fn);
+
+    // %need.alloc = call i1 @llvm.coro.alloc(token %id)
+    Value *needAlloc = B.CreateCall(
+        Intrinsic::getDeclaration(&M, Intrinsic::coro_alloc), Id, "need.alloc");
+    B.CreateCondBr(needAlloc, dynAlloc, begin);
+
+    B.SetInsertPoint(dynAlloc);
+
+    // %size = call i32 @llvm.coro.size.i32()
+    Value *size = B.CreateCall(
+        Intrinsic::getDeclaration(&M, Intrinsic::coro_size, B.getInt32Ty()),
+        {}, "size");
+
+    // %alloc = call i8* @malloc(i32 %size)
+    Value *alloc = B.CreateCall(
+        M.getOrInsertFunction(FrameAllocFn,
+                              FunctionType::get(B.getInt8PtrTy(),
+                                                B.getInt32Ty(), false)),
+        size, "alloc");
+    B.CreateBr(begin);
+
+    B.SetInsertPoint(begin);
+
+    PHINode *mem = B.CreatePHI(B.getInt8PtrTy(), 2, "frame.mem");
+    mem->addIncoming(ConstantPointerNull::get(B.getInt8PtrTy()), entry);
+    mem->addIncoming(alloc, dynAlloc);
+
+    return mem;
+}
+
+void emitCoroFrameFree(IRBuilder<> &B, Module &M, Value *Id, Value *Hdl)
+{
+    // %mem = call i8* @llvm.coro.free(token %id, i8* %hdl)
+    Value *mem = B.CreateCall(
+        Intrinsic::getDeclaration(&M, Intrinsic::coro_free), {Id, Hdl}, "mem");
+
+    // call void @free(i8* %mem)
+    B.CreateCall(
+        M.getOrInsertFunction(FrameFreeFn,
+                              FunctionType::get(B.getVoidTy(),
+                                                B.getInt8PtrTy(), false)),
+        mem);
+}
+
+Expected<Function *> emitCoroDriver(Module &M, Function &Coro, StringRef Name,
+                                    CoroSuspendFn OnSuspend)
+{
+    LLVMContext &ctx = M.getContext();
+    IRBuilder<> B(ctx);
+
+    if (Coro.getParent() != &M)
+        return createStringError(inconvertibleErrorCode(),
+                                 "Coroutine '%s' is not defined in module '%s'",
+                                 Coro.getName().str().c_str(),
+                                 M.getName().str().c_str());
+
+    if (Coro.getReturnType() != Type::getInt8PtrTy(ctx))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Coroutine '%s' does not return its handle",
+                                 Coro.getName().str().c_str());
+
+    auto signature = FunctionType::get(
+        Type::getVoidTy(ctx), Coro.getFunctionType()->params(), false);
+
+    auto fn = Function::Create(signature, Function::ExternalLinkage, Name, M);
+    fn->addFnAttr(DriverAttr, Coro.getName());
+
+    std::vector<Value *> args;
+    for (Argument &A : fn->args())
+        args.push_back(&A);
+
+    BasicBlock *entry = BasicBlock::Create(ctx, "entry", fn);
+    BasicBlock *loop = BasicBlock::Create(ctx, "loop", fn);
+    BasicBlock *body = BasicBlock::Create(ctx, "body", fn);
+    BasicBlock *end = BasicBlock::Create(ctx, "end", fn);
+
+    B.SetInsertPoint(entry);
+
+    // %hdl = call i8* @coro(...)
+    Value *hdl = B.CreateCall(&Coro, args, "hdl");
+    B.CreateBr(loop);
+
+    B.SetInsertPoint(loop);
+
+    // %done = call i1 @llvm.coro.done(i8* %hdl)
+    Value *done = B.CreateCall(
+        Intrinsic::getDeclaration(&M, Intrinsic::coro_done), hdl, "done");
+    B.CreateCondBr(done, end, body);
+
+    B.SetInsertPoint(body);
+
+    if (OnSuspend)
+        OnSuspend(B, hdl);
+
+    // call void @llvm.coro.resume(i8* %hdl)
+    B.CreateCall(Intrinsic::getDeclaration(&M, Intrinsic::coro_resume), hdl);
+    B.CreateBr(loop);
+
+    B.SetInsertPoint(end);
+
+    // call void @llvm.coro.destroy(i8* %hdl)
+    B.CreateCall(Intrinsic::getDeclaration(&M, Intrinsic::coro_destroy), hdl);
+    B.CreateRetVoid();
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyFunction(*fn, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Function verification failed: %s",
+                                 es.str().c_str());
+
+    return fn;
+}
+
+std::vector<CoroElisionReport> checkCoroElision(const Module &M)
+{
+    std::vector<CoroElisionReport> Reports;
+
+    for (const Function &F : M)
+    {
+        if (F.isDeclaration() || !F.hasFnAttribute(DriverAttr))
+            continue;
+
+        CoroElisionReport Report;
+        Report.Driver = F.getName().str();
+        Report.Coroutine =
+            F.getFnAttribute(DriverAttr).getValueAsString().str();
+        Report.Elided = true;
+
+        for (const Instruction &I : instructions(F))
+        {
+            auto *Call = dyn_cast<CallBase>(&I);
+            if (!Call || !Call->getCalledFunction())
+                continue;
+
+            StringRef Callee = Call->getCalledFunction()->getName();
+            if (Callee == Report.Coroutine || Callee == FrameAllocFn)
+                Report.Elided = false;
+        }
+
+        Reports.push_back(std::move(Report));
+    }
+
+    return Reports;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Error.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/// Coroutine drivers
+///
+/// A coroutine whose handle escapes to the host (through wrappers of
+/// llvm.coro.resume and friends) must keep its frame on the heap. When the
+/// loop that drives the coroutine is itself JIT code, the optimizer can
+/// inline the ramp function into it and CoroElide can move the frame to the
+/// driver's stack.
+///
+/// For elision to happen the coroutine must allocate its frame under
+/// llvm.coro.alloc (see emitCoroFrameAlloc), it must end in a final
+/// suspend point, and the handle must not escape the driver.
+
+/// Allocate the frame of a coroutine with malloc, unless llvm.coro.alloc
+/// says the frame has been elided. B must be positioned after the
+/// llvm.coro.id call Id; on return it is positioned at the end of a new
+/// block, and the result is the memory to pass to llvm.coro.begin.
+llvm::Value *emitCoroFrameAlloc(llvm::IRBuilder<> &B, llvm::Module &M,
+                                llvm::Value *Id);
+
+/// Free the frame in the cleanup path of a coroutine. Once the frame has
+/// been elided llvm.coro.free returns null and the call folds away.
+void emitCoroFrameFree(llvm::IRBuilder<> &B, llvm::Module &M, llvm::Value *Id,
+                       llvm::Value *Hdl);
+
+/// Emitted in the driver loop, each time the coroutine is suspended at a
+/// point other than the final one, before it is resumed. It may read the
+/// promise of Hdl but must not let Hdl escape.
+using CoroSuspendFn = std::function<void(llvm::IRBuilder<> &B, llvm::Value *Hdl)>;
+
+/// Create `void Name(<arguments of Coro>)`, which starts Coro, resumes it
+/// until it is done and destroys it. Coro must be a switch-resumed
+/// coroutine that returns its handle.
+llvm::Expected<llvm::Function *>
+emitCoroDriver(llvm::Module &M, llvm::Function &Coro, llvm::StringRef Name,
+               CoroSuspendFn OnSuspend = nullptr);
+
+/// Outcome of heap elision for one driver
+struct CoroElisionReport
+{
+    std::string Driver;
+    std::string Coroutine;
+
+    /// The ramp was inlined into the driver and no frame allocation is
+    /// left in it.
+    bool Elided = false;
+};
+
+/// Check the drivers of an optimized module.
+std::vector<CoroElisionReport> checkCoroElision(const llvm::Module &M);
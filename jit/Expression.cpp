@@ -0,0 +1,449 @@
+#include "Expression.h"
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <cctype>
+#include <vector>
+
+using namespace llvm;
+
+namespace {
+
+std::unique_ptr<Expr> makeConstant(const APInt &Value)
+{
+    auto E = std::make_unique<Expr>();
+    E->K = Expr::Constant;
+    E->Value = Value;
+    return E;
+}
+
+std::unique_ptr<Expr> makeNode(Expr::Kind K, std::unique_ptr<Expr> LHS,
+                               std::unique_ptr<Expr> RHS = nullptr)
+{
+    auto E = std::make_unique<Expr>();
+    E->K = K;
+    E->LHS = std::move(LHS);
+    E->RHS = std::move(RHS);
+    return E;
+}
+
+/// Recursive descent parser for the grammar in Expression.h
+class ExprParser
+{
+
+public:
+    ExprParser(StringRef Source, ArrayRef<std::string> Params, unsigned BitWidth)
+        : Source(Source), Params(Params), BitWidth(BitWidth), Pos(0) {}
+
+    Expected<std::unique_ptr<Expr>> parse()
+    {
+        auto E = parseSum();
+        if (!E)
+            return E.takeError();
+
+        skipSpace();
+        if (Pos != Source.size())
+            return error("unexpected character");
+
+        return E;
+    }
+
+private:
+    StringRef Source;
+    ArrayRef<std::string> Params;
+    unsigned BitWidth;
+    size_t Pos;
+
+    Error error(const char *What)
+    {
+        return createStringError(inconvertibleErrorCode(),
+                                 "Expression '%s', column %zu: %s",
+                                 Source.str().c_str(), Pos + 1, What);
+    }
+
+    void skipSpace()
+    {
+        while (Pos < Source.size() && isspace((unsigned char)Source[Pos]))
+            Pos++;
+    }
+
+    bool consume(char C)
+    {
+        skipSpace();
+        if (Pos < Source.size() && Source[Pos] == C)
+        {
+            Pos++;
+            return true;
+        }
+        return false;
+    }
+
+    Expected<std::unique_ptr<Expr>> parseSum()
+    {
+        auto LHS = parseProduct();
+        if (!LHS)
+            return LHS.takeError();
+
+        std::unique_ptr<Expr> E = std::move(*LHS);
+
+        while (true)
+        {
+            Expr::Kind K;
+            if (consume('+'))
+                K = Expr::Add;
+            else if (consume('-'))
+                K = Expr::Sub;
+            else
+                return std::move(E);
+
+            auto RHS = parseProduct();
+            if (!RHS)
+                return RHS.takeError();
+
+            E = makeNode(K, std::move(E), std::move(*RHS));
+        }
+    }
+
+    Expected<std::unique_ptr<Expr>> parseProduct()
+    {
+        auto LHS = parseUnary();
+        if (!LHS)
+            return LHS.takeError();
+
+        std::unique_ptr<Expr> E = std::move(*LHS);
+
+        while (true)
+        {
+            Expr::Kind K;
+            if (consume('*'))
+                K = Expr::Mul;
+            else if (consume('/'))
+                K = Expr::Div;
+            else if (consume('%'))
+                K = Expr::Rem;
+            else
+                return std::move(E);
+
+            auto RHS = parseUnary();
+            if (!RHS)
+                return RHS.takeError();
+
+            E = makeNode(K, std::move(E), std::move(*RHS));
+        }
+    }
+
+    Expected<std::unique_ptr<Expr>> parseUnary()
+    {
+        if (consume('-'))
+        {
+            auto Operand = parseUnary();
+            if (!Operand)
+                return Operand.takeError();
+
+            return makeNode(Expr::Neg, std::move(*Operand));
+        }
+
+        return parsePrimary();
+    }
+
+    Expected<std::unique_ptr<Expr>> parsePrimary()
+    {
+        if (consume('('))
+        {
+            auto E = parseSum();
+            if (!E)
+                return E.takeError();
+
+            if (!consume(')'))
+                return error("expected ')'");
+
+            return E;
+        }
+
+        skipSpace();
+        size_t Start = Pos;
+
+        if (Pos < Source.size() && isdigit((unsigned char)Source[Pos]))
+        {
+            while (Pos < Source.size() && isdigit((unsigned char)Source[Pos]))
+                Pos++;
+
+            APInt Value;
+            if (Source.slice(Start, Pos).getAsInteger(10, Value) ||
+                Value.getActiveBits() > BitWidth)
+            {
+                Pos = Start;
+                return error("integer literal out of range");
+            }
+
+            return makeConstant(Value.zextOrTrunc(BitWidth));
+        }
+
+        if (Pos < Source.size() &&
+            (isalpha((unsigned char)Source[Pos]) || Source[Pos] == '_'))
+        {
+            while (Pos < Source.size() &&
+                   (isalnum((unsigned char)Source[Pos]) || Source[Pos] == '_'))
+                Pos++;
+
+            StringRef Name = Source.slice(Start, Pos);
+
+            for (unsigned I = 0; I < Params.size(); I++)
+            {
+                if (Params[I] == Name)
+                {
+                    auto E = std::make_unique<Expr>();
+                    E->K = Expr::Param;
+                    E->Index = I;
+                    return std::move(E);
+                }
+            }
+
+            Pos = Start;
+            return error("unknown parameter");
+        }
+
+        return error("expected a number, a parameter or '('");
+    }
+};
+
+bool isConstant(const Expr &E, uint64_t V)
+{
+    return E.K == Expr::Constant && E.Value == V;
+}
+
+/// Fold a binary operation on two constants. Returns false for the
+/// operations that are undefined at run time, which are left alone.
+bool fold(Expr::Kind K, const APInt &L, const APInt &R, APInt &Result)
+{
+    switch (K)
+    {
+    case Expr::Add: Result = L + R; return true;
+    case Expr::Sub: Result = L - R; return true;
+    case Expr::Mul: Result = L * R; return true;
+    case Expr::Div:
+    case Expr::Rem:
+        if (R.isNullValue() || (L.isMinSignedValue() && R.isAllOnesValue()))
+            return false;
+        Result = K == Expr::Div ? L.sdiv(R) : L.srem(R);
+        return true;
+    default:
+        return false;
+    }
+}
+
+/// Collect the operands of a chain of K (Add or Mul) rooted at E.
+void flatten(Expr::Kind K, std::unique_ptr<Expr> E,
+             std::vector<std::unique_ptr<Expr>> &Operands)
+{
+    if (E->K != K)
+    {
+        Operands.push_back(std::move(E));
+        return;
+    }
+
+    flatten(K, std::move(E->LHS), Operands);
+    flatten(K, std::move(E->RHS), Operands);
+}
+
+std::unique_ptr<Expr> normalizeChain(Expr::Kind K, std::unique_ptr<Expr> E)
+{
+    std::vector<std::unique_ptr<Expr>> Operands;
+    flatten(K, std::move(E), Operands);
+
+    std::vector<std::pair<std::string, std::unique_ptr<Expr>>> Terms;
+    std::unique_ptr<Expr> Folded;
+
+    for (auto &Op : Operands)
+    {
+        if (Op->K != Expr::Constant)
+        {
+            std::string Key = printExpr(*Op);
+            Terms.emplace_back(std::move(Key), std::move(Op));
+            continue;
+        }
+
+        if (!Folded)
+            Folded = std::move(Op);
+        else
+            fold(K, Folded->Value, Op->Value, Folded->Value);
+    }
+
+    if (Folded)
+    {
+        // x * 0 is 0; + 0 and * 1 are neutral.
+        if (K == Expr::Mul && Folded->Value.isNullValue())
+            return Folded;
+
+        if (Folded->Value == (K == Expr::Add ? 0 : 1) && !Terms.empty())
+            Folded.reset();
+    }
+
+    std::stable_sort(Terms.begin(), Terms.end(),
+                     [](const std::pair<std::string, std::unique_ptr<Expr>> &L,
+                        const std::pair<std::string, std::unique_ptr<Expr>> &R) {
+                         return L.first < R.first;
+                     });
+
+    std::unique_ptr<Expr> Result;
+
+    for (auto &Term : Terms)
+        Result = Result ? makeNode(K, std::move(Result), std::move(Term.second))
+                        : std::move(Term.second);
+
+    if (Folded)
+        Result = Result ? makeNode(K, std::move(Result), std::move(Folded))
+                        : std::move(Folded);
+
+    return Result;
+}
+
+Value *emit(IRBuilder<> &B, const Expr &E, ArrayRef<Value *> Args)
+{
+    switch (E.K)
+    {
+    case Expr::Constant: return B.getInt(E.Value);
+    case Expr::Param:    return Args[E.Index];
+    case Expr::Neg:      return B.CreateNeg(emit(B, *E.LHS, Args));
+    default:
+        break;
+    }
+
+    Value *L = emit(B, *E.LHS, Args);
+    Value *R = emit(B, *E.RHS, Args);
+
+    switch (E.K)
+    {
+    case Expr::Add: return B.CreateAdd(L, R);
+    case Expr::Sub: return B.CreateSub(L, R);
+    case Expr::Mul: return B.CreateMul(L, R);
+    case Expr::Div: return B.CreateSDiv(L, R);
+    case Expr::Rem: return B.CreateSRem(L, R);
+    default:
+        llvm_unreachable("Not a binary expression");
+    }
+}
+
+} // end anonymous namespace
+
+Expected<std::unique_ptr<Expr>> parseExpr(StringRef Source,
+                                          ArrayRef<std::string> Params,
+                                          unsigned BitWidth)
+{
+    return ExprParser(Source, Params, BitWidth).parse();
+}
+
+std::unique_ptr<Expr> normalizeExpr(std::unique_ptr<Expr> E)
+{
+    if (E->LHS)
+        E->LHS = normalizeExpr(std::move(E->LHS));
+    if (E->RHS)
+        E->RHS = normalizeExpr(std::move(E->RHS));
+
+    switch (E->K)
+    {
+    case Expr::Constant:
+    case Expr::Param:
+        return E;
+
+    case Expr::Neg:
+        if (E->LHS->K == Expr::Constant)
+            return makeConstant(-E->LHS->Value);
+        if (E->LHS->K == Expr::Neg)
+            return std::move(E->LHS->LHS);
+        return E;
+
+    case Expr::Sub:
+        // x - c  ==>  x + (-c), which then joins the addition chain
+        if (E->RHS->K == Expr::Constant)
+        {
+            E->K = Expr::Add;
+            E->RHS = makeConstant(-E->RHS->Value);
+            return normalizeChain(Expr::Add, std::move(E));
+        }
+        if (E->LHS->K == Expr::Constant && E->LHS->Value.isNullValue())
+            return normalizeExpr(makeNode(Expr::Neg, std::move(E->RHS)));
+        return E;
+
+    case Expr::Add:
+    case Expr::Mul:
+        return normalizeChain(E->K, std::move(E));
+
+    case Expr::Div:
+    case Expr::Rem:
+    {
+        APInt Result;
+        if (E->LHS->K == Expr::Constant && E->RHS->K == Expr::Constant &&
+            fold(E->K, E->LHS->Value, E->RHS->Value, Result))
+            return makeConstant(Result);
+
+        if (isConstant(*E->RHS, 1))
+            return E->K == Expr::Div
+                       ? std::move(E->LHS)
+                       : makeConstant(APInt(E->RHS->Value.getBitWidth(), 0));
+        return E;
+    }
+    }
+
+    return E;
+}
+
+std::string printExpr(const Expr &E)
+{
+    switch (E.K)
+    {
+    case Expr::Constant: return E.Value.toString(10, true);
+    case Expr::Param:    return "$" + std::to_string(E.Index);
+    case Expr::Neg:      return "(neg " + printExpr(*E.LHS) + ")";
+    default:
+        break;
+    }
+
+    const char *Op = "";
+    switch (E.K)
+    {
+    case Expr::Add: Op = "+"; break;
+    case Expr::Sub: Op = "-"; break;
+    case Expr::Mul: Op = "*"; break;
+    case Expr::Div: Op = "/"; break;
+    case Expr::Rem: Op = "%"; break;
+    default: break;
+    }
+
+    return std::string("(") + Op + " " + printExpr(*E.LHS) + " " +
+           printExpr(*E.RHS) + ")";
+}
+
+Expected<Function *> emitExpr(Module &M, StringRef Name, const Expr &E,
+                              unsigned NumParams, unsigned BitWidth)
+{
+    LLVMContext &ctx = M.getContext();
+    IRBuilder<> B(ctx);
+
+    auto argTy = Type::getIntNTy(ctx, BitWidth);
+    std::vector<Type *> argTys(NumParams, argTy);
+    auto signature = FunctionType::get(argTy, argTys, false);
+
+    auto fn = Function::Create(signature, Function::ExternalLinkage, Name, M);
+
+    std::vector<Value *> Args;
+    for (Argument &A : fn->args())
+        Args.push_back(&A);
+
+    B.SetInsertPoint(BasicBlock::Create(ctx, "entry", fn));
+    B.CreateRet(emit(B, E, Args));
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyFunction(*fn, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Function verification failed: %s",
+                                 es.str().c_str());
+
+    return fn;
+}
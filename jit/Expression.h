@@ -0,0 +1,60 @@
+#pragma once
+
+#include <llvm/ADT/APInt.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Error.h>
+
+#include <memory>
+#include <string>
+
+/// Integer expressions
+///
+/// A small expression language over the parameters of a function:
+///
+///     expr    := term (('+' | '-') term)*
+///     term    := unary (('*' | '/' | '%') unary)*
+///     unary   := '-' unary | primary
+///     primary := number | identifier | '(' expr ')'
+///
+/// All values are integers of one bit width with wrapping arithmetic;
+/// division and remainder are signed. An expression over N parameters is
+/// compiled to a function taking N integers and returning one, so
+/// "x * y + z" over (x, y, z) is the mul_add of sample/simple.cpp.
+struct Expr
+{
+    enum Kind { Constant, Param, Neg, Add, Sub, Mul, Div, Rem };
+
+    Kind K;
+
+    /// Value of a Constant
+    llvm::APInt Value;
+
+    /// Position of a Param in the parameter list
+    unsigned Index = 0;
+
+    /// Operands; Neg only uses LHS
+    std::unique_ptr<Expr> LHS, RHS;
+};
+
+llvm::Expected<std::unique_ptr<Expr>>
+parseExpr(llvm::StringRef Source, llvm::ArrayRef<std::string> Params,
+          unsigned BitWidth);
+
+/// Rewrite E into a canonical form: constants are folded, neutral operands
+/// dropped, subtraction of constants becomes addition, and chains of
+/// additions or multiplications are flattened and their operands sorted.
+/// Expressions that only differ in those respects normalize to the same
+/// tree, and parameter names are already gone after parsing.
+std::unique_ptr<Expr> normalizeExpr(std::unique_ptr<Expr> E);
+
+/// Print E as an s-expression with parameters as $0, $1, ... Two
+/// normalized expressions compute the same function if they print the same.
+std::string printExpr(const Expr &E);
+
+/// Emit E as an external function Name(i<BitWidth> x NumParams) into M.
+llvm::Expected<llvm::Function *> emitExpr(llvm::Module &M, llvm::StringRef Name,
+                                          const Expr &E, unsigned NumParams,
+                                          unsigned BitWidth);
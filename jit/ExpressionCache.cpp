@@ -0,0 +1,104 @@
+#include "ExpressionCache.h"
+#include "Expression.h"
+
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+const size_t ExpressionCache::MaxSourcesPerEntry;
+
+ExpressionCache::ExpressionCache(JitEngine &JIT, JITDylib &Tenant,
+                                 size_t Capacity, unsigned BitWidth) :
+    JIT(JIT),
+    Tenant(Tenant),
+    BitWidth(BitWidth),
+    Cache(JIT, Capacity, MaxSourcesPerEntry)
+{
+}
+
+/// The source index key: the text plus the parameter list, since the same
+/// text means a different function over different parameters.
+static std::string getSourceKey(StringRef Source, ArrayRef<std::string> Params)
+{
+    std::string Key = Source.str();
+
+    for (const std::string &P : Params)
+    {
+        Key += '\0';
+        Key += P;
+    }
+
+    return Key;
+}
+
+Expected<JITTargetAddress>
+ExpressionCache::getAddress(StringRef Source, ArrayRef<std::string> Params)
+{
+    std::string SourceKey = getSourceKey(Source, Params);
+
+    if (JITTargetAddress A = Cache.lookupAlias(SourceKey))
+        return A;
+
+    auto E = parseExpr(Source, Params, BitWidth);
+    if (!E)
+        return E.takeError();
+
+    std::unique_ptr<Expr> Normalized = normalizeExpr(std::move(*E));
+
+    // The arity is part of the function's type, so it is part of the key.
+    std::string Canonical = std::to_string(Params.size()) + ":" +
+                            printExpr(*Normalized);
+
+    auto Addr = Cache.getOrCompile(Canonical, [&](VModuleKey K) {
+        return compile(*Normalized, Params.size(), K);
+    });
+
+    if (Addr)
+        Cache.addAlias(Canonical, SourceKey);
+
+    return Addr;
+}
+
+Expected<JITTargetAddress> ExpressionCache::compile(const Expr &E,
+                                                    unsigned NumParams,
+                                                    VModuleKey K)
+{
+    std::string Name = "__expr." + std::to_string(K);
+
+    // Not the engine's context: the types and constants of an expression
+    // are freed along with its module.
+    auto Ctx = std::make_unique<LLVMContext>();
+    auto module = std::make_unique<Module>(Name, *Ctx);
+    module->setDataLayout(JIT.getDataLayout());
+
+    if (auto Err = emitExpr(*module, Name, E, NumParams, BitWidth).takeError())
+        return std::move(Err);
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyModule(*module, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Module verification failed: %s",
+                                 es.str().c_str());
+
+    if (auto Err = JIT.addModule(Tenant,
+                                 ThreadSafeModule(std::move(module), std::move(Ctx)),
+                                 K))
+        return std::move(Err);
+
+    auto Addr = JIT.getFunctionAddr(Tenant, Name);
+    if (!Addr)
+    {
+        consumeError(JIT.removeModule(K));
+        return Addr.takeError();
+    }
+
+    return *Addr;
+}
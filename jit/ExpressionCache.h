@@ -0,0 +1,83 @@
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ExecutionEngine/JITSymbol.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/Support/Error.h>
+
+#include "CompiledFunctionCache.h"
+#include "JitEngine.h"
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+struct Expr;
+
+/// Compiled expression cache
+///
+/// Compiles expressions of the language in Expression.h and caches the
+/// resulting code by the canonical form of the expression, so that
+/// expressions that only differ in parameter names, operand order or
+/// constant arithmetic share one compiled function. A second index on the
+/// exact source text lets a repeated expression skip parsing as well.
+///
+/// The cache holds at most Capacity functions (see CompiledFunctionCache.h);
+/// function pointers obtained for an evicted expression must no longer be
+/// called.
+class ExpressionCache
+{
+
+public:
+    ExpressionCache(JitEngine &JIT, size_t Capacity, unsigned BitWidth = 64)
+        : ExpressionCache(JIT, JIT.getDefaultTenant(), Capacity, BitWidth) {}
+
+    ExpressionCache(JitEngine &JIT, llvm::orc::JITDylib &Tenant,
+                    size_t Capacity, unsigned BitWidth = 64);
+
+    ExpressionCache(const ExpressionCache &) = delete;
+    ExpressionCache &operator=(const ExpressionCache &) = delete;
+
+    /// Return the address of the function computing Source over Params,
+    /// compiling it on a miss.
+    llvm::Expected<llvm::JITTargetAddress>
+    getAddress(llvm::StringRef Source, llvm::ArrayRef<std::string> Params);
+
+    /// Signature_t must take Params.size() integers of the cache's bit width
+    /// and return one.
+    template <class Signature_t>
+    llvm::Expected<std::function<Signature_t>>
+    get(llvm::StringRef Source, llvm::ArrayRef<std::string> Params)
+    {
+        if (auto A = getAddress(Source, Params))
+            return std::function<Signature_t>(
+                llvm::jitTargetAddressToPointer<Signature_t *>(*A));
+        else
+            return A.takeError();
+    }
+
+    size_t size() const { return Cache.size(); }
+
+    size_t getNumHits() const { return Cache.getNumHits(); }
+    size_t getNumMisses() const { return Cache.getNumMisses(); }
+
+    /// See CompiledFunctionCache::takeEvictionError
+    llvm::Error takeEvictionError() { return Cache.takeEvictionError(); }
+
+private:
+    /// Source texts aliased to one entry are capped so that an expression
+    /// written in many ways cannot grow the source index without bound.
+    static const size_t MaxSourcesPerEntry = 8;
+
+    JitEngine &JIT;
+    llvm::orc::JITDylib &Tenant;
+    unsigned BitWidth;
+
+    /// By canonical form, with the source texts seen for it as aliases
+    CompiledFunctionCache Cache;
+
+    llvm::Expected<llvm::JITTargetAddress> compile(const Expr &E,
+                                            unsigned NumParams,
+                                            llvm::orc::VModuleKey K);
+};
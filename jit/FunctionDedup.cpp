@@ -0,0 +1,377 @@
+#include "FunctionDedup.h"
+
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include <algorithm>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+/// Collect the globals used by V. Returns false if one of them cannot be
+/// referred to from another module.
+static bool collectGlobals(const Value *V, SmallPtrSetImpl<const Value *> &Visited,
+                           std::vector<const GlobalValue *> &Globals)
+{
+    if (!Visited.insert(V).second)
+        return true;
+
+    if (auto *GV = dyn_cast<GlobalValue>(V))
+    {
+        if (GV->hasLocalLinkage() || isa<GlobalIndirectSymbol>(GV))
+            return false;
+
+        Globals.push_back(GV);
+        return true;
+    }
+
+    if (auto *C = dyn_cast<Constant>(V))
+        for (const Value *Op : C->operands())
+            if (!collectGlobals(Op, Visited, Globals))
+                return false;
+
+    return true;
+}
+
+static bool hasABIAttributes(const Function &F)
+{
+    for (const Argument &A : F.args())
+        if (A.hasByValAttr() || A.hasStructRetAttr() || A.hasInAllocaAttr() ||
+            A.hasAttribute(Attribute::InReg))
+            return true;
+
+    return false;
+}
+
+/// The body of F, cloned on its own into a scratch module under a fixed
+/// name and printed, so that neither its name nor the numbering of
+/// attribute groups and metadata in its module take part.
+std::string FunctionDeduplicator::getKey(const Function &F, const JITDylib &JD,
+                                         std::vector<std::string> &Refs) const
+{
+    if (F.isDeclaration() || !F.hasExternalLinkage() || F.isVarArg() ||
+        F.getSubprogram() || hasABIAttributes(F) ||
+        F.getInstructionCount() < MinInstructions.load())
+        return "";
+
+    SmallPtrSet<const Value *, 32> Visited;
+    std::vector<const GlobalValue *> Globals;
+
+    Visited.insert(&F);
+
+    if (F.hasPersonalityFn() &&
+        !collectGlobals(F.getPersonalityFn(), Visited, Globals))
+        return "";
+
+    for (const Instruction &I : instructions(F))
+        for (const Value *Op : I.operands())
+            if (!collectGlobals(Op, Visited, Globals))
+                return "";
+
+    Module Scratch("dedup", F.getContext());
+    ValueToValueMapTy VMap;
+
+    for (const GlobalValue *GV : Globals)
+    {
+        if (auto *Fn = dyn_cast<Function>(GV))
+            VMap[GV] = Function::Create(Fn->getFunctionType(),
+                                        GlobalValue::ExternalLinkage,
+                                        Fn->getName(), Scratch);
+        else
+            VMap[GV] = new GlobalVariable(
+                Scratch, GV->getValueType(),
+                cast<GlobalVariable>(GV)->isConstant(),
+                GlobalValue::ExternalLinkage, nullptr, GV->getName());
+    }
+
+    Function *NF = Function::Create(F.getFunctionType(),
+                                    GlobalValue::ExternalLinkage, "fn", Scratch);
+    VMap[&F] = NF;
+
+    auto NA = NF->arg_begin();
+    for (const Argument &A : F.args())
+        VMap[&A] = &*NA++;
+
+    SmallVector<ReturnInst *, 8> Returns;
+    CloneFunctionInto(NF, &F, VMap, false, Returns);
+
+    std::string buffer;
+    raw_string_ostream os(buffer);
+    Scratch.print(os, nullptr);
+    os.flush();
+
+    std::array<uint8_t, 20> Hash =
+        SHA1::hash(ArrayRef<uint8_t>(
+            reinterpret_cast<const uint8_t *>(buffer.data()), buffer.size()));
+
+    std::string Key(Hash.begin(), Hash.end());
+
+    // Names resolve differently in every JITDylib.
+    if (!Globals.empty())
+        Key += "@" + JD.getName();
+
+    for (const GlobalValue *GV : Globals)
+        Refs.push_back(GV->getName().str());
+
+    return Key;
+}
+
+/// Make F a tail call to Target with the same arguments.
+static void replaceWithThunk(Function &F, Value *Target)
+{
+    GlobalValue::LinkageTypes Linkage = F.getLinkage();
+
+    F.deleteBody();
+    F.setLinkage(Linkage);
+
+    IRBuilder<> B(BasicBlock::Create(F.getContext(), "entry", &F));
+
+    std::vector<Value *> Args;
+    for (Argument &A : F.args())
+        Args.push_back(&A);
+
+    CallInst *Call = B.CreateCall(F.getFunctionType(), Target, Args);
+    Call->setCallingConv(F.getCallingConv());
+    Call->setTailCallKind(CallInst::TCK_MustTail);
+
+    if (F.getReturnType()->isVoidTy())
+        B.CreateRetVoid();
+    else
+        B.CreateRet(Call);
+}
+
+void FunctionDeduplicator::deduplicate(Module &M, VModuleKey K,
+                                       const JITDylib &JD)
+{
+    std::map<std::string, Function *> Local;
+    std::vector<std::pair<Function *, Candidate>> Functions;
+
+    for (Function &F : M)
+    {
+        Candidate C;
+        C.Key = getKey(F, JD, C.Refs);
+
+        if (C.Key.empty())
+            continue;
+
+        if (!C.Refs.empty())
+            C.JD = &JD;
+
+        C.Symbol = GlobalPrefix ? GlobalPrefix + F.getName().str()
+                                : F.getName().str();
+        Functions.emplace_back(&F, std::move(C));
+    }
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    for (auto &Entry : Functions)
+    {
+        Function &F = *Entry.first;
+        Candidate &C = Entry.second;
+
+        auto I = Index.find(C.Key);
+        if (I != Index.end())
+        {
+            Type *PtrTy = F.getFunctionType()->getPointerTo();
+            Constant *Target = ConstantExpr::getIntToPtr(
+                ConstantInt::get(Type::getInt64Ty(M.getContext()),
+                                 I->second.Addr),
+                PtrTy);
+
+            replaceWithThunk(F, Target);
+            ThunkRefs[I->second.K]++;
+            ThunkTargets[K].push_back(I->second.K);
+            NumDeduplicated++;
+            continue;
+        }
+
+        auto L = Local.find(C.Key);
+        if (L != Local.end())
+        {
+            replaceWithThunk(F, L->second);
+            NumDeduplicated++;
+            continue;
+        }
+
+        Local[C.Key] = &F;
+        Pending[K].push_back(std::move(C));
+    }
+}
+
+void FunctionDeduplicator::notifyLoaded(VModuleKey K,
+                                        const object::ObjectFile &Obj,
+                                        const RuntimeDyld::LoadedObjectInfo &Info)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    auto P = Pending.find(K);
+    if (P == Pending.end())
+        return;
+
+    std::map<StringRef, Candidate *> BySymbol;
+    for (Candidate &C : P->second)
+        BySymbol[C.Symbol] = &C;
+
+    auto &Found = Loaded[K];
+
+    for (const object::SymbolRef &Sym : Obj.symbols())
+    {
+        Expected<StringRef> Name = Sym.getName();
+        if (!Name)
+        {
+            consumeError(Name.takeError());
+            continue;
+        }
+
+        auto CI = BySymbol.find(*Name);
+        if (CI == BySymbol.end())
+            continue;
+
+        Expected<object::section_iterator> Sec = Sym.getSection();
+        Expected<uint64_t> Addr = Sym.getAddress();
+
+        if (!Sec || !Addr || *Sec == Obj.section_end())
+        {
+            if (!Sec)
+                consumeError(Sec.takeError());
+            if (!Addr)
+                consumeError(Addr.takeError());
+            continue;
+        }
+
+        uint64_t Load = Info.getSectionLoadAddress(**Sec);
+        if (!Load)
+            continue;
+
+        CI->second->Addr = Load + (*Addr - (*Sec)->getAddress());
+        Found.push_back(*CI->second);
+    }
+
+    Pending.erase(P);
+}
+
+void FunctionDeduplicator::notifyEmitted(VModuleKey K)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    auto L = Loaded.find(K);
+    if (L == Loaded.end())
+        return;
+
+    for (Candidate &C : L->second)
+    {
+        // A concurrent identical module may have been emitted first.
+        auto I = Index.emplace(C.Key, Canonical{C.Addr, K, C.JD, std::move(C.Refs)});
+        if (!I.second)
+            continue;
+
+        for (const std::string &Ref : I.first->second.Refs)
+            Referrers.emplace(Ref, C.Key);
+    }
+
+    Loaded.erase(L);
+}
+
+void FunctionDeduplicator::notifyFailed(VModuleKey K)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    Pending.erase(K);
+    Loaded.erase(K);
+}
+
+void FunctionDeduplicator::eraseCanonical(std::map<std::string, Canonical>::iterator I)
+{
+    for (const std::string &Ref : I->second.Refs)
+    {
+        auto Range = Referrers.equal_range(Ref);
+        for (auto R = Range.first; R != Range.second;)
+            if (R->second == I->first)
+                R = Referrers.erase(R);
+            else
+                ++R;
+    }
+
+    Index.erase(I);
+}
+
+std::vector<VModuleKey> FunctionDeduplicator::notifyRemoved(VModuleKey K)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    Pending.erase(K);
+    Loaded.erase(K);
+
+    for (auto I = Index.begin(); I != Index.end();)
+        if (I->second.K == K)
+            eraseCanonical(I++);
+        else
+            ++I;
+
+    std::vector<VModuleKey> Freeable;
+
+    if (ThunkRefs.count(K))
+        Held.insert(K);
+    else
+        Freeable.push_back(K);
+
+    auto T = ThunkTargets.find(K);
+    if (T != ThunkTargets.end())
+    {
+        for (VModuleKey Target : T->second)
+        {
+            auto R = ThunkRefs.find(Target);
+            if (--R->second)
+                continue;
+
+            ThunkRefs.erase(R);
+            if (Held.erase(Target))
+                Freeable.push_back(Target);
+        }
+
+        ThunkTargets.erase(T);
+    }
+
+    return Freeable;
+}
+
+void FunctionDeduplicator::invalidate(const JITDylib *JD, StringRef Name)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    auto Affected = [&](const JITDylib *CJD, const std::vector<std::string> &Refs) {
+        return CJD && (!JD || CJD == JD) &&
+               std::find(Refs.begin(), Refs.end(), Name) != Refs.end();
+    };
+
+    std::vector<std::string> Keys;
+    auto Range = Referrers.equal_range(Name.str());
+    for (auto R = Range.first; R != Range.second; ++R)
+        Keys.push_back(R->second);
+
+    for (const std::string &Key : Keys)
+    {
+        auto I = Index.find(Key);
+        if (I != Index.end() && Affected(I->second.JD, I->second.Refs))
+            eraseCanonical(I);
+    }
+
+    // Those not emitted yet may already be linked against the old
+    // definition.
+    for (auto *Functions : {&Pending, &Loaded})
+        for (auto &Module : *Functions)
+        {
+            std::vector<Candidate> &Cs = Module.second;
+            Cs.erase(std::remove_if(Cs.begin(), Cs.end(),
+                                    [&](const Candidate &C) {
+                                        return Affected(C.JD, C.Refs);
+                                    }),
+                     Cs.end());
+        }
+}
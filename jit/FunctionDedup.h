@@ -0,0 +1,134 @@
+#pragma once
+
+#include <llvm/ExecutionEngine/JITSymbol.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/ExecutionEngine/RuntimeDyld.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Object/ObjectFile.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+/// Function deduplicator
+///
+/// Identifies optimized functions by a hash of their IR, with their own
+/// name left out. The first function with a given body is compiled as
+/// usual and, once its object has been emitted (relocated and made
+/// executable), its address is recorded. Later
+/// functions with the same body, in any module, are reduced to a thunk
+/// that tail-calls the recorded code, so only one copy is generated and
+/// kept in memory. Identical functions within one module are reduced to
+/// thunks calling the first of them.
+///
+/// Only functions with external linkage, no debug info and no references
+/// to module-private globals are shared. A function that refers to other
+/// symbols by name is only shared within its own JITDylib, where the names
+/// resolve to the same definitions, and only until one of those names is
+/// defined, redefined or removed there (or in the runtime library, which
+/// every JITDylib falls back to); see invalidate.
+///
+/// A function is no longer shared once its module is removed. The code of
+/// a removed module that thunks still target stays in memory until the
+/// last module with such thunks is removed too.
+class FunctionDeduplicator
+{
+
+public:
+    explicit FunctionDeduplicator(char GlobalPrefix) : GlobalPrefix(GlobalPrefix) {}
+
+    void setEnabled(bool Enabled) { this->Enabled.store(Enabled); }
+    bool isEnabled() const { return Enabled.load(); }
+
+    /// Functions below this size are never shared: the thunk would be
+    /// about as large.
+    void setMinInstructions(unsigned N) { MinInstructions.store(N); }
+
+    /// Replace the functions of the optimized module M whose bodies are
+    /// known, and remember the others until the object of K is loaded.
+    void deduplicate(llvm::Module &M, llvm::orc::VModuleKey K,
+                     const llvm::orc::JITDylib &JD);
+
+    /// Find the addresses of the functions remembered for K. They are not
+    /// used until the object is emitted.
+    void notifyLoaded(llvm::orc::VModuleKey K, const llvm::object::ObjectFile &Obj,
+                      const llvm::RuntimeDyld::LoadedObjectInfo &Info);
+
+    /// Record the addresses found for K, whose code is ready to run.
+    void notifyEmitted(llvm::orc::VModuleKey K);
+
+    /// Forget the functions of K, whose materialization failed.
+    void notifyFailed(llvm::orc::VModuleKey K);
+
+    /// Forget the functions of module K, and release the code its thunks
+    /// target. Returns the modules whose code can be freed now: K, unless
+    /// thunks still target it, and removed modules that only K's thunks
+    /// still targeted.
+    std::vector<llvm::orc::VModuleKey> notifyRemoved(llvm::orc::VModuleKey K);
+
+    /// Stop sharing the functions that refer to Name in JD, as it was
+    /// defined, redefined or removed there. A null JD stands for the
+    /// runtime library, and affects every JITDylib.
+    void invalidate(const llvm::orc::JITDylib *JD, llvm::StringRef Name);
+
+    /// Number of functions replaced by thunks so far
+    unsigned getNumDeduplicated() const { return NumDeduplicated.load(); }
+
+private:
+    char GlobalPrefix;
+
+    std::atomic<bool> Enabled{false};
+    std::atomic<unsigned> MinInstructions{16};
+    std::atomic<unsigned> NumDeduplicated{0};
+
+    /// A function that may become canonical
+    struct Candidate
+    {
+        /// Key of its body
+        std::string Key;
+
+        /// Symbol name in the object, and address once loaded
+        std::string Symbol;
+        llvm::JITTargetAddress Addr = 0;
+
+        /// JITDylib the names it refers to resolve in, and those names;
+        /// null and empty if it refers to none
+        const llvm::orc::JITDylib *JD = nullptr;
+        std::vector<std::string> Refs;
+    };
+
+    struct Canonical
+    {
+        llvm::JITTargetAddress Addr;
+        llvm::orc::VModuleKey K;
+        const llvm::orc::JITDylib *JD;
+        std::vector<std::string> Refs;
+    };
+
+    std::mutex Mutex;
+    std::map<std::string, Canonical> Index;
+
+    /// Keys of the Index entries that refer to a name
+    std::multimap<std::string, std::string> Referrers;
+
+    /// Functions of modules not loaded yet, and loaded but not emitted
+    std::map<llvm::orc::VModuleKey, std::vector<Candidate>> Pending;
+    std::map<llvm::orc::VModuleKey, std::vector<Candidate>> Loaded;
+
+    /// Number of thunks targeting the code of a module, the modules every
+    /// module has thunks to (once per thunk), and the removed modules whose
+    /// code is still targeted
+    std::map<llvm::orc::VModuleKey, unsigned> ThunkRefs;
+    std::map<llvm::orc::VModuleKey, std::vector<llvm::orc::VModuleKey>> ThunkTargets;
+    std::set<llvm::orc::VModuleKey> Held;
+
+    /// Key of F's body, and the names it refers to in Refs
+    std::string getKey(const llvm::Function &F, const llvm::orc::JITDylib &JD,
+                       std::vector<std::string> &Refs) const;
+
+    void eraseCanonical(std::map<std::string, Canonical>::iterator I);
+
+};
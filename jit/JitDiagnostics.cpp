@@ -0,0 +1,272 @@
+#include "JitDiagnostics.h"
+
+#include <llvm/IR/DiagnosticHandler.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/Regex.h>
+#include <llvm/Support/Timer.h>
+
+using namespace llvm;
+
+const char *const JitDiagnostics::DefaultRemarkPasses =
+    "inline|loop-vectorize|slp-vectorizer|loop-unroll";
+
+std::shared_timed_mutex &JitDiagnostics::getPipelineLock()
+{
+    static std::shared_timed_mutex PipelineLock;
+    return PipelineLock;
+}
+
+namespace {
+
+/// Installed on a module's context while it is optimized. Remarks of the
+/// selected passes are recorded; every other diagnostic goes to the handler
+/// that was installed before.
+class RemarkCollector : public DiagnosticHandler
+{
+
+public:
+    RemarkCollector(StringRef PassRegex, DiagnosticHandler &Previous,
+                    ModuleDiagnostics &Result)
+        : Passes(("^(" + PassRegex + ")$").str()), Previous(Previous),
+          Result(Result) {}
+
+    bool handleDiagnostics(const DiagnosticInfo &DI) override
+    {
+        auto *Remark = dyn_cast<DiagnosticInfoIROptimization>(&DI);
+
+        if (!Remark)
+            return Previous.handleDiagnostics(DI);
+
+        if (!Passes.match(Remark->getPassName()))
+            return true;
+
+        JitRemark R;
+
+        switch (DI.getKind())
+        {
+        case DK_OptimizationRemark:
+            R.Kind = JitRemark::Passed;
+            break;
+        case DK_OptimizationRemarkMissed:
+            R.Kind = JitRemark::Missed;
+            break;
+        default:
+            R.Kind = JitRemark::Analysis;
+            break;
+        }
+
+        R.Pass = Remark->getPassName().str();
+        R.Name = Remark->getRemarkName().str();
+        R.Message = Remark->getMsg();
+
+        if (Remark->isLocationAvailable())
+            R.Location = Remark->getLocationStr();
+
+        Result.Remarks[Remark->getFunction().getName().str()].push_back(
+            std::move(R));
+
+        return true;
+    }
+
+    bool isAnalysisRemarkEnabled(StringRef PassName) const override
+    {
+        return Passes.match(PassName);
+    }
+
+    bool isMissedOptRemarkEnabled(StringRef PassName) const override
+    {
+        return Passes.match(PassName);
+    }
+
+    bool isPassedOptRemarkEnabled(StringRef PassName) const override
+    {
+        return Passes.match(PassName);
+    }
+
+    bool isAnyRemarkEnabled() const override { return true; }
+
+private:
+    Regex Passes;
+    DiagnosticHandler &Previous;
+    ModuleDiagnostics &Result;
+
+};
+
+} // end anonymous namespace
+
+/// Sum the wall times of the pass timers, which the timer groups only
+/// export as JSON members of the form "time.pass.<pass>.wall": seconds.
+static void takePassTimes(std::map<std::string, double> &PassSeconds)
+{
+    std::string buffer;
+    raw_string_ostream os(buffer);
+
+    os << "{\n";
+    TimerGroup::printAllJSONValues(os, "");
+    os << "\n}";
+
+    TimerGroup::clearAll();
+
+    Expected<json::Value> Times = json::parse(os.str());
+    if (!Times)
+    {
+        consumeError(Times.takeError());
+        return;
+    }
+
+    const StringRef Prefix = "time.pass.";
+    const StringRef Suffix = ".wall";
+
+    for (const auto &Entry : *Times->getAsObject())
+    {
+        StringRef Key = Entry.first;
+
+        if (!Key.startswith(Prefix) || !Key.endswith(Suffix))
+            continue;
+
+        if (Optional<double> Seconds = Entry.second.getAsNumber())
+        {
+            StringRef Pass = Key.drop_front(Prefix.size()).drop_back(Suffix.size());
+            PassSeconds[Pass.str()] += *Seconds;
+        }
+    }
+}
+
+void JitDiagnostics::setRemarksEnabled(bool Enabled, StringRef PassRegex)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    RemarksEnabled = Enabled;
+    RemarkPasses = PassRegex.str();
+}
+
+void JitDiagnostics::setPassTimingEnabled(bool Enabled)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    PassTimingEnabled = Enabled;
+}
+
+bool JitDiagnostics::isEnabled() const
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return RemarksEnabled || PassTimingEnabled;
+}
+
+void JitDiagnostics::collect(Module &M, function_ref<void()> Optimize)
+{
+    bool Remarks, Timing;
+    std::string Passes;
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Remarks = RemarksEnabled;
+        Timing = PassTimingEnabled;
+        Passes = RemarkPasses;
+    }
+
+    ModuleDiagnostics Result;
+    Result.ModuleName = M.getModuleIdentifier();
+
+    LLVMContext &Ctx = M.getContext();
+    std::unique_ptr<DiagnosticHandler> Previous;
+
+    if (Remarks)
+    {
+        Previous = Ctx.getDiagnosticHandler();
+        Ctx.setDiagnosticHandler(
+            std::make_unique<RemarkCollector>(Passes, *Previous, Result));
+    }
+
+    if (Timing)
+    {
+        std::lock_guard<std::shared_timed_mutex> Lock(getPipelineLock());
+
+        TimePassesIsEnabled = true;
+        Optimize();
+        TimePassesIsEnabled = false;
+
+        takePassTimes(Result.PassSeconds);
+    }
+    else
+    {
+        std::shared_lock<std::shared_timed_mutex> Lock(getPipelineLock());
+        Optimize();
+    }
+
+    if (Remarks)
+        Ctx.setDiagnosticHandler(std::move(Previous));
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Modules.push_back(std::move(Result));
+}
+
+std::vector<ModuleDiagnostics> JitDiagnostics::getModules() const
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return Modules;
+}
+
+void JitDiagnostics::clear()
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Modules.clear();
+}
+
+static const char *getKindName(JitRemark::RemarkKind Kind)
+{
+    switch (Kind)
+    {
+    case JitRemark::Passed:
+        return "passed";
+    case JitRemark::Missed:
+        return "missed";
+    default:
+        return "analysis";
+    }
+}
+
+json::Value JitDiagnostics::toJSON() const
+{
+    json::Array JModules;
+
+    for (const ModuleDiagnostics &MD : getModules())
+    {
+        json::Object JPasses;
+        for (const auto &Pass : MD.PassSeconds)
+            JPasses[Pass.first] = Pass.second;
+
+        json::Object JFunctions;
+        for (const auto &Function : MD.Remarks)
+        {
+            json::Array JRemarks;
+
+            for (const JitRemark &R : Function.second)
+            {
+                json::Object JRemark{{"kind", getKindName(R.Kind)},
+                                     {"pass", R.Pass},
+                                     {"name", R.Name},
+                                     {"message", R.Message}};
+
+                if (!R.Location.empty())
+                    JRemark["location"] = R.Location;
+
+                JRemarks.push_back(std::move(JRemark));
+            }
+
+            JFunctions[Function.first] = std::move(JRemarks);
+        }
+
+        JModules.push_back(json::Object{{"module", MD.ModuleName},
+                                        {"passes", std::move(JPasses)},
+                                        {"functions", std::move(JFunctions)}});
+    }
+
+    return json::Object{{"modules", std::move(JModules)}};
+}
+
+void JitDiagnostics::writeJSON(raw_ostream &OS) const
+{
+    OS << formatv("{0:2}", toJSON()) << "\n";
+}
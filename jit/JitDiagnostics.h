@@ -0,0 +1,101 @@
+#pragma once
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+/// One optimization remark
+struct JitRemark
+{
+    enum RemarkKind { Passed, Missed, Analysis };
+
+    RemarkKind Kind;
+
+    /// Pass that emitted the remark, e.g. "inline" or "loop-vectorize"
+    std::string Pass;
+
+    /// Identifier of the remark within the pass, e.g. "Inlined"
+    std::string Name;
+
+    std::string Message;
+
+    /// Source location, if the IR has debug locations
+    std::string Location;
+};
+
+/// What the optimizer did to one module
+struct ModuleDiagnostics
+{
+    std::string ModuleName;
+
+    /// Remarks by function
+    std::map<std::string, std::vector<JitRemark>> Remarks;
+
+    /// Wall time in seconds by pass, summed over all instances of a pass
+    std::map<std::string, double> PassSeconds;
+};
+
+/// Optimizer diagnostics
+///
+/// When enabled, the optimizer records the optimization remarks of a set of
+/// passes (by default the inliner, the loop and SLP vectorizers and the loop
+/// unroller) and the execution time of every pass, for every module it
+/// optimizes. The results can be exported as JSON keyed by module and
+/// function.
+///
+/// Pass timing relies on the global timers of the legacy pass manager,
+/// which time every pass pipeline that runs in the process, optimization
+/// or code generation, while they are on. A timed optimization therefore
+/// runs alone: it holds the pipeline lock exclusively, and every other
+/// pipeline holds it shared (see getPipelineLock).
+class JitDiagnostics
+{
+
+public:
+    static const char *const DefaultRemarkPasses;
+
+    /// To be held shared while running a pass pipeline outside collect.
+    static std::shared_timed_mutex &getPipelineLock();
+
+    /// Collect the remarks of the passes whose name matches PassRegex.
+    void setRemarksEnabled(bool Enabled,
+                           llvm::StringRef PassRegex = DefaultRemarkPasses);
+
+    void setPassTimingEnabled(bool Enabled);
+
+    bool isEnabled() const;
+
+    /// Run Optimize, which runs the pass pipeline over M, and record the
+    /// remarks and timings it produces. M's context must not be used by
+    /// anybody else meanwhile.
+    void collect(llvm::Module &M, llvm::function_ref<void()> Optimize);
+
+    std::vector<ModuleDiagnostics> getModules() const;
+
+    /// Discard everything collected so far.
+    void clear();
+
+    /// {"modules": [{"module": ..., "passes": {pass: seconds},
+    ///               "functions": {function: [remark, ...]}}]}
+    llvm::json::Value toJSON() const;
+
+    void writeJSON(llvm::raw_ostream &OS) const;
+
+private:
+    mutable std::mutex Mutex;
+
+    bool RemarksEnabled = false;
+    std::string RemarkPasses = DefaultRemarkPasses;
+    bool PassTimingEnabled = false;
+
+    std::vector<ModuleDiagnostics> Modules;
+
+};
@@ -1,25 +1,157 @@
 #include "JitEngine.h"
 #include "JitOptimizer.h"
+#include "ModulePartitioner.h"
 
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/CodeGen/RuntimeLibcalls.h>
+#include <llvm/CodeGen/TargetLowering.h>
+#include <llvm/CodeGen/TargetSubtargetInfo.h>
 #include <llvm/ExecutionEngine/Orc/CompileUtils.h>
 #include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
-#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/SHA1.h>
+
+#include <algorithm>
+#include <set>
 
 using namespace llvm;
 using namespace llvm::orc;
 
+/// Coroutines cannot be code generated before they are split, even when
+/// nothing else is optimized.
+static bool usesCoroutines(const Module &module)
+{
+    return module.getFunction(Intrinsic::getName(Intrinsic::coro_id)) != nullptr;
+}
+
+/// What shared code must have been compiled for to run here
+static std::string getTargetId(const JITTargetMachineBuilder &JTMB)
+{
+    return JTMB.getTargetTriple().str() + " " + JTMB.getFeatures().getString();
+}
+
 JitEngine::JitEngine(JITTargetMachineBuilder JTMB, DataLayout DL) : 
+    RuntimeJD(ES.createJITDylib("<runtime>", false)),
     GDBListener(JITEventListener::createGDBRegistrationListener()),
+    SharedTargetId(getTargetId(JTMB)),
+    CompileMachines(std::make_shared<TargetMachinePool>(JTMB)),
+    QuickMachines(std::make_shared<TargetMachinePool>(
+        getQuickTargetMachineBuilder(JTMB))),
+    SharedMachines(std::make_shared<TargetMachinePool>(
+        getSharedTargetMachineBuilder(std::move(JTMB)))),
     ObjectLayer(ES, createMemoryManagerFtor()),
-    CompileLayer(ES, ObjectLayer, ConcurrentIRCompiler(std::move(JTMB))),
+    CompileLayer(ES, ObjectLayer, PooledIRCompiler(CompileMachines)),
     OptimizeLayer(ES, CompileLayer),
+    QuickCompileLayer(ES, ObjectLayer, PooledIRCompiler(QuickMachines)),
+    QuickLayer(ES, QuickCompileLayer),
+    SharedObjects(ES, ObjectLayer),
+    SharedCompileLayer(ES, SharedObjects, PooledIRCompiler(SharedMachines)),
+    SharedLayer(ES, SharedCompileLayer),
     DL(std::move(DL)),
     Mangle(ES, this->DL),
-    Context(std::make_unique<LLVMContext>())
+    Context(std::make_unique<LLVMContext>()),
+    Dedup(this->DL.getGlobalPrefix()),
+    SymbolCacheEnabled(true)
 {
     ObjectLayer.setNotifyLoaded(createNotifyLoadedFtor());
+    ObjectLayer.setNotifyEmitted(
+        [this](VModuleKey K, std::unique_ptr<MemoryBuffer>) {
+            Dedup.notifyEmitted(K);
+        });
+    JitOptimizer Optimizer(2, &Budget, &Diagnostics);
+    OptimizeLayer.setTransform(
+        [this, Optimizer](ThreadSafeModule TSM,
+                          const MaterializationResponsibility &R)
+            -> Expected<ThreadSafeModule> {
+            if (auto Err = linkRuntimeLibraries(*TSM.getModule()))
+                return std::move(Err);
+
+            auto Optimized = Optimizer(std::move(TSM), R);
+            if (!Optimized)
+                return Optimized;
+
+            reportCoroElision(*Optimized->getModule());
+
+            if (Dedup.isEnabled())
+                Dedup.deduplicate(*Optimized->getModule(), R.getVModuleKey(),
+                                  R.getTargetJITDylib());
+
+            return Optimized;
+        });
+
+    JitOptimizer Lowering(0);
+    QuickLayer.setTransform(
+        [Lowering](ThreadSafeModule TSM, const MaterializationResponsibility &R)
+            -> Expected<ThreadSafeModule> {
+            if (!usesCoroutines(*TSM.getModule()))
+                return std::move(TSM);
+
+            return Lowering(std::move(TSM), R);
+        });
+
+    // Deduplication thunks would refer to code only this process has.
+    SharedLayer.setTransform(
+        [this, Optimizer](ThreadSafeModule TSM,
+                          const MaterializationResponsibility &R)
+            -> Expected<ThreadSafeModule> {
+            if (auto Err = linkRuntimeLibraries(*TSM.getModule()))
+                return std::move(Err);
+
+            auto Optimized = Optimizer(std::move(TSM), R);
+            if (Optimized)
+                reportCoroElision(*Optimized->getModule());
+
+            return Optimized;
+        });
+
     auto R = createHostProcessResolver();
-    ES.getMainJITDylib().setGenerator(std::move(R));
+    RuntimeJD.setGenerator(std::move(R));
+
+    ES.getMainJITDylib().addToSearchOrder(RuntimeJD);
+}
+
+JITTargetMachineBuilder
+JitEngine::getQuickTargetMachineBuilder(JITTargetMachineBuilder JTMB)
+{
+    JTMB.setCodeGenOptLevel(CodeGenOpt::None);
+    JTMB.getOptions().EnableFastISel = true;
+    return JTMB;
+}
+
+JITTargetMachineBuilder
+JitEngine::getSharedTargetMachineBuilder(JITTargetMachineBuilder JTMB)
+{
+    JTMB.setRelocationModel(Reloc::PIC_);
+    JTMB.setCodeModel(CodeModel::Small);
+    return JTMB;
+}
+
+Expected<JITDylib &> JitEngine::createTenant(StringRef Name)
+{
+    std::lock_guard<std::mutex> Lock(TenantsMutex);
+
+    if (Name.empty() || Tenants.count(Name) ||
+        Name == RuntimeJD.getName() || Name == getDefaultTenant().getName())
+        return createStringError(inconvertibleErrorCode(),
+                                 "Tenant name '%s' is not available",
+                                 Name.str().c_str());
+
+    JITDylib &JD = ES.createJITDylib(Name.str(), false);
+    JD.addToSearchOrder(RuntimeJD);
+
+    Tenants[Name] = &JD;
+    return JD;
+}
+
+JITDylib *JitEngine::getTenant(StringRef Name)
+{
+    std::lock_guard<std::mutex> Lock(TenantsMutex);
+
+    auto I = Tenants.find(Name);
+    return I == Tenants.end() ? nullptr : I->second;
 }
 
 JITDylib::GeneratorFunction JitEngine::createHostProcessResolver()
@@ -28,11 +160,149 @@ JITDylib::GeneratorFunction JitEngine::createHostProcessResolver()
     return cantFail(DynamicLibrarySearchGenerator::GetForCurrentProcess(Prefix));
 }
 
+/// Functions JIT code may call without its IR naming them: the runtime
+/// library calls of code generation (memcpy, __udivti3, __powidf2...) and
+/// the library functions the optimizer may introduce (memset from loop
+/// idioms, puts from printf...)
+static Expected<std::vector<std::string>>
+getImplicitLibcalls(TargetMachinePool &Machines)
+{
+    auto TM = Machines.acquire();
+    if (!TM)
+        return TM.takeError();
+
+    // Subtargets are per function
+    LLVMContext Ctx;
+    Module M("libcalls", Ctx);
+    Function *F = Function::Create(FunctionType::get(Type::getVoidTy(Ctx), false),
+                                   GlobalValue::ExternalLinkage, "libcalls", M);
+
+    const TargetLowering *Lowering =
+        (*TM)->getSubtargetImpl(*F)->getTargetLowering();
+
+    std::set<std::string> Names;
+
+    for (int LC = 0; LC < RTLIB::UNKNOWN_LIBCALL; LC++)
+        if (const char *Name = Lowering->getLibcallName(RTLIB::Libcall(LC)))
+            Names.insert(Name);
+
+    TargetLibraryInfoImpl TLII((*TM)->getTargetTriple());
+    TargetLibraryInfo TLI(TLII);
+
+    for (unsigned LF = 0; LF < NumLibFuncs; LF++)
+        if (TLI.has(LibFunc(LF)))
+            Names.insert(TLI.getName(LibFunc(LF)).str());
+
+    return std::vector<std::string>(Names.begin(), Names.end());
+}
+
+Error JitEngine::setHostSymbolTable(ArrayRef<StringRef> Names,
+                                   HostSymbolFallback Fallback)
+{
+    // The same handle the process resolver searches
+    sys::DynamicLibrary Process = sys::DynamicLibrary::getPermanentLibrary(nullptr);
+
+    SymbolMap Defs;
+    std::string Missing;
+
+    for (StringRef Name : Names)
+    {
+        void *Addr = Process.getAddressOfSymbol(Name.str().c_str());
+
+        if (!Addr)
+        {
+            Missing += (Missing.empty() ? "" : ", ") + Name.str();
+            continue;
+        }
+
+        Defs[Mangle(Name)] = JITEvaluatedSymbol(
+            pointerToJITTargetAddress(Addr),
+            JITSymbolFlags::Exported | JITSymbolFlags::Callable);
+    }
+
+    if (!Missing.empty())
+        return createStringError(inconvertibleErrorCode(),
+                                 "Host symbols not found: %s", Missing.c_str());
+
+    auto Libcalls = getImplicitLibcalls(*CompileMachines);
+    if (!Libcalls)
+        return Libcalls.takeError();
+
+    // Those the process does not have fail to link, as they would anyway.
+    for (const std::string &Name : *Libcalls)
+    {
+        SymbolStringPtr Mangled = Mangle(Name);
+
+        if (!Defs.count(Mangled))
+            if (void *Addr = Process.getAddressOfSymbol(Name.c_str()))
+                Defs[Mangled] = JITEvaluatedSymbol(
+                    pointerToJITTargetAddress(Addr),
+                    JITSymbolFlags::Exported | JITSymbolFlags::Callable);
+    }
+
+    // One at a time, so that names an earlier table (or defineAbsolute, or
+    // the process resolver) already defined are skipped.
+    for (auto &Def : Defs)
+    {
+        Error Err = RuntimeJD.define(absoluteSymbols(SymbolMap({Def})));
+
+        if (auto Remaining = handleErrors(std::move(Err),
+                                          [](const DuplicateDefinition &) {}))
+            return Remaining;
+    }
+
+    for (StringRef Name : Names)
+        invalidateSymbol(RuntimeJD, Name);
+
+    for (const std::string &Name : *Libcalls)
+        invalidateSymbol(RuntimeJD, Name);
+
+    if (Fallback == HostSymbolFallback::Fail)
+        RuntimeJD.setGenerator(JITDylib::GeneratorFunction());
+    else
+        RuntimeJD.setGenerator(createHostProcessResolver());
+
+    return Error::success();
+}
+
+/// The object layer creates an object's memory manager and notifies its
+/// loading on the same thread, without anything in between. This is how a
+/// memory manager is matched with the module key of its object.
+static thread_local JitMemoryManager *LastMemoryManager = nullptr;
+
 RTDyldObjectLinkingLayer::NotifyLoadedFunction JitEngine::createNotifyLoadedFtor()
 {
-    using namespace std::placeholders;
-    return std::bind(&JITEventListener::notifyObjectLoaded,
-                     GDBListener, _1, _2, _3);
+    return [this](VModuleKey K, const object::ObjectFile &Obj,
+                  const RuntimeDyld::LoadedObjectInfo &Info) {
+        if (LastMemoryManager)
+        {
+            std::lock_guard<std::mutex> Lock(ModulesMutex);
+            MemoryManagers[K] = LastMemoryManager;
+            LastMemoryManager = nullptr;
+        }
+
+        Dedup.notifyLoaded(K, Obj, Info);
+
+        if (!isQuick(K))
+            GDBListener->notifyObjectLoaded(K, Obj, Info);
+
+        std::lock_guard<std::mutex> Lock(ListenersMutex);
+        for (JITEventListener *L : Listeners)
+            L->notifyObjectLoaded(K, Obj, Info);
+    };
+}
+
+void JitEngine::addEventListener(JITEventListener &L)
+{
+    std::lock_guard<std::mutex> Lock(ListenersMutex);
+    Listeners.push_back(&L);
+}
+
+void JitEngine::removeEventListener(JITEventListener &L)
+{
+    std::lock_guard<std::mutex> Lock(ListenersMutex);
+    Listeners.erase(std::remove(Listeners.begin(), Listeners.end(), &L),
+                    Listeners.end());
 }
 
 using GetMemoryManagerFunction =
@@ -40,7 +310,13 @@ using GetMemoryManagerFunction =
 
 GetMemoryManagerFunction JitEngine::createMemoryManagerFtor() {
   return []() -> GetMemoryManagerFunction::result_type {
-    return std::make_unique<SectionMemoryManager>();
+    std::unique_ptr<JitMemoryManager> MemMgr;
+    if (auto Shared = SharedObjectLayer::takeMemoryManager())
+        MemMgr = std::make_unique<JitMemoryManager>(std::move(Shared));
+    else
+        MemMgr = std::make_unique<JitMemoryManager>();
+    LastMemoryManager = MemMgr.get();
+    return std::move(MemMgr);
   };
 }
 
@@ -57,23 +333,435 @@ Error JitEngine::applyDataLayout(Module &module)
     return Error::success();
 }
 
-Error JitEngine::addModule(std::unique_ptr<llvm::Module> module)
+Error JitEngine::addRuntimeBitcode(std::unique_ptr<MemoryBuffer> Buffer)
+{
+    auto Library = RuntimeLibrary::Create(std::move(Buffer), DL);
+    if (!Library)
+        return Library.takeError();
+
+    std::lock_guard<std::mutex> Lock(RuntimeLibrariesMutex);
+    RuntimeLibraries.push_back(std::move(*Library));
+
+    return Error::success();
+}
+
+/// Runs inside the transform, with the module's context locked by the IR
+/// layer.
+Error JitEngine::linkRuntimeLibraries(Module &module)
+{
+    std::vector<std::shared_ptr<const RuntimeLibrary>> Libraries;
+
+    {
+        std::lock_guard<std::mutex> Lock(RuntimeLibrariesMutex);
+        Libraries = RuntimeLibraries;
+    }
+
+    for (const auto &Library : Libraries)
+        if (auto Err = Library->link(module))
+            return Err;
+
+    return Error::success();
+}
+
+void JitEngine::setCoroElisionHandler(CoroElisionHandler Handler)
 {
+    std::lock_guard<std::mutex> Lock(CoroElisionMutex);
+    CoroElisionReporter = std::move(Handler);
+}
+
+void JitEngine::reportCoroElision(const Module &module)
+{
+    CoroElisionHandler Handler;
+
+    {
+        std::lock_guard<std::mutex> Lock(CoroElisionMutex);
+        Handler = CoroElisionReporter;
+    }
+
+    if (!Handler)
+        return;
+
+    for (const CoroElisionReport &Report : checkCoroElision(module))
+        Handler(Report);
+}
+
+Expected<ThreadSafeModule> JitEngine::adoptModule(std::unique_ptr<Module> module)
+{
+    std::lock_guard<std::mutex> Lock(ContextMutex);
+
+    LLVMContext *Ctx = &module->getContext();
+
+    if (Ctx != Context.getContext())
+    {
+        for (RetiredContext &Retired : RetiredContexts)
+            if (Retired.Context.getContext() == Ctx)
+                return ThreadSafeModule(std::move(module), Retired.Context);
+
+        return createStringError(inconvertibleErrorCode(),
+                                 "Module '%s' was not created in a context "
+                                 "of the engine",
+                                 module->getName().str().c_str());
+    }
+
+    // Modules are being built in the current context now; the retired ones
+    // nobody holds a handle to only live on in their pending modules.
+    RetiredContexts.erase(
+        std::remove_if(RetiredContexts.begin(), RetiredContexts.end(),
+                       [](const RetiredContext &Retired) {
+                           return Retired.InUse.expired();
+                       }),
+        RetiredContexts.end());
 
-    if (auto Err = applyDataLayout(*module))
+    ThreadSafeModule TSM(std::move(module), Context);
+
+    if (ContextRotation && ++ModulesInContext >= ContextRotation)
+    {
+        RetiredContexts.push_back(RetiredContext{Context, ContextInUse});
+        Context = ThreadSafeContext(std::make_unique<LLVMContext>());
+        ContextInUse.reset();
+        ModulesInContext = 0;
+    }
+
+    return std::move(TSM);
+}
+
+Error JitEngine::addModule(JITDylib &Tenant, std::unique_ptr<llvm::Module> module,
+                           VModuleKey K, CompileMode Mode)
+{
+    auto TSM = adoptModule(std::move(module));
+    if (!TSM)
+        return TSM.takeError();
+
+    return addModule(Tenant, std::move(*TSM), K, Mode);
+}
+
+Error JitEngine::addModule(JITDylib &Tenant, ThreadSafeModule TSM, VModuleKey K,
+                           CompileMode Mode)
+{
+    const bool Quick = Mode == CompileMode::Quick;
+
+    if (auto Err = applyDataLayout(*TSM.getModule()))
         return Err;
 
-    OptimizeLayer.setTransform(JitOptimizer(2));
+    // Collect the names before handing the module off; they are only
+    // invalidated once the new definitions are in place.
+    std::vector<std::string> Names = getDefinedNames(*TSM.getModule());
+
+    std::shared_ptr<const MemoryBuffer> IR;
+    std::vector<ThreadSafeModule> Partitions;
+
+    {
+        // Other modules of the context may be compiling meanwhile.
+        auto Lock = TSM.getContextLock();
+        Module &module = *TSM.getModule();
+
+        if (RetainIR.load())
+        {
+            SmallVector<char, 0> Buffer;
+            raw_svector_ostream os(Buffer);
+            WriteBitcodeToFile(module, os);
+
+            IR = MemoryBuffer::getMemBufferCopy(
+                StringRef(Buffer.data(), Buffer.size()),
+                module.getModuleIdentifier());
+        }
+
+        unsigned N = NumPartitions.load();
+
+        if (!Quick && N > 1 &&
+            module.getInstructionCount() >= PartitionMinInstructions.load())
+        {
+            auto Parts = partitionModule(module, N);
+            if (!Parts)
+                return Parts.takeError();
+
+            Partitions = std::move(*Parts);
+        }
+    }
 
-    return OptimizeLayer.add(ES.getMainJITDylib(),
-                             ThreadSafeModule(std::move(module), Context),
-                             ES.allocateVModule());
+    if (Partitions.size() < 2)
+    {
+        Partitions.clear();
+        Partitions.push_back(std::move(TSM));
+    }
+
+    std::vector<VModuleKey> Keys{K};
+    while (Keys.size() < Partitions.size())
+        Keys.push_back(createModuleKey());
+
+    {
+        std::lock_guard<std::mutex> Lock(ModulesMutex);
+        Modules[K] = ModuleRecord{&Tenant, Names, std::move(IR),
+                                  std::vector<VModuleKey>(Keys.begin() + 1,
+                                                          Keys.end()),
+                                  Quick};
+    }
+
+    // Symbols of the partitions added so far, to take them back if a later
+    // one cannot be added.
+    SymbolNameSet Added;
+
+    for (size_t i = 0; i < Partitions.size(); i++)
+    {
+        std::vector<std::string> Defined;
+        if (Partitions.size() > 1)
+            Defined = getDefinedNames(*Partitions[i].getModule());
+
+        IRLayer &Layer = Quick ? static_cast<IRLayer &>(QuickLayer) : OptimizeLayer;
+
+        if (auto Err = Layer.add(Tenant, std::move(Partitions[i]), Keys[i]))
+        {
+            if (!Added.empty())
+                consumeError(Tenant.remove(Added));
+
+            std::lock_guard<std::mutex> Lock(ModulesMutex);
+            Modules.erase(K);
+            return Err;
+        }
+
+        for (const std::string &Name : Defined)
+            Added.insert(Mangle(Name));
+    }
+
+    for (const std::string &Name : Names)
+        invalidateSymbol(Tenant, Name);
+
+    return Error::success();
+}
+
+Expected<SharedCodeRegion::Role>
+JitEngine::addSharedModule(JITDylib &Tenant, std::unique_ptr<llvm::Module> module,
+                           VModuleKey K, std::shared_ptr<SharedCodeRegion> Region)
+{
+    auto TSM = adoptModule(std::move(module));
+    if (!TSM)
+        return TSM.takeError();
+
+    return addSharedModule(Tenant, std::move(*TSM), K, std::move(Region));
 }
 
-Expected<JITTargetAddress> JitEngine::getFunctionAddr(StringRef Name)
+Expected<SharedCodeRegion::Role>
+JitEngine::addSharedModule(JITDylib &Tenant, ThreadSafeModule TSM, VModuleKey K,
+                           std::shared_ptr<SharedCodeRegion> Region)
 {
+    using Role = SharedCodeRegion::Role;
+
+    if (auto Err = applyDataLayout(*TSM.getModule()))
+        return std::move(Err);
+
+    std::vector<std::string> Names = getDefinedNames(*TSM.getModule());
+
+    std::shared_ptr<const MemoryBuffer> IR;
+    SharedCodeRegion::ModuleHash Hash;
+
+    {
+        auto Lock = TSM.getContextLock();
+        Module &module = *TSM.getModule();
+
+        SmallVector<char, 0> Buffer;
+        raw_svector_ostream os(Buffer);
+        WriteBitcodeToFile(module, os);
+
+        if (RetainIR.load())
+            IR = MemoryBuffer::getMemBufferCopy(
+                StringRef(Buffer.data(), Buffer.size()),
+                module.getModuleIdentifier());
+
+        os << SharedTargetId;
+        Hash = SHA1::hash(ArrayRef<uint8_t>(
+            reinterpret_cast<const uint8_t *>(Buffer.data()), Buffer.size()));
+    }
+
+    Role R = Region->claim(Hash);
+
+    std::unique_ptr<MemoryBuffer> Obj;
+
+    if (R == Role::Import)
+    {
+        if (auto Loaded = Region->loadObject())
+            Obj = std::move(*Loaded);
+        else
+        {
+            consumeError(Loaded.takeError());
+            R = Role::Private;
+        }
+    }
+
+    if (R == Role::Private)
+    {
+        if (auto Err = addModule(Tenant, std::move(TSM), K))
+            return std::move(Err);
+
+        return R;
+    }
+
+    {
+        std::lock_guard<std::mutex> Lock(ModulesMutex);
+        Modules[K] = ModuleRecord{&Tenant, Names, std::move(IR), {}, false};
+    }
+
+    SharedObjects.setRegion(K, Region, R == Role::Export);
+
+    Error Err = R == Role::Import
+                    ? SharedObjects.add(Tenant, std::move(Obj), K)
+                    : SharedLayer.add(Tenant, std::move(TSM), K);
+
+    if (Err)
+    {
+        SharedObjects.forgetRegion(K);
+
+        std::lock_guard<std::mutex> Lock(ModulesMutex);
+        Modules.erase(K);
+        return std::move(Err);
+    }
+
+    for (const std::string &Name : Names)
+        invalidateSymbol(Tenant, Name);
+
+    // The other processes can only import once the region is published,
+    // which must not wait for a first lookup here.
+    if (R == Role::Export)
+        if (auto Err = compileModule(K))
+        {
+            SharedObjects.forgetRegion(K);
+
+            // Take the failed definitions back, so that the module can be
+            // added again. Should that fail too, the module stays under K.
+            if (auto RemoveErr = removeModule(K))
+                return joinErrors(std::move(Err), std::move(RemoveErr));
+
+            return std::move(Err);
+        }
+
+    return R;
+}
+
+std::shared_ptr<const MemoryBuffer> JitEngine::getRetainedIR(JITDylib &Tenant,
+                                                             StringRef Name)
+{
+    std::lock_guard<std::mutex> Lock(ModulesMutex);
+
+    // The newest definition is the one lookups find.
+    for (auto I = Modules.rbegin(); I != Modules.rend(); ++I)
+    {
+        const ModuleRecord &Record = I->second;
+
+        if (Record.Tenant != &Tenant || !Record.IR)
+            continue;
+
+        for (const std::string &Defined : Record.Names)
+            if (Defined == Name)
+                return Record.IR;
+    }
+
+    return nullptr;
+}
+
+bool JitEngine::isQuick(VModuleKey K)
+{
+    std::lock_guard<std::mutex> Lock(ModulesMutex);
+
+    auto I = Modules.find(K);
+    return I != Modules.end() && I->second.Quick;
+}
+
+Error JitEngine::removeModule(VModuleKey K)
+{
+    ModuleRecord Record;
+
+    {
+        std::lock_guard<std::mutex> Lock(ModulesMutex);
+
+        auto I = Modules.find(K);
+        if (I == Modules.end())
+            return createStringError(inconvertibleErrorCode(),
+                                     "Unknown module key %llu",
+                                     (unsigned long long)K);
+
+        Record = std::move(I->second);
+        Modules.erase(I);
+    }
+
+    SymbolNameSet Names;
+    for (const std::string &Name : Record.Names)
+        Names.insert(Mangle(Name));
+
+    if (auto Err = Record.Tenant->remove(Names))
+    {
+        // Still being materialized: leave the module in place.
+        std::lock_guard<std::mutex> Lock(ModulesMutex);
+        Modules[K] = std::move(Record);
+        return Err;
+    }
+
+    for (const std::string &Name : Record.Names)
+        invalidateSymbol(*Record.Tenant, Name);
+
+    SharedObjects.forgetRegion(K);
+
+    std::vector<VModuleKey> Keys{K};
+    Keys.insert(Keys.end(), Record.PartitionKeys.begin(),
+                Record.PartitionKeys.end());
+
+    // Code that other modules' thunks jump to stays until they are removed
+    // too. Modules that thunks jump to are never quick.
+    for (VModuleKey Key : Keys)
+        for (VModuleKey Freeable : Dedup.notifyRemoved(Key))
+            freeObject(Freeable, Freeable == Key && Record.Quick);
+
+    return Error::success();
+}
+
+void JitEngine::freeObject(VModuleKey K, bool Quick)
+{
+    JitMemoryManager *MemMgr = nullptr;
+
+    {
+        std::lock_guard<std::mutex> Lock(ModulesMutex);
+
+        auto I = MemoryManagers.find(K);
+        if (I != MemoryManagers.end())
+        {
+            MemMgr = I->second;
+            MemoryManagers.erase(I);
+        }
+    }
+
+    // A partition that was never looked up was never compiled either.
+    if (!MemMgr)
+        return;
+
+    if (!Quick)
+        GDBListener->notifyFreeingObject(K);
+
+    {
+        std::lock_guard<std::mutex> Lock(ListenersMutex);
+        for (JITEventListener *L : Listeners)
+            L->notifyFreeingObject(K);
+    }
+
+    MemMgr->release();
+}
+
+void JitEngine::invalidateSymbol(const JITDylib &JD, StringRef Name)
+{
+    Symbols.invalidate(Name);
+    Dedup.invalidate(&JD == &RuntimeJD ? nullptr : &JD, Name);
+}
+
+Expected<JITTargetAddress> JitEngine::getFunctionAddr(JITDylib &Tenant,
+                                                      StringRef Name)
+{
+    const bool UseCache = SymbolCacheEnabled.load(std::memory_order_relaxed);
+
+    if (UseCache)
+        if (JITTargetAddress A = Symbols.lookup(&Tenant, Name))
+            return A;
+
+    uint64_t Epoch = Symbols.getEpoch();
+
     SymbolStringPtr NamePtr = Mangle(Name);
-    JITDylibSearchList JDs{{&ES.getMainJITDylib(), true}};
+    JITDylibSearchList JDs{{&Tenant, true}, {&RuntimeJD, false}};
 
     Expected<JITEvaluatedSymbol> S = ES.lookup(JDs, NamePtr);
     
@@ -85,11 +773,196 @@ Expected<JITTargetAddress> JitEngine::getFunctionAddr(StringRef Name)
         return createStringError(inconvertibleErrorCode(),
                                  "'%s' evaluated to nullptr", Name.data());
 
+    if (UseCache)
+        Symbols.insert(&Tenant, Name, A, Epoch);
+
     return A;
 }
 
+Error JitEngine::compileModule(VModuleKey K)
+{
+    JITDylib *Tenant = nullptr;
+    SymbolNameSet Names;
+    std::vector<VModuleKey> Keys{K};
+
+    {
+        std::lock_guard<std::mutex> Lock(ModulesMutex);
+
+        auto I = Modules.find(K);
+        if (I == Modules.end())
+            return createStringError(inconvertibleErrorCode(),
+                                     "Unknown module key %llu",
+                                     (unsigned long long)K);
+
+        Tenant = I->second.Tenant;
+        for (const std::string &Name : I->second.Names)
+            Names.insert(Mangle(Name));
+
+        Keys.insert(Keys.end(), I->second.PartitionKeys.begin(),
+                    I->second.PartitionKeys.end());
+    }
+
+    if (Names.empty())
+        return Error::success();
+
+    // One lookup for everything, so that all partitions are dispatched
+    // before waiting on any of them.
+    JITDylibSearchList JDs{{Tenant, true}};
+    auto Result = ES.lookup(JDs, std::move(Names));
+
+    if (!Result)
+    {
+        for (VModuleKey Key : Keys)
+            Dedup.notifyFailed(Key);
+
+        return Result.takeError();
+    }
+
+    return Error::success();
+}
+
+Error JitEngine::setCompileThreads(unsigned NumThreads)
+{
+    // Held throughout, so that no module can be added until materialization
+    // is dispatched to the pool.
+    std::lock_guard<std::mutex> Lock(ModulesMutex);
+
+    if (CompileThreads)
+        return createStringError(inconvertibleErrorCode(),
+                                 "The compile threads are already running");
+
+    if (!Modules.empty())
+        return createStringError(inconvertibleErrorCode(),
+                                 "Compile threads must be set before the "
+                                 "first module is added");
+
+    CompileThreads = std::make_unique<ThreadPool>(std::max(NumThreads, 1u));
+
+    ES.setDispatchMaterialization(
+        [this](JITDylib &JD, std::unique_ptr<MaterializationUnit> MU) {
+            // The pool only takes copyable tasks.
+            auto SharedMU = std::shared_ptr<MaterializationUnit>(std::move(MU));
+            CompileThreads->async([SharedMU, &JD]() { SharedMU->doMaterialize(JD); });
+        });
+
+    return Error::success();
+}
+
+Error JitEngine::setCompileQueue(unsigned NumThreads, size_t Capacity)
+{
+    std::lock_guard<std::mutex> Lock(QueueMutex);
+
+    if (Queue)
+        return createStringError(inconvertibleErrorCode(),
+                                 "The compile queue is already running");
+
+    Queue = std::make_unique<CompileQueue>(NumThreads, Capacity);
+    return Error::success();
+}
+
+CompileQueue &JitEngine::getCompileQueue()
+{
+    std::lock_guard<std::mutex> Lock(QueueMutex);
+
+    if (!Queue)
+        Queue = std::make_unique<CompileQueue>(1, 64);
+
+    return *Queue;
+}
+
+Error JitEngine::addModuleAsync(JITDylib &Tenant, ThreadSafeModule TSM,
+                                VModuleKey K, CompilePriority Priority,
+                                AddModuleCallback OnReady)
+{
+    auto Compile = [this, &Tenant, TSM = std::move(TSM), K,
+                    OnReady = std::move(OnReady)]() mutable {
+        if (auto Err = addModule(Tenant, std::move(TSM), K))
+            return OnReady(std::move(Err));
+
+        OnReady(compileModule(K));
+    };
+
+    return getCompileQueue().submit(Priority, std::move(Compile));
+}
+
+std::future<Error> JitEngine::addModuleAsync(JITDylib &Tenant,
+                                             ThreadSafeModule TSM, VModuleKey K,
+                                             CompilePriority Priority)
+{
+    auto P = std::make_shared<std::promise<Error>>();
+
+    if (auto Err = addModuleAsync(Tenant, std::move(TSM), K, Priority,
+                                  [P](Error Err) { P->set_value(std::move(Err)); }))
+        P->set_value(std::move(Err));
+
+    return P->get_future();
+}
+
+std::future<Error> JitEngine::addModuleAsync(JITDylib &Tenant,
+                                             std::unique_ptr<Module> module,
+                                             VModuleKey K,
+                                             CompilePriority Priority)
+{
+    auto TSM = adoptModule(std::move(module));
+
+    if (!TSM)
+    {
+        std::promise<Error> Failed;
+        Failed.set_value(TSM.takeError());
+        return Failed.get_future();
+    }
+
+    return addModuleAsync(Tenant, std::move(*TSM), K, Priority);
+}
+
+Error JitEngine::getFunctionAddrAsync(JITDylib &Tenant, StringRef Name,
+                                      CompilePriority Priority,
+                                      FunctionAddrCallback OnReady)
+{
+    if (SymbolCacheEnabled.load(std::memory_order_relaxed))
+        if (JITTargetAddress A = Symbols.lookup(&Tenant, Name))
+        {
+            OnReady(A);
+            return Error::success();
+        }
+
+    auto Resolve = [this, &Tenant, Name = Name.str(),
+                    OnReady = std::move(OnReady)]() mutable {
+        OnReady(getFunctionAddr(Tenant, Name));
+    };
+
+    return getCompileQueue().submit(Priority, std::move(Resolve));
+}
+
+std::vector<std::string> JitEngine::getDefinedNames(const Module &module)
+{
+    std::vector<std::string> Names;
+
+    for (const GlobalValue &GV : module.global_values())
+        if (GV.hasName() && !GV.isDeclaration() && !GV.hasLocalLinkage() &&
+            !GV.hasAvailableExternallyLinkage())
+            Names.push_back(GV.getName().str());
+
+    return Names;
+}
+
+Error JitEngine::removeFunction(JITDylib &Tenant, StringRef Name)
+{
+    Error Err = Tenant.remove({Mangle(Name)});
+    invalidateSymbol(Tenant, Name);
+    return Err;
+}
+
 llvm::Error JitEngine::defineAbsolute(llvm::StringRef Name, llvm::JITEvaluatedSymbol Sym) {
+    return defineAbsolute(RuntimeJD, Name, Sym);
+}
+
+llvm::Error JitEngine::defineAbsolute(JITDylib &Tenant, llvm::StringRef Name,
+                                      llvm::JITEvaluatedSymbol Sym) {
     auto InternedName = ES.intern(Name);
-    SymbolMap Symbols({{InternedName, Sym}});
-    return ES.getMainJITDylib().define(absoluteSymbols(std::move(Symbols)));
+    SymbolMap Defs({{InternedName, Sym}});
+    Error Err = Tenant.define(absoluteSymbols(std::move(Defs)));
+
+    invalidateSymbol(Tenant, Name);
+    return Err;
 }
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/FunctionExtras.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/ADT/StringRef.h>
 #include <llvm/ExecutionEngine/JITEventListener.h>
 #include <llvm/ExecutionEngine/JITSymbol.h>
@@ -12,11 +15,74 @@
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/ThreadPool.h>
 #include <llvm/Target/TargetMachine.h>
 
+#include "CompileBudget.h"
+#include "CompileQueue.h"
+#include "CoroDriver.h"
+#include "FunctionDedup.h"
+#include "JitDiagnostics.h"
+#include "JitMemoryManager.h"
+#include "RuntimeLibrary.h"
+#include "SharedCode.h"
+#include "SymbolCache.h"
+#include "TargetMachinePool.h"
+
+#include <atomic>
 #include <functional>
+#include <future>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
+
+/// How the code of a module is generated
+enum class CompileMode
+{
+    /// Optimized IR (see JitOptimizer) and optimized code generation.
+    Optimized,
+
+    /// No IR optimization beyond lowering coroutines, O0 code generation
+    /// with FastISel, and no debugger registration. For code that runs once
+    /// or only a few times, where compiling dominates.
+    Quick
+};
+
+/// What happens to a host symbol that is not in the host symbol table
+enum class HostSymbolFallback
+{
+    /// Linking fails.
+    Fail,
+
+    /// The symbol is searched for in the process, as without a table.
+    Dynamic
+};
+
+/// A context of the engine, kept alive for as long as the handle is. The
+/// engine accepts modules created in it (as std::unique_ptr) for as long
+/// as any handle to it exists, even once it has been retired.
+class ContextHandle
+{
+
+public:
+    ContextHandle(llvm::orc::ThreadSafeContext TSC, std::shared_ptr<void> InUse)
+        : TSC(std::move(TSC)), InUse(std::move(InUse))
+    {
+    }
+
+    operator llvm::orc::ThreadSafeContext() const { return TSC; }
+
+    llvm::LLVMContext *getContext() { return TSC.getContext(); }
+
+    llvm::orc::ThreadSafeContext::Lock getLock() const { return TSC.getLock(); }
+
+private:
+    llvm::orc::ThreadSafeContext TSC;
+    std::shared_ptr<void> InUse;
+};
 
 class JitEngine
 {
@@ -41,51 +107,478 @@ public:
         return std::make_unique<JitEngine>(std::move(*JTMB), std::move(*DL));
     }
 
+    /// The context new modules should be created in. With context rotation
+    /// on, it stays alive at least until a module created in a newer context
+    /// has been added; threads that build modules concurrently should hold
+    /// on to getThreadSafeContext() instead.
     llvm::LLVMContext &getContext()
     {
+        std::lock_guard<std::mutex> Lock(ContextMutex);
         return *Context.getContext();
     }
 
-    llvm::Error addModule(std::unique_ptr<llvm::Module> module);
+    /// The current context, kept alive, and its modules accepted, for as
+    /// long as the handle is.
+    ContextHandle getThreadSafeContext()
+    {
+        std::lock_guard<std::mutex> Lock(ContextMutex);
+
+        std::shared_ptr<void> InUse = ContextInUse.lock();
+        if (!InUse)
+        {
+            InUse = std::make_shared<char>();
+            ContextInUse = InUse;
+        }
+
+        return ContextHandle(Context, std::move(InUse));
+    }
+
+    /// Create a fresh context once ModulesPerContext modules have been
+    /// added in the current one. A retired context is freed as soon as all
+    /// of its modules have been compiled (or removed) and nobody holds it,
+    /// so that the types and constants it interned do not accumulate. Zero,
+    /// the default, never rotates.
+    void setContextRotation(unsigned ModulesPerContext)
+    {
+        std::lock_guard<std::mutex> Lock(ContextMutex);
+        ContextRotation = ModulesPerContext;
+    }
+
+    /// Create a tenant
+    /// Every tenant owns a JITDylib of its own, so the symbols defined by one
+    /// tenant never collide with those of another. Tenants link against the
+    /// shared runtime dylib, which holds the host symbols.
+    llvm::Expected<llvm::orc::JITDylib &> createTenant(llvm::StringRef Name);
+
+    /// Return the tenant called Name, or nullptr if there is none.
+    llvm::orc::JITDylib *getTenant(llvm::StringRef Name);
+
+    /// The default tenant receives the modules and symbols added without an
+    /// explicit tenant.
+    llvm::orc::JITDylib &getDefaultTenant() { return ES.getMainJITDylib(); }
+
+    llvm::Error addModule(std::unique_ptr<llvm::Module> module)
+    {
+        return addModule(getDefaultTenant(), std::move(module));
+    }
+
+    llvm::Error addModule(llvm::orc::JITDylib &Tenant,
+                          std::unique_ptr<llvm::Module> module)
+    {
+        return addModule(Tenant, std::move(module), createModuleKey());
+    }
+
+    /// Add a module under a key obtained from createModuleKey, so that it
+    /// can later be unloaded with removeModule. The module must have been
+    /// created in a context returned by getContext().
+    llvm::Error addModule(llvm::orc::JITDylib &Tenant,
+                          std::unique_ptr<llvm::Module> module,
+                          llvm::orc::VModuleKey K,
+                          CompileMode Mode = CompileMode::Optimized);
+
+    /// Add a module that lives in a context of its own. Quick modules skip
+    /// runtime library linking, deduplication and partitioning too.
+    llvm::Error addModule(llvm::orc::JITDylib &Tenant,
+                          llvm::orc::ThreadSafeModule TSM,
+                          llvm::orc::VModuleKey K,
+                          CompileMode Mode = CompileMode::Optimized);
+
+    /// Add a module whose code is shared with the other processes that add
+    /// the same module with the same Region (see SharedCode.h). The first
+    /// one compiles the module into the region before returning; the others
+    /// link the code found there and skip compilation. If the region is
+    /// still being compiled into or holds a different module, the module is
+    /// compiled privately as by addModule. Shared modules are not
+    /// partitioned or deduplicated. Returns the role this process played.
+    ///
+    /// Should the first one fail to compile, the region is marked failed
+    /// and the module is removed before the error is returned. If it cannot
+    /// be removed yet, both errors are returned, and it must be removed
+    /// with removeModule(K) before it is added again.
+    llvm::Expected<SharedCodeRegion::Role>
+    addSharedModule(llvm::orc::JITDylib &Tenant, llvm::orc::ThreadSafeModule TSM,
+                    llvm::orc::VModuleKey K,
+                    std::shared_ptr<SharedCodeRegion> Region);
+
+    /// The module must have been created in a context returned by
+    /// getContext().
+    llvm::Expected<SharedCodeRegion::Role>
+    addSharedModule(llvm::orc::JITDylib &Tenant,
+                    std::unique_ptr<llvm::Module> module, llvm::orc::VModuleKey K,
+                    std::shared_ptr<SharedCodeRegion> Region);
+
+    llvm::orc::VModuleKey createModuleKey() { return ES.allocateVModule(); }
+
+    /// Compile every definition of the module added under K now, rather
+    /// than on first lookup. With compile threads, its partitions are
+    /// compiled in parallel.
+    llvm::Error compileModule(llvm::orc::VModuleKey K);
+
+    /// Compile on a pool of NumThreads threads instead of on the thread
+    /// that looks a symbol up, which still blocks until its code is ready.
+    /// Whatever a single lookup needs from different modules or partitions
+    /// is then compiled in parallel. Fails once a module has been added, or
+    /// if the threads are already running.
+    llvm::Error setCompileThreads(unsigned NumThreads);
+
+    /// Split every module of at least MinInstructions instructions into up
+    /// to Partitions modules that are optimized and compiled on their
+    /// own (see ModulePartitioner.h), and share the module's key. Calls
+    /// between partitions are not inlined. Zero or one partitions, the
+    /// default, keep modules whole.
+    void setModulePartitioning(unsigned Partitions, size_t MinInstructions)
+    {
+        PartitionMinInstructions.store(MinInstructions);
+        NumPartitions.store(Partitions);
+    }
+
+    /// Generate code with pooled target machines (see TargetMachinePool.h)
+    /// rather than with a new one per module. On by default.
+    void setTargetMachineReuse(bool Enabled)
+    {
+        for (TargetMachinePool *Pool : {CompileMachines.get(), QuickMachines.get(),
+                                        SharedMachines.get()})
+            Pool->setReuseEnabled(Enabled);
+    }
+
+    /// Number of target machines created for code generation so far
+    unsigned getNumTargetMachines() const
+    {
+        return CompileMachines->getNumCreated() + QuickMachines->getNumCreated() +
+               SharedMachines->getNumCreated();
+    }
+
+    /// Unload the module added under K: its symbols are removed from its
+    /// tenant and, if it was compiled, its code and data are freed. Nothing
+    /// may still be executing or referencing the module's code. The code of
+    /// a module that deduplicated functions of other modules refer to is
+    /// kept.
+    llvm::Error removeModule(llvm::orc::VModuleKey K);
 
     template <class Signature_t>
     llvm::Expected<std::function<Signature_t>> getFunction(llvm::StringRef Name)
     {
-        if (auto A = getFunctionAddr(Name))
+        return getFunction<Signature_t>(getDefaultTenant(), Name);
+    }
+
+    template <class Signature_t>
+    llvm::Expected<std::function<Signature_t>>
+    getFunction(llvm::orc::JITDylib &Tenant, llvm::StringRef Name)
+    {
+        if (auto A = getFunctionAddr(Tenant, Name))
             return std::function<Signature_t>(
                 llvm::jitTargetAddressToPointer<Signature_t *>(*A));
         else
             return A.takeError();
     }
 
+    /// Resolve Name in Tenant (and the runtime dylib), compiling it if needed.
+    llvm::Expected<llvm::JITTargetAddress>
+    getFunctionAddr(llvm::orc::JITDylib &Tenant, llvm::StringRef Name);
+
+    using AddModuleCallback = llvm::unique_function<void(llvm::Error)>;
+    using FunctionAddrCallback =
+        llvm::unique_function<void(llvm::Expected<llvm::JITTargetAddress>)>;
+
+    /// Size the compile queue behind the asynchronous calls. Otherwise it is
+    /// created on first use with one thread and room for 64 tasks; once it
+    /// exists it can no longer be changed.
+    llvm::Error setCompileQueue(unsigned NumThreads, size_t Capacity);
+
+    /// Add a module and compile all of its definitions on the compile
+    /// queue. OnReady runs on a compile thread, with the error of either
+    /// step. If the queue is full the error is returned right away and
+    /// OnReady is never called.
+    llvm::Error addModuleAsync(llvm::orc::JITDylib &Tenant,
+                               llvm::orc::ThreadSafeModule TSM,
+                               llvm::orc::VModuleKey K, CompilePriority Priority,
+                               AddModuleCallback OnReady);
+
+    std::future<llvm::Error>
+    addModuleAsync(llvm::orc::JITDylib &Tenant, llvm::orc::ThreadSafeModule TSM,
+                   llvm::orc::VModuleKey K,
+                   CompilePriority Priority = CompilePriority::Background);
+
+    /// The module must have been created in a context returned by
+    /// getContext().
+    std::future<llvm::Error>
+    addModuleAsync(llvm::orc::JITDylib &Tenant,
+                   std::unique_ptr<llvm::Module> module, llvm::orc::VModuleKey K,
+                   CompilePriority Priority = CompilePriority::Background);
+
+    /// Resolve Name on the compile queue. If the address is cached already,
+    /// OnReady is called right away on the calling thread. If the queue is
+    /// full the error is returned and OnReady is never called.
+    llvm::Error getFunctionAddrAsync(llvm::orc::JITDylib &Tenant,
+                                     llvm::StringRef Name,
+                                     CompilePriority Priority,
+                                     FunctionAddrCallback OnReady);
+
+    template <class Signature_t>
+    std::future<llvm::Expected<std::function<Signature_t>>>
+    getFunctionAsync(llvm::orc::JITDylib &Tenant, llvm::StringRef Name,
+                     CompilePriority Priority = CompilePriority::Interactive)
+    {
+        using Result_t = llvm::Expected<std::function<Signature_t>>;
+
+        auto P = std::make_shared<std::promise<Result_t>>();
+
+        auto OnReady = [P](llvm::Expected<llvm::JITTargetAddress> A) {
+            if (A)
+                P->set_value(std::function<Signature_t>(
+                    llvm::jitTargetAddressToPointer<Signature_t *>(*A)));
+            else
+                P->set_value(A.takeError());
+        };
+
+        if (auto Err = getFunctionAddrAsync(Tenant, Name, Priority,
+                                            std::move(OnReady)))
+            P->set_value(std::move(Err));
+
+        return P->get_future();
+    }
+
+    template <class Signature_t>
+    std::future<llvm::Expected<std::function<Signature_t>>>
+    getFunctionAsync(llvm::StringRef Name,
+                     CompilePriority Priority = CompilePriority::Interactive)
+    {
+        return getFunctionAsync<Signature_t>(getDefaultTenant(), Name, Priority);
+    }
+
+    /// Remove a function (or any other symbol) from Tenant. Together with
+    /// addModule or defineAbsolute this is how symbols are redefined.
+    llvm::Error removeFunction(llvm::orc::JITDylib &Tenant, llvm::StringRef Name);
+
+    llvm::Error removeFunction(llvm::StringRef Name)
+    {
+        return removeFunction(getDefaultTenant(), Name);
+    }
+
+    /// Resolved addresses are cached in front of the execution session. The
+    /// cache is on by default; turning it off is mostly useful to measure it.
+    void setSymbolCacheEnabled(bool Enabled)
+    {
+        SymbolCacheEnabled.store(Enabled, std::memory_order_relaxed);
+    }
+
+    /// Per-module compile budget of the optimizer. It is disabled until a
+    /// budget is set on it.
+    CompileBudget &getCompileBudget() { return Budget; }
+
+    /// Optimization remarks and pass timings of the modules compiled while
+    /// enabled. Disabled by default.
+    JitDiagnostics &getDiagnostics() { return Diagnostics; }
+
+    /// Sharing of identical optimized functions across modules. Disabled
+    /// by default; see FunctionDedup.h.
+    FunctionDeduplicator &getDeduplicator() { return Dedup; }
+
+    using CoroElisionHandler = std::function<void(const CoroElisionReport &)>;
+
+    /// Called after optimization for every coroutine driver (see
+    /// CoroDriver.h) in a module, with whether its frame was elided.
+    void setCoroElisionHandler(CoroElisionHandler Handler);
+
+    /// Notify L of every object loaded from now on, quick modules
+    /// included, and of the freeing of those objects, as the debugger is
+    /// (see JitProfiler.h). L must be removed before it is destroyed.
+    void addEventListener(llvm::JITEventListener &L);
+    void removeEventListener(llvm::JITEventListener &L);
+
+    /// Keep the bitcode of every module added from now on, as it was before
+    /// optimization, so that its functions can be recompiled later (see
+    /// JitSpecializer.h). Off by default.
+    void setRetainIR(bool Retain) { RetainIR.store(Retain); }
+
+    /// Bitcode of the module that defines Name in Tenant, or nullptr if
+    /// that module was added without retaining its IR.
+    std::shared_ptr<const llvm::MemoryBuffer>
+    getRetainedIR(llvm::orc::JITDylib &Tenant, llvm::StringRef Name);
+
+    /// Add a bitcode library with the definitions of host helpers. Every
+    /// module compiled from now on gets the helpers it calls linked in
+    /// before optimization, so they can be inlined. The helpers must still
+    /// be defined in the host (e.g. with defineAbsolute) for the calls that
+    /// cannot be linked.
+    llvm::Error addRuntimeBitcode(std::unique_ptr<llvm::MemoryBuffer> Buffer);
+
     const llvm::DataLayout & getDataLayout() const { return DL; }
     const llvm::orc::MangleAndInterner & getMangle() const { return Mangle; }
 
+    /// Resolve the host symbols JIT code may call (e.g. the libc functions
+    /// it uses) once, and define them in the runtime dylib. Without a
+    /// table, every unresolved external of every object is searched for in
+    /// all loaded libraries. Fails if a name cannot be found in the process.
+    /// Should be called before adding modules that use the symbols.
+    ///
+    /// The library functions that code generation and the optimizer may
+    /// introduce into any module (memcpy, memset, __udivti3, fmod...) are
+    /// added to the table, as far as the process has them. Names already
+    /// defined in the runtime dylib, e.g. by an earlier call, are kept.
+    llvm::Error setHostSymbolTable(llvm::ArrayRef<llvm::StringRef> Names,
+                                   HostSymbolFallback Fallback =
+                                       HostSymbolFallback::Fail);
+
+    /// Define a host symbol in the shared runtime dylib. It becomes visible
+    /// to every tenant.
     llvm::Error defineAbsolute(llvm::StringRef Name, llvm::JITEvaluatedSymbol Sym);
 
+    /// Define a host symbol that is only visible to Tenant.
+    llvm::Error defineAbsolute(llvm::orc::JITDylib &Tenant,
+                               llvm::StringRef Name,
+                               llvm::JITEvaluatedSymbol Sym);
+
     /// Constructor
     JitEngine(llvm::orc::JITTargetMachineBuilder JTMB, llvm::DataLayout DL);
 
+    /// The target machine builder of quick compilation
+    static llvm::orc::JITTargetMachineBuilder
+    getQuickTargetMachineBuilder(llvm::orc::JITTargetMachineBuilder JTMB);
+
+    /// The target machine builder of code shared between processes, which
+    /// must not depend on where it is loaded
+    static llvm::orc::JITTargetMachineBuilder
+    getSharedTargetMachineBuilder(llvm::orc::JITTargetMachineBuilder JTMB);
+
 private:
 
     /// Execution Session
     /// This object controls the JIT program. It is thread safe.
     llvm::orc::ExecutionSession ES;
 
+    /// Runtime Dylib
+    /// Holds the host symbols (absolute definitions and the process
+    /// resolver). It is only written by the engine and every tenant has it
+    /// in its search order.
+    llvm::orc::JITDylib &RuntimeJD;
+
+    /// Tenants
+    /// Named tenant dylibs. The mutex only protects the map: the dylibs
+    /// themselves are synchronized by the execution session.
+    std::mutex TenantsMutex;
+    llvm::StringMap<llvm::orc::JITDylib *> Tenants;
+
     /// GDB Listener
     /// This listener will be attached to the code generation to enable the
     /// debugging of JIT compiled code.
     llvm::JITEventListener *GDBListener;
 
+    /// Event Listeners
+    /// Notified under the mutex, so a listener is not called once removed.
+    std::mutex ListenersMutex;
+    std::vector<llvm::JITEventListener *> Listeners;
+
     llvm::DataLayout DL;
 
+    /// Compile Budget
+    /// Shared by every invocation of the optimizer transform.
+    CompileBudget Budget;
+
+    JitDiagnostics Diagnostics;
+
+    FunctionDeduplicator Dedup;
+
+    /// Modules
+    /// The tenant and defined names of every module, and the memory manager
+    /// of every module that has been loaded, for removeModule.
+    struct ModuleRecord
+    {
+        llvm::orc::JITDylib *Tenant;
+        std::vector<std::string> Names;
+        std::shared_ptr<const llvm::MemoryBuffer> IR;
+
+        /// Keys of the partitions but the first, which has the module's key
+        std::vector<llvm::orc::VModuleKey> PartitionKeys;
+
+        /// Compiled in quick mode, hence not registered with the debugger
+        bool Quick = false;
+    };
+
+    std::atomic<bool> RetainIR{false};
+
+    std::atomic<unsigned> NumPartitions{0};
+    std::atomic<size_t> PartitionMinInstructions{0};
+
+    std::mutex ModulesMutex;
+    std::map<llvm::orc::VModuleKey, ModuleRecord> Modules;
+    std::map<llvm::orc::VModuleKey, JitMemoryManager *> MemoryManagers;
+
+    /// Target triple and features, which shared code must have been
+    /// compiled for. Part of the hash that identifies a shared module.
+    const std::string SharedTargetId;
+
+    /// Target machines of the optimized, quick and shared compile layers
+    std::shared_ptr<TargetMachinePool> CompileMachines;
+    std::shared_ptr<TargetMachinePool> QuickMachines;
+    std::shared_ptr<TargetMachinePool> SharedMachines;
+
     llvm::orc::RTDyldObjectLinkingLayer ObjectLayer;
     llvm::orc::IRCompileLayer CompileLayer;
     llvm::orc::IRTransformLayer OptimizeLayer;
+
+    /// Quick compilation
+    /// A layer chain of its own, into the same object layer.
+    llvm::orc::IRCompileLayer QuickCompileLayer;
+    llvm::orc::IRTransformLayer QuickLayer;
+
+    /// Shared code
+    /// A layer chain of its own that compiles position independent code,
+    /// into an object layer that links it into shared regions.
+    SharedObjectLayer SharedObjects;
+    llvm::orc::IRCompileLayer SharedCompileLayer;
+    llvm::orc::IRTransformLayer SharedLayer;
+
+    /// Contexts
+    /// Context is where new modules are created. A retired context is
+    /// referenced here while handles to it exist (ContextHandle), or else
+    /// until a module of a newer context is added; after that, only its
+    /// pending modules keep it alive.
+    std::mutex ContextMutex;
     llvm::orc::ThreadSafeContext Context;
+    std::weak_ptr<void> ContextInUse;
+
+    struct RetiredContext
+    {
+        llvm::orc::ThreadSafeContext Context;
+        std::weak_ptr<void> InUse;
+    };
+
+    std::vector<RetiredContext> RetiredContexts;
+    unsigned ContextRotation = 0;
+    unsigned ModulesInContext = 0;
 
     llvm::orc::MangleAndInterner Mangle;
 
+    /// Symbol Cache
+    /// Lock-free cache of the addresses returned by getFunctionAddr, keyed by
+    /// tenant and unmangled name. Every path that defines or removes a
+    /// symbol invalidates the name.
+    SymbolCache Symbols;
+    std::atomic<bool> SymbolCacheEnabled;
+
+    /// Runtime Libraries
+    /// Linked into each module by the optimize transform, which takes a
+    /// snapshot of the list so libraries can be added concurrently.
+    std::mutex RuntimeLibrariesMutex;
+    std::vector<std::shared_ptr<const RuntimeLibrary>> RuntimeLibraries;
+
+    std::mutex CoroElisionMutex;
+    CoroElisionHandler CoroElisionReporter;
+
+    /// Compile Threads
+    /// Materialization is dispatched to them once set. Destroyed before the
+    /// layers and the session their tasks use.
+    std::unique_ptr<llvm::ThreadPool> CompileThreads;
+
+    /// Compile Queue
+    /// Created on first use. Declared last so that it is destroyed, and its
+    /// pending tasks run, while the rest of the engine is still alive.
+    std::mutex QueueMutex;
+    std::unique_ptr<CompileQueue> Queue;
+
+    CompileQueue &getCompileQueue();
+
     llvm::orc::RTDyldObjectLinkingLayer::GetMemoryManagerFunction
     createMemoryManagerFtor();
 
@@ -96,5 +589,25 @@ private:
 
     llvm::Error applyDataLayout(llvm::Module &module);
 
-    llvm::Expected<llvm::JITTargetAddress> getFunctionAddr(llvm::StringRef Name);
+    /// Whether K is the key of a module added in quick mode
+    bool isQuick(llvm::orc::VModuleKey K);
+
+    /// Free the code of the object of K, if it was ever loaded.
+    void freeObject(llvm::orc::VModuleKey K, bool Quick);
+
+    /// Drop what is cached about Name, as it was defined, redefined or
+    /// removed in JD.
+    void invalidateSymbol(const llvm::orc::JITDylib &JD, llvm::StringRef Name);
+
+    /// Wrap a module created in one of the engine's contexts, and rotate
+    /// the context if it is due.
+    llvm::Expected<llvm::orc::ThreadSafeModule>
+    adoptModule(std::unique_ptr<llvm::Module> module);
+
+    llvm::Error linkRuntimeLibraries(llvm::Module &module);
+
+    void reportCoroElision(const llvm::Module &module);
+
+    static std::vector<std::string> getDefinedNames(const llvm::Module &module);
+
 };
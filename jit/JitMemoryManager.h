@@ -0,0 +1,105 @@
+#pragma once
+
+#include <llvm/ExecutionEngine/RuntimeDyld.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+
+#include <memory>
+#include <mutex>
+
+/// Releasable memory manager
+///
+/// The object linking layer keeps the memory manager of every object it
+/// loads until the layer itself is destroyed. This class is the one the
+/// layer owns: it forwards to a SectionMemoryManager (or another memory
+/// manager, such as SharedCodeMemoryManager) that the engine can release
+/// earlier, which unmaps the code and data of the object once its module
+/// has been removed. After release() only this small forwarding shell
+/// stays behind.
+class JitMemoryManager : public llvm::RuntimeDyld::MemoryManager
+{
+
+public:
+    JitMemoryManager() : Inner(std::make_unique<llvm::SectionMemoryManager>()) {}
+
+    explicit JitMemoryManager(std::unique_ptr<llvm::RuntimeDyld::MemoryManager> Inner)
+        : Inner(std::move(Inner))
+    {
+    }
+
+    bool needsToReserveAllocationSpace() override
+    {
+        return Inner->needsToReserveAllocationSpace();
+    }
+
+    void reserveAllocationSpace(uintptr_t CodeSize, uint32_t CodeAlign,
+                                uintptr_t RODataSize, uint32_t RODataAlign,
+                                uintptr_t RWDataSize,
+                                uint32_t RWDataAlign) override
+    {
+        Inner->reserveAllocationSpace(CodeSize, CodeAlign, RODataSize,
+                                      RODataAlign, RWDataSize, RWDataAlign);
+    }
+
+    uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment,
+                                 unsigned SectionID,
+                                 llvm::StringRef SectionName) override
+    {
+        return Inner->allocateCodeSection(Size, Alignment, SectionID,
+                                          SectionName);
+    }
+
+    uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment,
+                                 unsigned SectionID,
+                                 llvm::StringRef SectionName,
+                                 bool IsReadOnly) override
+    {
+        return Inner->allocateDataSection(Size, Alignment, SectionID,
+                                          SectionName, IsReadOnly);
+    }
+
+    void registerEHFrames(uint8_t *Addr, uint64_t LoadAddr,
+                          size_t Size) override
+    {
+        Inner->registerEHFrames(Addr, LoadAddr, Size);
+    }
+
+    void deregisterEHFrames() override
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+
+        if (Inner)
+            Inner->deregisterEHFrames();
+    }
+
+    void notifyObjectLoaded(llvm::RuntimeDyld &RTDyld,
+                            const llvm::object::ObjectFile &Obj) override
+    {
+        Inner->notifyObjectLoaded(RTDyld, Obj);
+    }
+
+    bool finalizeMemory(std::string *ErrMsg = nullptr) override
+    {
+        return Inner->finalizeMemory(ErrMsg);
+    }
+
+    /// Deregister the EH frames and free all the memory of the object. The
+    /// object's code must not be running or be called again.
+    void release()
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+
+        if (!Inner)
+            return;
+
+        Inner->deregisterEHFrames();
+        Inner.reset();
+    }
+
+private:
+    /// Only serializes release against the layer's final deregistration;
+    /// allocation and finalization always happen before the engine can
+    /// release the object.
+    std::mutex Mutex;
+
+    std::unique_ptr<llvm::RuntimeDyld::MemoryManager> Inner;
+};
@@ -3,10 +3,12 @@
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/IRPrintingPasses.h>
 #include <llvm/Transforms/Coroutines.h>
+#include <llvm/Transforms/IPO/AlwaysInliner.h>
 #include <llvm/Support/Debug.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/PassRegistry.h>
 
+#include <chrono>
 #include <fstream>
 #include <iostream>
 
@@ -15,13 +17,53 @@ using namespace llvm::orc;
 
 Expected<ThreadSafeModule>
 JitOptimizer::operator()(ThreadSafeModule TSM,
-                            const MaterializationResponsibility &)
+                            const MaterializationResponsibility &) const
 {
     Module &M = *TSM.getModule();
 
+    CompileReport Report;
+    Report.ModuleName = M.getModuleIdentifier();
+    Report.RequestedOptLevel = OptLevel;
+    Report.OptLevel = OptLevel;
+
+    if (Budget && Budget->isEnabled())
+        applyBudget(M, Report);
+
+    auto Start = std::chrono::steady_clock::now();
+
+    if (Diagnostics && Diagnostics->isEnabled())
+        Diagnostics->collect(M, [&]() { runPipeline(M, Report.OptLevel); });
+    else
+    {
+        std::shared_lock<std::shared_timed_mutex> Lock(JitDiagnostics::getPipelineLock());
+        runPipeline(M, Report.OptLevel);
+    }
+
+    if (Budget && Budget->isEnabled())
+    {
+        std::chrono::duration<double, std::milli> Elapsed =
+            std::chrono::steady_clock::now() - Start;
+
+        Report.ElapsedMs = Elapsed.count();
+        Budget->record(Report);
+    }
+
+    return std::move(TSM);
+}
+
+void JitOptimizer::runPipeline(Module &M, unsigned Level) const
+{
+    PassManagerBuilder B;
+    B.OptLevel = Level;
+
     legacy::FunctionPassManager FPM(&M);
 
-    B.Inliner = createFunctionInliningPass(B.OptLevel, B.SizeLevel, false);
+    // At O0 only always_inline functions are inlined, as in clang; the
+    // pipeline then does little more than lower coroutines.
+    if (Level == 0)
+        B.Inliner = createAlwaysInlinerLegacyPass();
+    else
+        B.Inliner = createFunctionInliningPass(B.OptLevel, B.SizeLevel, false);
 
     addCoroutinePassesToExtensionPoints(B);
 
@@ -35,6 +77,30 @@ JitOptimizer::operator()(ThreadSafeModule TSM,
     legacy::PassManager MPM;
     B.populateModulePassManager(MPM);
     MPM.run(M);
+}
 
-    return std::move(TSM);
+void JitOptimizer::applyBudget(Module &M, CompileReport &Report) const
+{
+    unsigned Threshold = Budget->getLargeFunctionThreshold();
+
+    for (Function &F : M)
+    {
+        if (F.isDeclaration())
+            continue;
+
+        unsigned Size = F.getInstructionCount();
+        Report.Instructions += Size;
+
+        // optsize lowers the inline threshold for calls inside F and turns
+        // off partial and runtime unrolling of its loops.
+        if (Threshold && Size > Threshold &&
+            !F.hasFnAttribute(Attribute::OptimizeForSize))
+        {
+            F.addFnAttr(Attribute::OptimizeForSize);
+            Report.ReducedFunctions++;
+        }
+    }
+
+    Report.OptLevel = Budget->selectOptLevel(OptLevel, Report.Instructions,
+                                             Report.ProjectedMs);
 }
\ No newline at end of file
@@ -6,20 +6,36 @@
 #include <llvm/Transforms/IPO.h>
 #include <llvm/Transforms/IPO/PassManagerBuilder.h>
 
+#include "CompileBudget.h"
+#include "JitDiagnostics.h"
+
 class JitOptimizer
 {
 
 public:
-    JitOptimizer(unsigned OptLevel)
-    {
-        B.OptLevel = OptLevel;
-    }
+    /// When a Budget is given, the requested OptLevel is an upper bound that
+    /// the budget may lower for modules that would take too long. When
+    /// Diagnostics are given and enabled, they record what the pipeline did.
+    JitOptimizer(unsigned OptLevel, CompileBudget *Budget = nullptr,
+                 JitDiagnostics *Diagnostics = nullptr)
+        : OptLevel(OptLevel), Budget(Budget), Diagnostics(Diagnostics) {}
 
+    /// The transform is installed once in the optimize layer and may be
+    /// invoked concurrently for modules of different tenants, so the pass
+    /// pipeline is built from scratch on every call.
     llvm::Expected<llvm::orc::ThreadSafeModule>
     operator()(llvm::orc::ThreadSafeModule TSM,
-               const llvm::orc::MaterializationResponsibility &);
+               const llvm::orc::MaterializationResponsibility &) const;
 
 private:
-    llvm::PassManagerBuilder B;
+    unsigned OptLevel;
+    CompileBudget *Budget;
+    JitDiagnostics *Diagnostics;
+
+    /// Optimize oversized functions for size and choose the opt level for the
+    /// module. Fills in the size and level fields of Report.
+    void applyBudget(llvm::Module &M, CompileReport &Report) const;
+
+    void runPipeline(llvm::Module &M, unsigned Level) const;
 
-};
\ No newline at end of file
+};
@@ -0,0 +1,355 @@
+#include "JitProfiler.h"
+
+#include <llvm/Object/SymbolSize.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#include <signal.h>
+#include <sys/time.h>
+#include <ucontext.h>
+
+using namespace llvm;
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define JIT_PROFILER_SUPPORTED 1
+#else
+#define JIT_PROFILER_SUPPORTED 0
+#endif
+
+/// The sample buffer is global, so that a signal that arrives while a
+/// profiler is being destroyed never touches it. Every slot holds a
+/// program counter, or zero when free.
+static const size_t SampleSlots = 8192;
+static std::atomic<uintptr_t> Samples[SampleSlots];
+static std::atomic<uint64_t> NextSlot{0};
+static std::atomic<uint64_t> NumDropped{0};
+
+/// Whether the handler stores samples. It stays installed after stop, as
+/// a pending SIGPROF would otherwise terminate the process.
+static std::atomic<bool> Sampling{false};
+
+static std::atomic<JitProfiler *> ActiveProfiler{nullptr};
+
+/// How often the profiler's thread drains the buffer while sampling
+static const std::chrono::milliseconds DrainInterval(50);
+
+static uintptr_t getSampledPC(void *Context)
+{
+#if JIT_PROFILER_SUPPORTED && defined(__x86_64__)
+    return static_cast<ucontext_t *>(Context)->uc_mcontext.gregs[REG_RIP];
+#elif JIT_PROFILER_SUPPORTED && defined(__aarch64__)
+    return static_cast<ucontext_t *>(Context)->uc_mcontext.pc;
+#else
+    (void)Context;
+    return 0;
+#endif
+}
+
+/// Async-signal-safe: lock-free atomics only.
+static void handleSample(int, siginfo_t *, void *Context)
+{
+    if (!Sampling.load(std::memory_order_relaxed))
+        return;
+
+    uintptr_t PC = getSampledPC(Context);
+    if (!PC)
+        return;
+
+    uint64_t Slot = NextSlot.fetch_add(1, std::memory_order_relaxed) % SampleSlots;
+    uintptr_t Free = 0;
+
+    if (!Samples[Slot].compare_exchange_strong(Free, PC, std::memory_order_release,
+                                               std::memory_order_relaxed))
+        NumDropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+static Error makeSystemError(const char *What)
+{
+    int Errno = errno;
+    return createStringError(std::error_code(Errno, std::generic_category()),
+                             "%s: %s", What, std::strerror(Errno));
+}
+
+JitProfiler::~JitProfiler()
+{
+    stop();
+}
+
+Error JitProfiler::start(std::chrono::microseconds Interval)
+{
+#if !JIT_PROFILER_SUPPORTED
+    return createStringError(inconvertibleErrorCode(),
+                             "Sampling is not supported on this platform");
+#endif
+
+    if (Interval.count() <= 0)
+        return createStringError(inconvertibleErrorCode(),
+                                 "The sampling interval must be positive");
+
+    JitProfiler *None = nullptr;
+    if (!ActiveProfiler.compare_exchange_strong(None, this))
+        return createStringError(inconvertibleErrorCode(),
+                                 None == this ? "The profiler is already running"
+                                              : "Another profiler is running");
+
+    struct sigaction Previous;
+    sigaction(SIGPROF, nullptr, &Previous);
+
+    bool Ours = (Previous.sa_flags & SA_SIGINFO) &&
+                Previous.sa_sigaction == handleSample;
+
+    if (!Ours && Previous.sa_handler != SIG_DFL && Previous.sa_handler != SIG_IGN)
+    {
+        ActiveProfiler.store(nullptr);
+        return createStringError(inconvertibleErrorCode(),
+                                 "SIGPROF is handled by someone else");
+    }
+
+    struct itimerval Timer;
+    getitimer(ITIMER_PROF, &Timer);
+
+    if (Timer.it_value.tv_sec || Timer.it_value.tv_usec)
+    {
+        ActiveProfiler.store(nullptr);
+        return createStringError(inconvertibleErrorCode(),
+                                 "The profiling timer is in use");
+    }
+
+    if (!Ours)
+    {
+        struct sigaction Action;
+        memset(&Action, 0, sizeof(Action));
+        Action.sa_sigaction = handleSample;
+        Action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&Action.sa_mask);
+
+        if (sigaction(SIGPROF, &Action, nullptr))
+        {
+            Error Err = makeSystemError("Cannot handle SIGPROF");
+            ActiveProfiler.store(nullptr);
+            return Err;
+        }
+    }
+
+    // Left over by an earlier profiler
+    for (std::atomic<uintptr_t> &Slot : Samples)
+        Slot.store(0, std::memory_order_relaxed);
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Running = true;
+    }
+
+    Sampling.store(true);
+
+    Timer.it_interval.tv_sec = Interval.count() / 1000000;
+    Timer.it_interval.tv_usec = Interval.count() % 1000000;
+    Timer.it_value = Timer.it_interval;
+
+    if (setitimer(ITIMER_PROF, &Timer, nullptr))
+    {
+        Error Err = makeSystemError("Cannot set the profiling timer");
+        Sampling.store(false);
+        {
+            std::lock_guard<std::mutex> Lock(Mutex);
+            Running = false;
+        }
+        ActiveProfiler.store(nullptr);
+        return Err;
+    }
+
+    Drainer = std::thread([this]() {
+        std::unique_lock<std::mutex> Lock(Mutex);
+
+        while (Running)
+        {
+            Stopping.wait_for(Lock, DrainInterval);
+            drain();
+        }
+    });
+
+    return Error::success();
+}
+
+void JitProfiler::stop()
+{
+    if (ActiveProfiler.load() != this)
+        return;
+
+    struct itimerval Off;
+    memset(&Off, 0, sizeof(Off));
+    setitimer(ITIMER_PROF, &Off, nullptr);
+
+    Sampling.store(false);
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Running = false;
+    }
+
+    Stopping.notify_all();
+    Drainer.join();
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        drain();
+    }
+
+    ActiveProfiler.store(nullptr);
+}
+
+bool JitProfiler::isRunning()
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return Running;
+}
+
+void JitProfiler::drain()
+{
+    for (std::atomic<uintptr_t> &Slot : Samples)
+    {
+        uintptr_t PC = Slot.exchange(0, std::memory_order_acquire);
+        if (!PC)
+            continue;
+
+        NumSamples++;
+
+        auto I = Ranges.upper_bound(PC);
+        if (I == Ranges.begin())
+            continue;
+
+        --I;
+        if (PC < I->second.End)
+            I->second.Function.Samples++;
+    }
+}
+
+std::vector<JitProfiler::HotFunction> JitProfiler::getHotFunctions(size_t N)
+{
+    std::vector<HotFunction> Hot;
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        drain();
+
+        Hot = Freed;
+        for (const auto &R : Ranges)
+            if (R.second.Function.Samples)
+                Hot.push_back(R.second.Function);
+    }
+
+    std::sort(Hot.begin(), Hot.end(),
+              [](const HotFunction &A, const HotFunction &B) {
+                  return A.Samples > B.Samples;
+              });
+
+    if (Hot.size() > N)
+        Hot.resize(N);
+
+    return Hot;
+}
+
+uint64_t JitProfiler::getNumSamples()
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    drain();
+    return NumSamples;
+}
+
+uint64_t JitProfiler::getNumDropped() const
+{
+    return NumDropped.load(std::memory_order_relaxed);
+}
+
+void JitProfiler::reset()
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    drain();
+
+    for (auto &R : Ranges)
+        R.second.Function.Samples = 0;
+
+    Freed.clear();
+    NumSamples = 0;
+    NumDropped.store(0);
+}
+
+void JitProfiler::notifyObjectLoaded(ObjectKey K, const object::ObjectFile &Obj,
+                                     const RuntimeDyld::LoadedObjectInfo &L)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    std::vector<uint64_t> &Starts = Objects[K];
+
+    for (const auto &SymSize : object::computeSymbolSizes(Obj))
+    {
+        const object::SymbolRef &Sym = SymSize.first;
+
+        Expected<object::SymbolRef::Type> Type = Sym.getType();
+        if (!Type)
+        {
+            consumeError(Type.takeError());
+            continue;
+        }
+
+        if (*Type != object::SymbolRef::ST_Function || !SymSize.second)
+            continue;
+
+        Expected<StringRef> Name = Sym.getName();
+        Expected<object::section_iterator> Sec = Sym.getSection();
+        Expected<uint64_t> Addr = Sym.getAddress();
+
+        if (!Name || !Sec || !Addr || *Sec == Obj.section_end())
+        {
+            if (!Name)
+                consumeError(Name.takeError());
+            if (!Sec)
+                consumeError(Sec.takeError());
+            if (!Addr)
+                consumeError(Addr.takeError());
+            continue;
+        }
+
+        uint64_t Load = L.getSectionLoadAddress(**Sec);
+        if (!Load)
+            continue;
+
+        uint64_t Start = Load + (*Addr - (*Sec)->getAddress());
+
+        StringRef Unprefixed = *Name;
+        if (GlobalPrefix != '\0' && Unprefixed.startswith(StringRef(&GlobalPrefix, 1)))
+            Unprefixed = Unprefixed.drop_front();
+
+        Ranges[Start] = Range{Start + SymSize.second,
+                              HotFunction{Unprefixed.str(), K, 0}};
+        Starts.push_back(Start);
+    }
+}
+
+void JitProfiler::notifyFreeingObject(ObjectKey K)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    auto O = Objects.find(K);
+    if (O == Objects.end())
+        return;
+
+    // Whatever was sampled in the object's code is in the buffer by now.
+    drain();
+
+    for (uint64_t Start : O->second)
+    {
+        auto R = Ranges.find(Start);
+        if (R == Ranges.end() || R->second.Function.Key != K)
+            continue;
+
+        if (R->second.Function.Samples)
+            Freed.push_back(std::move(R->second.Function));
+
+        Ranges.erase(R);
+    }
+
+    Objects.erase(O);
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/ExecutionEngine/RuntimeDyld.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/Error.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Sampling profiler
+///
+/// Samples the program counter of the process on a SIGPROF timer, which
+/// ticks with the CPU time of all its threads and interrupts the thread
+/// that is running, and attributes the samples to the JIT compiled
+/// functions they fall in. Functions are learned from the objects the
+/// engine loads once the profiler is registered as an event listener (see
+/// JitEngine::addEventListener); samples anywhere else only count towards
+/// the total.
+///
+/// The signal handler only stores the sample in a fixed lock-free buffer,
+/// which a thread of the profiler drains while it runs, and which is
+/// drained as well before reports and before code is freed, so that
+/// samples are never attributed to code loaded later at the same address.
+/// Samples are dropped while the buffer is full.
+///
+/// Only one profiler samples at a time, and not while the process has a
+/// SIGPROF handler or profiling timer of its own. Linux on x86-64 and
+/// AArch64 only.
+class JitProfiler : public llvm::JITEventListener
+{
+
+public:
+    /// GlobalPrefix is that of the engine's data layout, and is stripped
+    /// from the names of the functions reported.
+    explicit JitProfiler(char GlobalPrefix = '\0') : GlobalPrefix(GlobalPrefix) {}
+
+    /// Stops sampling
+    ~JitProfiler() override;
+
+    /// Sample every Interval of process CPU time until stop.
+    llvm::Error start(std::chrono::microseconds Interval = std::chrono::milliseconds(1));
+
+    void stop();
+
+    bool isRunning();
+
+    struct HotFunction
+    {
+        std::string Name;
+
+        /// Key of the object the function was loaded with, which is that
+        /// of its module, or of its partition for partitioned modules
+        ObjectKey Key;
+
+        uint64_t Samples;
+    };
+
+    /// The N functions with the most samples, most first. Functions whose
+    /// code has been freed are still reported.
+    std::vector<HotFunction> getHotFunctions(size_t N);
+
+    /// Number of samples taken, in JIT compiled code or not
+    uint64_t getNumSamples();
+
+    /// Number of samples dropped because the buffer was full
+    uint64_t getNumDropped() const;
+
+    /// Forget the samples taken so far.
+    void reset();
+
+    void notifyObjectLoaded(ObjectKey K, const llvm::object::ObjectFile &Obj,
+                            const llvm::RuntimeDyld::LoadedObjectInfo &L) override;
+
+    void notifyFreeingObject(ObjectKey K) override;
+
+private:
+    const char GlobalPrefix;
+
+    struct Range
+    {
+        uint64_t End;
+        HotFunction Function;
+    };
+
+    /// Mutex protects everything below.
+    std::mutex Mutex;
+
+    /// Code of the functions loaded, by start address
+    std::map<uint64_t, Range> Ranges;
+
+    /// Start addresses of the functions of every object
+    std::map<ObjectKey, std::vector<uint64_t>> Objects;
+
+    /// Functions with samples whose code has been freed
+    std::vector<HotFunction> Freed;
+
+    uint64_t NumSamples = 0;
+
+    bool Running = false;
+    std::condition_variable Stopping;
+    std::thread Drainer;
+
+    /// Attribute the samples in the buffer. Requires Mutex.
+    void drain();
+};
@@ -0,0 +1,156 @@
+#include "JitSpecializer.h"
+#include "RetainedIR.h"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+
+#include <algorithm>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+JitSpecializer::JitSpecializer(JitEngine &JIT, JITDylib &Tenant, size_t Capacity) :
+    JIT(JIT),
+    Tenant(Tenant),
+    Cache(JIT, Capacity)
+{
+}
+
+/// Name, then every bound argument as index and bits, in index order
+static std::string getKey(StringRef Name, ArrayRef<BoundArgument> Args)
+{
+    std::string Key = Name.str();
+
+    for (const BoundArgument &A : Args)
+    {
+        Key += '\0';
+        Key += std::to_string(A.Index) + "=" + std::to_string(A.Bits);
+    }
+
+    return Key;
+}
+
+Expected<JITTargetAddress>
+JitSpecializer::getAddress(StringRef Name, ArrayRef<BoundArgument> Args)
+{
+    std::vector<BoundArgument> Sorted(Args.begin(), Args.end());
+    std::sort(Sorted.begin(), Sorted.end(),
+              [](const BoundArgument &L, const BoundArgument &R) {
+                  return L.Index < R.Index;
+              });
+
+    for (size_t i = 1; i < Sorted.size(); i++)
+        if (Sorted[i].Index == Sorted[i - 1].Index)
+            return createStringError(inconvertibleErrorCode(),
+                                     "Argument %u of '%s' is bound twice",
+                                     Sorted[i].Index, Name.str().c_str());
+
+    return Cache.getOrCompile(getKey(Name, Sorted), [&](VModuleKey K) {
+        return specialize(Name, Sorted, K);
+    });
+}
+
+static Expected<Constant *> getConstant(Type *Ty, uint64_t Bits)
+{
+    if (auto *ITy = dyn_cast<IntegerType>(Ty))
+        if (ITy->getBitWidth() <= 64)
+            return ConstantInt::get(ITy, Bits);
+
+    if (Ty->isFloatTy())
+        return ConstantFP::get(Ty->getContext(),
+                               APFloat(APFloat::IEEEsingle(), APInt(32, Bits)));
+
+    if (Ty->isDoubleTy())
+        return ConstantFP::get(Ty->getContext(),
+                               APFloat(APFloat::IEEEdouble(), APInt(64, Bits)));
+
+    if (Ty->isPointerTy())
+        return ConstantExpr::getIntToPtr(
+            ConstantInt::get(Type::getInt64Ty(Ty->getContext()), Bits), Ty);
+
+    std::string buffer;
+    raw_string_ostream os(buffer);
+    Ty->print(os);
+
+    return createStringError(inconvertibleErrorCode(),
+                             "Cannot bind an argument of type %s",
+                             os.str().c_str());
+}
+
+Expected<JITTargetAddress>
+JitSpecializer::specialize(StringRef Name, ArrayRef<BoundArgument> Args,
+                           VModuleKey K)
+{
+    // The retained IR is parsed afresh, into a context that belongs to the
+    // specialization's module alone.
+    auto Ctx = std::make_unique<LLVMContext>();
+
+    auto M = loadRetainedIR(JIT, Tenant, Name, *Ctx);
+    if (!M)
+        return M.takeError();
+
+    Module &module = **M;
+    Function *F = module.getFunction(Name);
+
+    std::string SpecName = Name.str() + ".spec." + std::to_string(K);
+
+    Function *NF = Function::Create(F->getFunctionType(),
+                                    GlobalValue::ExternalLinkage, SpecName,
+                                    module);
+
+    ValueToValueMapTy VMap;
+    auto NA = NF->arg_begin();
+    const BoundArgument *Bound = Args.begin();
+
+    for (Argument &A : F->args())
+    {
+        Argument *Arg = &*NA++;
+        Arg->setName(A.getName());
+
+        if (Bound != Args.end() && Bound->Index == A.getArgNo())
+        {
+            auto C = getConstant(A.getType(), Bound->Bits);
+            if (!C)
+                return C.takeError();
+
+            VMap[&A] = *C;
+            Bound++;
+        }
+        else
+            VMap[&A] = Arg;
+    }
+
+    if (Bound != Args.end())
+        return createStringError(inconvertibleErrorCode(),
+                                 "'%s' has no argument %u",
+                                 Name.str().c_str(), Bound->Index);
+
+    SmallVector<ReturnInst *, 8> Returns;
+    CloneFunctionInto(NF, F, VMap, false, Returns);
+
+    NF->setLinkage(GlobalValue::ExternalLinkage);
+    NF->setComdat(nullptr);
+
+    // Everything else is compiled in the tenant already.
+    if (auto Err = keepOnlyForInlining(module, *NF))
+        return std::move(Err);
+
+    if (auto Err = JIT.addModule(Tenant,
+                                 ThreadSafeModule(std::move(*M), std::move(Ctx)),
+                                 K))
+        return std::move(Err);
+
+    auto Addr = JIT.getFunctionAddr(Tenant, SpecName);
+    if (!Addr)
+    {
+        consumeError(JIT.removeModule(K));
+        return Addr.takeError();
+    }
+
+    return *Addr;
+}
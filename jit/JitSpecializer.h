@@ -0,0 +1,105 @@
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ExecutionEngine/JITSymbol.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/Support/Error.h>
+
+#include "CompiledFunctionCache.h"
+#include "JitEngine.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <type_traits>
+
+/// An argument fixed to a value, given as the bits of the host value
+struct BoundArgument
+{
+    unsigned Index;
+    uint64_t Bits;
+
+    /// Integers, floating point values and pointers of up to 64 bits
+    template <typename T>
+    static BoundArgument bind(unsigned Index, T Value)
+    {
+        static_assert(std::is_arithmetic<T>::value || std::is_pointer<T>::value,
+                      "Only scalars can be bound");
+        static_assert(sizeof(T) <= sizeof(uint64_t), "Value too wide");
+
+        BoundArgument A{Index, 0};
+        std::memcpy(&A.Bits, &Value, sizeof(T));
+        return A;
+    }
+};
+
+/// Function specializer
+///
+/// Recompiles a JIT function with some of its arguments replaced by
+/// constants, so that the optimizer can fold the work that depends on them.
+/// The specialized function keeps the signature of the original and
+/// ignores the values passed for bound arguments, so it can be called
+/// through the same function type.
+///
+/// The function is cloned from the IR its module had when it was added,
+/// which the engine only keeps with JitEngine::setRetainIR. The rest of
+/// that module goes along as available_externally definitions: the
+/// optimizer can inline them, but the code that runs for them outside the
+/// clone is the code already in the tenant. Functions that use mutable
+/// module-private globals cannot be specialized, since the clone would get
+/// its own copy of them. Bound pointers are embedded as constants, so what
+/// they point to must outlive the specialization.
+///
+/// Specializations are cached by function and bound values, at most
+/// Capacity of them (see CompiledFunctionCache.h).
+class JitSpecializer
+{
+
+public:
+    JitSpecializer(JitEngine &JIT, size_t Capacity)
+        : JitSpecializer(JIT, JIT.getDefaultTenant(), Capacity) {}
+
+    JitSpecializer(JitEngine &JIT, llvm::orc::JITDylib &Tenant, size_t Capacity);
+
+    JitSpecializer(const JitSpecializer &) = delete;
+    JitSpecializer &operator=(const JitSpecializer &) = delete;
+
+    /// Return the address of Name specialized for Args, compiling it on a
+    /// miss.
+    llvm::Expected<llvm::JITTargetAddress>
+    getAddress(llvm::StringRef Name, llvm::ArrayRef<BoundArgument> Args);
+
+    /// Signature_t is the signature of the original function.
+    template <class Signature_t>
+    llvm::Expected<std::function<Signature_t>>
+    get(llvm::StringRef Name, llvm::ArrayRef<BoundArgument> Args)
+    {
+        if (auto A = getAddress(Name, Args))
+            return std::function<Signature_t>(
+                llvm::jitTargetAddressToPointer<Signature_t *>(*A));
+        else
+            return A.takeError();
+    }
+
+    size_t size() const { return Cache.size(); }
+
+    size_t getNumHits() const { return Cache.getNumHits(); }
+    size_t getNumMisses() const { return Cache.getNumMisses(); }
+
+    /// See CompiledFunctionCache::takeEvictionError
+    llvm::Error takeEvictionError() { return Cache.takeEvictionError(); }
+
+private:
+    JitEngine &JIT;
+    llvm::orc::JITDylib &Tenant;
+
+    /// By function name and bound values
+    CompiledFunctionCache Cache;
+
+    llvm::Expected<llvm::JITTargetAddress>
+    specialize(llvm::StringRef Name, llvm::ArrayRef<BoundArgument> Args,
+               llvm::orc::VModuleKey K);
+};
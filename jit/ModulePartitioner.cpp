@@ -0,0 +1,279 @@
+#include "ModulePartitioner.h"
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+
+#include <algorithm>
+#include <map>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+namespace
+{
+
+/// Groups of the definitions of a module, with the number of instructions
+/// in each
+class Clusters
+{
+
+public:
+    explicit Clusters(Module &M)
+    {
+        for (GlobalValue &GV : M.global_values())
+        {
+            if (GV.isDeclaration())
+                continue;
+
+            size_t Size = 1;
+            if (auto *F = dyn_cast<Function>(&GV))
+                Size = std::max<size_t>(F->getInstructionCount(), 1);
+
+            Index[&GV] = Parent.size();
+            Parent.push_back(Parent.size());
+            Sizes.push_back(Size);
+            TotalSize += Size;
+        }
+    }
+
+    /// Cluster of a definition, or -1 for declarations
+    int find(const GlobalValue *GV)
+    {
+        auto I = Index.find(GV);
+        return I == Index.end() ? -1 : find(I->second);
+    }
+
+    int find(int C)
+    {
+        while (Parent[C] != C)
+            C = Parent[C] = Parent[Parent[C]];
+        return C;
+    }
+
+    void join(const GlobalValue *A, const GlobalValue *B)
+    {
+        join(find(A), find(B));
+    }
+
+    void join(int A, int B)
+    {
+        if (A < 0 || B < 0)
+            return;
+
+        A = find(A);
+        B = find(B);
+
+        if (A == B)
+            return;
+
+        // The earliest definition leads, which keeps the result stable.
+        if (A > B)
+            std::swap(A, B);
+
+        Parent[B] = A;
+        Sizes[A] += Sizes[B];
+    }
+
+    /// Instructions in the cluster of C
+    size_t size(int C) { return Sizes[find(C)]; }
+
+    std::vector<int> getClusters()
+    {
+        std::vector<int> Roots;
+        for (int C = 0; C < int(Parent.size()); C++)
+            if (find(C) == C)
+                Roots.push_back(C);
+        return Roots;
+    }
+
+    size_t getTotalSize() const { return TotalSize; }
+
+private:
+    DenseMap<const GlobalValue *, int> Index;
+    std::vector<int> Parent;
+    std::vector<size_t> Sizes;
+    size_t TotalSize = 0;
+};
+
+} // end anonymous namespace
+
+/// Call F for every global value that uses V, looking through constants.
+template <typename Callback>
+static void forEachGlobalUser(Value *V, SmallPtrSetImpl<Value *> &Visited, Callback F)
+{
+    for (User *U : V->users())
+    {
+        if (!Visited.insert(U).second)
+            continue;
+
+        if (auto *I = dyn_cast<Instruction>(U))
+            F(I->getFunction());
+        else if (auto *GV = dyn_cast<GlobalValue>(U))
+            F(GV);
+        else if (isa<Constant>(U))
+            forEachGlobalUser(U, Visited, F);
+    }
+}
+
+/// Join whatever cannot be split: module-private symbols with their users,
+/// comdats, and aliases and ifuncs with what they point to.
+static void joinInseparable(Module &M, Clusters &C)
+{
+    std::map<const Comdat *, const GlobalValue *> ComdatLeaders;
+
+    for (GlobalValue &GV : M.global_values())
+    {
+        if (GV.isDeclaration())
+            continue;
+
+        if (GV.hasLocalLinkage())
+        {
+            SmallPtrSet<Value *, 16> Visited;
+            forEachGlobalUser(&GV, Visited, [&](const GlobalValue *User) {
+                C.join(&GV, User);
+            });
+        }
+
+        if (const Comdat *CD = GV.getComdat())
+        {
+            auto L = ComdatLeaders.emplace(CD, &GV);
+            C.join(L.first->second, &GV);
+        }
+
+        if (auto *GIS = dyn_cast<GlobalIndirectSymbol>(&GV))
+            if (const GlobalObject *Base = GIS->getBaseObject())
+                C.join(&GV, Base);
+    }
+}
+
+/// Join callers with their callees, most frequent calls first, as long as
+/// clusters stay within Limit instructions.
+static void joinCalls(Module &M, Clusters &C, size_t Limit)
+{
+    std::map<std::pair<const Function *, const Function *>, size_t> Calls;
+
+    for (Function &Caller : M)
+        for (BasicBlock &BB : Caller)
+            for (Instruction &I : BB)
+                if (auto *Call = dyn_cast<CallBase>(&I))
+                {
+                    const Function *Callee = Call->getCalledFunction();
+                    if (Callee && Callee != &Caller && !Callee->isDeclaration())
+                        Calls[std::make_pair(&Caller, Callee)]++;
+                }
+
+    struct Edge
+    {
+        const Function *Caller;
+        const Function *Callee;
+        size_t Count;
+    };
+
+    std::vector<Edge> Edges;
+    for (const auto &Call : Calls)
+        Edges.push_back(Edge{Call.first.first, Call.first.second, Call.second});
+
+    // Small callees first among equally frequent calls, as they are the
+    // likeliest to be inlined.
+    std::stable_sort(Edges.begin(), Edges.end(), [&](const Edge &A, const Edge &B) {
+        if (A.Count != B.Count)
+            return A.Count > B.Count;
+        return A.Callee->getInstructionCount() < B.Callee->getInstructionCount();
+    });
+
+    for (const Edge &E : Edges)
+    {
+        int A = C.find(E.Caller), B = C.find(E.Callee);
+
+        if (A != B && C.size(A) + C.size(B) <= Limit)
+            C.join(A, B);
+    }
+}
+
+Expected<std::vector<ThreadSafeModule>>
+partitionModule(Module &M, unsigned NumPartitions)
+{
+    NumPartitions = std::max(NumPartitions, 1u);
+
+    // Partitions are cloned in M's context. They are moved to contexts of
+    // their own through bitcode, which is also much smaller to hold while
+    // the rest are cloned.
+    std::unique_ptr<Module> Source = CloneModule(M);
+
+    // Partitions refer to each other's symbols by name.
+    for (GlobalValue &GV : Source->global_values())
+        if (!GV.hasName() && !GV.isDeclaration())
+            GV.setName("__partition.anon");
+
+    Clusters C(*Source);
+    joinInseparable(*Source, C);
+
+    size_t Limit = (C.getTotalSize() + NumPartitions - 1) / NumPartitions;
+    joinCalls(*Source, C, Limit);
+
+    // Largest clusters first, each to the partition with the fewest
+    // instructions so far
+    std::vector<int> Roots = C.getClusters();
+    std::stable_sort(Roots.begin(), Roots.end(),
+                     [&](int A, int B) { return C.size(A) > C.size(B); });
+
+    std::vector<size_t> Load(NumPartitions, 0);
+    std::map<int, unsigned> PartitionOf;
+
+    for (int Root : Roots)
+    {
+        unsigned P = std::min_element(Load.begin(), Load.end()) - Load.begin();
+        PartitionOf[Root] = P;
+        Load[P] += C.size(Root);
+    }
+
+    std::vector<SmallVector<char, 0>> Bitcode;
+
+    for (unsigned P = 0; P < NumPartitions; P++)
+    {
+        bool Defines = false;
+
+        ValueToValueMapTy VMap;
+        auto Part = CloneModule(*Source, VMap, [&](const GlobalValue *GV) {
+            int Cluster = C.find(GV);
+            bool Here = Cluster >= 0 && PartitionOf[Cluster] == P;
+            Defines |= Here;
+            return Here;
+        });
+
+        if (!Defines)
+            continue;
+
+        Bitcode.emplace_back();
+        raw_svector_ostream os(Bitcode.back());
+        WriteBitcodeToFile(*Part, os);
+    }
+
+    std::vector<ThreadSafeModule> Partitions;
+
+    for (const SmallVector<char, 0> &Buffer : Bitcode)
+    {
+        auto Ctx = std::make_unique<LLVMContext>();
+
+        MemoryBufferRef Ref(StringRef(Buffer.data(), Buffer.size()),
+                            M.getModuleIdentifier());
+
+        auto Part = parseBitcodeFile(Ref, *Ctx);
+        if (!Part)
+            return Part.takeError();
+
+        Partitions.emplace_back(std::move(*Part), std::move(Ctx));
+    }
+
+    return std::move(Partitions);
+}
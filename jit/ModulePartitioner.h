@@ -0,0 +1,27 @@
+#pragma once
+
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Error.h>
+
+#include <vector>
+
+/// Split a module into up to NumPartitions modules that can be compiled
+/// independently, for parallel code generation.
+///
+/// Partitions follow the call graph: functions and variables that share
+/// module-private symbols, comdats or aliases are kept together, then
+/// callers are grouped with their callees, most frequent calls first, as
+/// long as a group stays within an even share of the module's
+/// instructions. The groups are spread over the partitions by size.
+///
+/// Every partition declares what it uses from the others, so once they are
+/// all added to the same dylib they link back into one symbol namespace.
+/// Calls between partitions are no longer inlined.
+///
+/// Each partition gets a context of its own, so that partitions do not
+/// serialize on a shared context lock while they compile. Partitions that
+/// would define nothing are dropped. M is left untouched; its context must
+/// be locked by the caller.
+llvm::Expected<std::vector<llvm::orc::ThreadSafeModule>>
+partitionModule(llvm::Module &M, unsigned NumPartitions);
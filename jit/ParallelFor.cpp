@@ -0,0 +1,401 @@
+#include "ParallelFor.h"
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <string>
+
+using namespace llvm;
+
+static const char *const ParallelForFn = "jit_parallel_for";
+
+/// The pool and queue of the current thread, for threads inside a pool
+static thread_local const ParallelForPool *CurrentPool = nullptr;
+static thread_local unsigned CurrentQueue = 0;
+
+ParallelForPool::ParallelForPool(unsigned NumThreads)
+{
+    for (unsigned i = 0; i <= NumThreads; i++)
+        Queues.push_back(std::make_unique<WorkQueue>());
+
+    for (unsigned i = 0; i < NumThreads; i++)
+        Workers.emplace_back([this, i]() { work(i); });
+}
+
+ParallelForPool::~ParallelForPool()
+{
+    {
+        std::lock_guard<std::mutex> Lock(SleepMutex);
+        Stopping = true;
+    }
+
+    Wake.notify_all();
+
+    for (std::thread &Worker : Workers)
+        Worker.join();
+}
+
+ParallelForPool &ParallelForPool::getDefault()
+{
+    static ParallelForPool Pool(
+        std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return Pool;
+}
+
+unsigned ParallelForPool::getQueueIndex() const
+{
+    return CurrentPool == this ? CurrentQueue : Queues.size() - 1;
+}
+
+void ParallelForPool::push(unsigned Index, Range R)
+{
+    {
+        std::lock_guard<std::mutex> Lock(Queues[Index]->Mutex);
+        Queues[Index]->Ranges.push_back(R);
+    }
+
+    NumQueued.fetch_add(1);
+
+    // Taking the lock orders the push with a worker about to sleep, which
+    // checks NumQueued under it.
+    {
+        std::lock_guard<std::mutex> Lock(SleepMutex);
+    }
+
+    Wake.notify_one();
+}
+
+bool ParallelForPool::pop(unsigned Index, Range &R)
+{
+    WorkQueue &Q = *Queues[Index];
+    std::lock_guard<std::mutex> Lock(Q.Mutex);
+
+    if (Q.Ranges.empty())
+        return false;
+
+    R = Q.Ranges.back();
+    Q.Ranges.pop_back();
+    return true;
+}
+
+bool ParallelForPool::steal(unsigned Index, Range &R)
+{
+    for (size_t i = 1; i < Queues.size(); i++)
+    {
+        WorkQueue &Q = *Queues[(Index + i) % Queues.size()];
+        std::lock_guard<std::mutex> Lock(Q.Mutex);
+
+        if (Q.Ranges.empty())
+            continue;
+
+        R = Q.Ranges.front();
+        Q.Ranges.pop_front();
+        return true;
+    }
+
+    return false;
+}
+
+bool ParallelForPool::runOne(unsigned Index)
+{
+    Range R;
+
+    if (!pop(Index, R) && !steal(Index, R))
+        return false;
+
+    NumQueued.fetch_sub(1);
+    execute(Index, R);
+    return true;
+}
+
+void ParallelForPool::execute(unsigned Index, Range R)
+{
+    Loop &L = *R.L;
+
+    while (R.End - R.Begin > L.Grain)
+    {
+        uint64_t Mid = R.Begin + (R.End - R.Begin) / 2;
+        push(Index, Range{&L, Mid, R.End});
+        R.End = Mid;
+    }
+
+    L.Body(L.Ctx, R.Begin, R.End);
+
+    // Last use of L, which may be gone once the count reaches zero
+    L.Remaining.fetch_sub(R.End - R.Begin, std::memory_order_release);
+}
+
+void ParallelForPool::work(unsigned Index)
+{
+    CurrentPool = this;
+    CurrentQueue = Index;
+
+    while (true)
+    {
+        if (runOne(Index))
+            continue;
+
+        std::unique_lock<std::mutex> Lock(SleepMutex);
+        Wake.wait(Lock, [this]() { return Stopping || NumQueued.load() > 0; });
+
+        if (Stopping && NumQueued.load() == 0)
+            return;
+    }
+}
+
+void ParallelForPool::run(uint64_t Begin, uint64_t End, uint64_t Grain,
+                          ParallelForBody Body, void *Ctx)
+{
+    if (End <= Begin)
+        return;
+
+    Grain = std::max<uint64_t>(Grain, 1);
+
+    if (End - Begin <= Grain || Workers.empty())
+    {
+        Body(Ctx, Begin, End);
+        return;
+    }
+
+    Loop L;
+    L.Body = Body;
+    L.Ctx = Ctx;
+    L.Grain = Grain;
+    L.Remaining.store(End - Begin);
+
+    unsigned Index = getQueueIndex();
+
+    execute(Index, Range{&L, Begin, End});
+
+    // Help with whatever is queued, this loop or any other, until the last
+    // chunk of this one is done.
+    while (L.Remaining.load(std::memory_order_acquire) != 0)
+        if (!runOne(Index))
+            std::this_thread::yield();
+}
+
+void jit_parallel_for(uint64_t Begin, uint64_t End, uint64_t Grain,
+                      ParallelForBody Body, void *Ctx)
+{
+    ParallelForPool::getDefault().run(Begin, End, Grain, Body, Ctx);
+}
+
+Error defineParallelFor(JitEngine &JIT)
+{
+    return JIT.defineAbsolute(
+        ParallelForFn,
+        JITEvaluatedSymbol(pointerToJITTargetAddress(&jit_parallel_for),
+                           JITSymbolFlags::Exported | JITSymbolFlags::Callable));
+}
+
+/// Outline a loop over a range into `void Name(i8* ctx, i64 begin, i64 end)`
+/// and call jit_parallel_for on it at B. With an Identity, the loop carries
+/// an accumulator, and the closure ends with the result, which chunks are
+/// merged into. Returns the outlined function and the closure.
+static Expected<std::pair<Function *, Value *>>
+outlineLoop(IRBuilder<> &B, StringRef Name, Value *Begin, Value *End,
+            Value *Grain, ArrayRef<Value *> Captures, Value *Identity,
+            const ReduceBodyFn &Body, const CombineFn &Combine)
+{
+    BasicBlock *caller = B.GetInsertBlock();
+    Function *callerFn = caller->getParent();
+    Module &M = *callerFn->getParent();
+    LLVMContext &ctx = M.getContext();
+
+    Type *i64 = Type::getInt64Ty(ctx);
+
+    for (Value *V : {Begin, End, Grain})
+        if (V->getType() != i64)
+            return createStringError(inconvertibleErrorCode(),
+                                     "Bounds and grain of '%s' must be i64",
+                                     Name.str().c_str());
+
+    std::vector<Type *> fields;
+    for (Value *V : Captures)
+        fields.push_back(V->getType());
+
+    if (Identity)
+        fields.push_back(Identity->getType());
+
+    StructType *closureTy = StructType::get(ctx, fields);
+
+    auto bodyTy = FunctionType::get(Type::getVoidTy(ctx),
+                                    {Type::getInt8PtrTy(ctx), i64, i64}, false);
+    auto fn = Function::Create(bodyTy, Function::InternalLinkage, Name, M);
+
+    Function::arg_iterator args = fn->arg_begin();
+    Value *ctxArg = args++;
+    ctxArg->setName("ctx");
+    Value *begin = args++;
+    begin->setName("begin");
+    Value *end = args++;
+    end->setName("end");
+
+    BasicBlock *entry = BasicBlock::Create(ctx, "entry", fn);
+    BasicBlock *loop = BasicBlock::Create(ctx, "loop", fn);
+    BasicBlock *exit = BasicBlock::Create(ctx, "exit", fn);
+
+    IRBuilder<> O(entry);
+
+    Value *env = O.CreateBitCast(ctxArg, closureTy->getPointerTo(), "closure");
+
+    std::vector<Value *> captured;
+    for (unsigned i = 0; i < Captures.size(); i++)
+        captured.push_back(O.CreateLoad(closureTy->getElementType(i),
+                                        O.CreateStructGEP(closureTy, env, i)));
+
+    // The runtime never calls the body with an empty range.
+    O.CreateBr(loop);
+
+    O.SetInsertPoint(loop);
+    PHINode *i = O.CreatePHI(i64, 2, "i");
+    i->addIncoming(begin, entry);
+
+    PHINode *acc = nullptr;
+    if (Identity)
+    {
+        acc = O.CreatePHI(Identity->getType(), 2, "acc");
+        acc->addIncoming(Identity, entry);
+    }
+
+    Value *next = Body(O, i, acc, captured);
+
+    Value *inc = O.CreateAdd(i, O.getInt64(1), "i.next");
+
+    // Body may have added blocks, so the loop is closed from where it ended.
+    BasicBlock *latch = O.GetInsertBlock();
+    i->addIncoming(inc, latch);
+
+    if (acc)
+        acc->addIncoming(next, latch);
+
+    O.CreateCondBr(O.CreateICmpULT(inc, end), loop, exit);
+
+    O.SetInsertPoint(exit);
+
+    if (Identity)
+    {
+        // Merge the partial result of the chunk, which the latch leaves in
+        // next. The first attempt assumes the result still holds Identity;
+        // a failed one returns the value to retry with.
+        Type *accTy = Identity->getType();
+        Type *bitsTy = IntegerType::get(ctx, accTy->getPrimitiveSizeInBits());
+
+        BasicBlock *merge = BasicBlock::Create(ctx, "merge", fn);
+        BasicBlock *done = BasicBlock::Create(ctx, "done", fn);
+
+        Value *slot = O.CreateBitCast(
+            O.CreateStructGEP(closureTy, env, Captures.size()),
+            bitsTy->getPointerTo(), "result");
+        O.CreateBr(merge);
+
+        O.SetInsertPoint(merge);
+        PHINode *expected = O.CreatePHI(bitsTy, 2, "expected");
+        expected->addIncoming(O.CreateBitCast(Identity, bitsTy), exit);
+
+        Value *merged = Combine(O, O.CreateBitCast(expected, accTy), next);
+
+        Value *pair = O.CreateAtomicCmpXchg(
+            slot, expected, O.CreateBitCast(merged, bitsTy),
+            AtomicOrdering::AcquireRelease, AtomicOrdering::Monotonic);
+
+        expected->addIncoming(O.CreateExtractValue(pair, 0), O.GetInsertBlock());
+        O.CreateCondBr(O.CreateExtractValue(pair, 1), done, merge);
+
+        O.SetInsertPoint(done);
+    }
+
+    O.CreateRetVoid();
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    // Checked before anything is added to the caller, so that a failure
+    // leaves it as it was.
+    if (verifyFunction(*fn, &es))
+    {
+        fn->eraseFromParent();
+        return createStringError(inconvertibleErrorCode(),
+                                 "Function verification failed: %s",
+                                 es.str().c_str());
+    }
+
+    // The closure lives in the caller's frame, allocated in its entry block
+    // so that a loop around the parallel loop does not grow the stack.
+    IRBuilder<> Alloca(&callerFn->getEntryBlock(),
+                       callerFn->getEntryBlock().begin());
+    Value *closure = Alloca.CreateAlloca(closureTy, nullptr, Name + ".closure");
+
+    for (unsigned i = 0; i < fields.size(); i++)
+        B.CreateStore(i < Captures.size() ? Captures[i] : Identity,
+                      B.CreateStructGEP(closureTy, closure, i));
+
+    // call void @jit_parallel_for(i64 %begin, i64 %end, i64 %grain,
+    //                             void (i8*, i64, i64)* @body, i8* %closure)
+    FunctionCallee parallelFor = M.getOrInsertFunction(
+        ParallelForFn,
+        FunctionType::get(Type::getVoidTy(ctx),
+                          {i64, i64, i64, bodyTy->getPointerTo(),
+                           Type::getInt8PtrTy(ctx)},
+                          false));
+
+    B.CreateCall(parallelFor,
+                 {Begin, End, Grain, fn,
+                  B.CreateBitCast(closure, Type::getInt8PtrTy(ctx))});
+
+    return std::make_pair(fn, closure);
+}
+
+Expected<Function *> emitParallelFor(IRBuilder<> &B, StringRef Name,
+                                     Value *Begin, Value *End, Value *Grain,
+                                     ArrayRef<Value *> Captures,
+                                     ParallelBodyFn Body)
+{
+    auto Iteration = [&](IRBuilder<> &B, Value *I, Value *,
+                         ArrayRef<Value *> Captured) -> Value * {
+        Body(B, I, Captured);
+        return nullptr;
+    };
+
+    auto Outlined = outlineLoop(B, Name, Begin, End, Grain, Captures, nullptr,
+                                Iteration, nullptr);
+    if (!Outlined)
+        return Outlined.takeError();
+
+    return Outlined->first;
+}
+
+Expected<Value *> emitParallelReduce(IRBuilder<> &B, StringRef Name,
+                                     Value *Begin, Value *End, Value *Grain,
+                                     ArrayRef<Value *> Captures, Value *Identity,
+                                     ReduceBodyFn Body, CombineFn Combine)
+{
+    Type *accTy = Identity->getType();
+    unsigned bits = accTy->getPrimitiveSizeInBits();
+
+    bool supported = accTy->isFloatTy() || accTy->isDoubleTy() ||
+                     (accTy->isIntegerTy() && bits >= 8 && bits <= 64 &&
+                      isPowerOf2_32(bits));
+
+    if (!supported)
+        return createStringError(inconvertibleErrorCode(),
+                                 "Cannot reduce '%s' atomically",
+                                 Name.str().c_str());
+
+    auto Outlined = outlineLoop(B, Name, Begin, End, Grain, Captures, Identity,
+                                Body, Combine);
+    if (!Outlined)
+        return Outlined.takeError();
+
+    StructType *closureTy = cast<StructType>(
+        cast<PointerType>(Outlined->second->getType())->getElementType());
+
+    return B.CreateLoad(accTy,
+                        B.CreateStructGEP(closureTy, Outlined->second,
+                                          Captures.size()),
+                        Name + ".result");
+}
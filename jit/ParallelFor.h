@@ -0,0 +1,155 @@
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Error.h>
+
+#include "JitEngine.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Parallel loops for JIT code
+///
+/// JIT code runs a loop in parallel by calling
+///
+///     void jit_parallel_for(uint64_t begin, uint64_t end, uint64_t grain,
+///                           void (*body)(void *ctx, uint64_t begin, uint64_t end),
+///                           void *ctx)
+///
+/// which returns once body has run over every iteration in [begin, end),
+/// in chunks of at most grain iterations. The loop body is outlined into
+/// body and whatever it uses from the caller is passed through ctx; see
+/// emitParallelFor and emitParallelReduce, which generate both sides.
+
+/// Outlined loop body, running the iterations in [Begin, End)
+using ParallelForBody = void (*)(void *Ctx, uint64_t Begin, uint64_t End);
+
+extern "C" void jit_parallel_for(uint64_t Begin, uint64_t End, uint64_t Grain,
+                                 ParallelForBody Body, void *Ctx);
+
+/// Work-stealing pool behind jit_parallel_for
+///
+/// Every worker has a deque of iteration ranges. A worker takes the range
+/// it pushed last, splits it in halves down to the grain, pushing the upper
+/// halves back, and runs what is left. Idle workers steal from the other
+/// end of another worker's deque, where the largest ranges are. The thread
+/// that starts a loop works on it too until it is complete, so loops may
+/// be nested. The deques are guarded by a mutex each, which is only
+/// contended when stealing.
+class ParallelForPool
+{
+
+public:
+    /// NumThreads workers besides the threads that start loops
+    explicit ParallelForPool(unsigned NumThreads);
+    ~ParallelForPool();
+
+    ParallelForPool(const ParallelForPool &) = delete;
+    ParallelForPool &operator=(const ParallelForPool &) = delete;
+
+    void run(uint64_t Begin, uint64_t End, uint64_t Grain, ParallelForBody Body,
+             void *Ctx);
+
+    unsigned getNumThreads() const { return Workers.size(); }
+
+    /// The pool of jit_parallel_for, with a worker per hardware thread
+    /// besides the caller. Created on first use.
+    static ParallelForPool &getDefault();
+
+private:
+    struct Loop
+    {
+        ParallelForBody Body;
+        void *Ctx;
+        uint64_t Grain;
+
+        /// Iterations not run yet
+        std::atomic<uint64_t> Remaining;
+    };
+
+    struct Range
+    {
+        Loop *L;
+        uint64_t Begin;
+        uint64_t End;
+    };
+
+    struct WorkQueue
+    {
+        std::mutex Mutex;
+        std::deque<Range> Ranges;
+    };
+
+    /// One per worker, and a last one shared by the threads outside the pool
+    std::vector<std::unique_ptr<WorkQueue>> Queues;
+    std::vector<std::thread> Workers;
+
+    std::atomic<size_t> NumQueued{0};
+
+    std::mutex SleepMutex;
+    std::condition_variable Wake;
+    bool Stopping = false;
+
+    unsigned getQueueIndex() const;
+
+    void push(unsigned Index, Range R);
+    bool pop(unsigned Index, Range &R);
+    bool steal(unsigned Index, Range &R);
+
+    /// Run one queued range, if there is any.
+    bool runOne(unsigned Index);
+    void execute(unsigned Index, Range R);
+
+    void work(unsigned Index);
+};
+
+/// Make jit_parallel_for visible to every tenant of JIT.
+llvm::Error defineParallelFor(JitEngine &JIT);
+
+/// Emits one iteration of a parallel loop at B. I is the i64 index, and
+/// Captured are the values captured from the enclosing function, as seen
+/// from the outlined body. The body may create blocks; it must leave B at
+/// the end of an unterminated block.
+using ParallelBodyFn = std::function<void(llvm::IRBuilder<> &B, llvm::Value *I,
+                                          llvm::ArrayRef<llvm::Value *> Captured)>;
+
+/// Emit at B a parallel loop over the i64 range [Begin, End). Body is
+/// outlined into the internal function Name, and Captures, which must be
+/// first-class values of the function at B, are passed to it in a closure
+/// on the caller's stack. Returns the outlined body.
+llvm::Expected<llvm::Function *>
+emitParallelFor(llvm::IRBuilder<> &B, llvm::StringRef Name, llvm::Value *Begin,
+                llvm::Value *End, llvm::Value *Grain,
+                llvm::ArrayRef<llvm::Value *> Captures, ParallelBodyFn Body);
+
+/// Emits one iteration of a parallel reduction and returns the new value
+/// of the accumulator Acc.
+using ReduceBodyFn = std::function<llvm::Value *(
+    llvm::IRBuilder<> &B, llvm::Value *I, llvm::Value *Acc,
+    llvm::ArrayRef<llvm::Value *> Captured)>;
+
+/// Combines two partial results; it must be associative and commutative,
+/// with Identity as its neutral element.
+using CombineFn =
+    std::function<llvm::Value *(llvm::IRBuilder<> &B, llvm::Value *L, llvm::Value *R)>;
+
+/// Emit at B a parallel reduction over [Begin, End) and return its result.
+/// Every chunk is reduced on its own, starting from Identity, and merged
+/// into the result with a compare-and-swap loop, so the type of Identity
+/// must be an integer of 8 to 64 bits, float or double.
+llvm::Expected<llvm::Value *>
+emitParallelReduce(llvm::IRBuilder<> &B, llvm::StringRef Name, llvm::Value *Begin,
+                   llvm::Value *End, llvm::Value *Grain,
+                   llvm::ArrayRef<llvm::Value *> Captures, llvm::Value *Identity,
+                   ReduceBodyFn Body, CombineFn Combine);
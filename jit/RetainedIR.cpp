@@ -0,0 +1,118 @@
+#include "RetainedIR.h"
+
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+Expected<std::unique_ptr<Module>> loadRetainedIR(JitEngine &JIT, JITDylib &Tenant,
+                                                 StringRef Name, LLVMContext &Ctx)
+{
+    std::shared_ptr<const MemoryBuffer> IR = JIT.getRetainedIR(Tenant, Name);
+
+    if (!IR)
+        return createStringError(inconvertibleErrorCode(),
+                                 "No IR retained for '%s'",
+                                 Name.str().c_str());
+
+    auto M = parseBitcodeFile(IR->getMemBufferRef(), Ctx);
+    if (!M)
+        return M.takeError();
+
+    Function *F = (*M)->getFunction(Name);
+
+    if (!F || F->isDeclaration())
+        return createStringError(inconvertibleErrorCode(),
+                                 "'%s' is not defined in its retained IR",
+                                 Name.str().c_str());
+
+    if (usesPrivateState(*F))
+        return createStringError(inconvertibleErrorCode(),
+                                 "'%s' uses module-private state",
+                                 Name.str().c_str());
+
+    return std::move(*M);
+}
+
+static bool usesPrivateState(const Value *V, SmallPtrSetImpl<const Value *> &Visited)
+{
+    if (!Visited.insert(V).second)
+        return false;
+
+    if (auto *GV = dyn_cast<GlobalVariable>(V))
+        return GV->hasLocalLinkage() && !GV->isConstant();
+
+    if (auto *F = dyn_cast<Function>(V))
+    {
+        if (F->isDeclaration())
+            return false;
+
+        for (const Instruction &I : instructions(F))
+            for (const Value *Op : I.operands())
+                if ((!isa<Function>(Op) || cast<Function>(Op)->hasLocalLinkage()) &&
+                    usesPrivateState(Op, Visited))
+                    return true;
+
+        return false;
+    }
+
+    if (auto *C = dyn_cast<Constant>(V))
+        for (const Value *Op : C->operands())
+            if (usesPrivateState(Op, Visited))
+                return true;
+
+    return false;
+}
+
+bool usesPrivateState(const Function &F)
+{
+    SmallPtrSet<const Value *, 32> Visited;
+    return usesPrivateState(&F, Visited);
+}
+
+Error keepOnlyForInlining(Module &M, const Function &New)
+{
+    for (Function &G : M)
+    {
+        if (&G == &New || G.isDeclaration() || G.hasLocalLinkage())
+            continue;
+
+        if (usesPrivateState(G))
+            G.deleteBody();
+        else
+            G.setLinkage(GlobalValue::AvailableExternallyLinkage);
+
+        G.setComdat(nullptr);
+    }
+
+    for (GlobalVariable &GV : M.globals())
+    {
+        if (GV.isDeclaration() || GV.hasLocalLinkage())
+            continue;
+
+        GV.setLinkage(GlobalValue::AvailableExternallyLinkage);
+        GV.setComdat(nullptr);
+    }
+
+    while (!M.alias_empty())
+    {
+        GlobalAlias &GA = *M.alias_begin();
+        GA.replaceAllUsesWith(GA.getAliasee());
+        GA.eraseFromParent();
+    }
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyModule(M, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Module verification failed: %s",
+                                 es.str().c_str());
+
+    return Error::success();
+}
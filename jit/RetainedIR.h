@@ -0,0 +1,35 @@
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Error.h>
+
+#include "JitEngine.h"
+
+#include <memory>
+
+/// Recompiling from retained IR
+///
+/// Helpers for building new functions out of the IR a module had when it
+/// was added (see JitEngine::setRetainIR), to be compiled in a module of
+/// their own next to the original, as JitSpecializer and batch wrappers do.
+
+/// Parse the retained IR of the module that defines Name in Tenant. Fails
+/// if no IR was retained for Name, or if Name uses module-private state.
+llvm::Expected<std::unique_ptr<llvm::Module>>
+loadRetainedIR(JitEngine &JIT, llvm::orc::JITDylib &Tenant,
+               llvm::StringRef Name, llvm::LLVMContext &Ctx);
+
+/// Whether F reads or writes mutable module-private globals, directly or
+/// through module-private functions. A copy of F outside its module would
+/// get a copy of those globals of its own.
+bool usesPrivateState(const llvm::Function &F);
+
+/// Keep the definitions of M other than New for inlining only: the code
+/// that runs for them outside New is the code already in the tenant.
+/// Functions that use module-private state lose their bodies. Fails if M
+/// does not verify afterwards.
+llvm::Error keepOnlyForInlining(llvm::Module &M, const llvm::Function &New);
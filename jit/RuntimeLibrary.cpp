@@ -0,0 +1,150 @@
+#include "RuntimeLibrary.h"
+
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/IPO/Internalize.h>
+
+using namespace llvm;
+
+static bool usesInternalState(const Value *V,
+                              SmallPtrSetImpl<const Value *> &Visited);
+
+/// Whether the body of F refers, possibly through internal functions, to a
+/// global with internal linkage that is not a function. Such state cannot
+/// be shared with the host once the code is copied into a JIT module.
+/// External callees do not count: if they are not linked, they are called
+/// in the host.
+static bool bodyUsesInternalState(const Function &F,
+                                  SmallPtrSetImpl<const Value *> &Visited)
+{
+    for (const Instruction &I : instructions(F))
+        for (const Value *Op : I.operands())
+            if (usesInternalState(Op, Visited))
+                return true;
+
+    return false;
+}
+
+static bool usesInternalState(const Value *V,
+                              SmallPtrSetImpl<const Value *> &Visited)
+{
+    if (!Visited.insert(V).second)
+        return false;
+
+    if (auto *F = dyn_cast<Function>(V))
+        return F->hasLocalLinkage() && bodyUsesInternalState(*F, Visited);
+
+    if (auto *GV = dyn_cast<GlobalValue>(V))
+        return GV->hasLocalLinkage();
+
+    if (auto *C = dyn_cast<Constant>(V))
+        for (const Value *Op : C->operands())
+            if (usesInternalState(Op, Visited))
+                return true;
+
+    return false;
+}
+
+Expected<std::unique_ptr<RuntimeLibrary>>
+RuntimeLibrary::Create(std::unique_ptr<MemoryBuffer> Buffer, const DataLayout &DL)
+{
+    LLVMContext Ctx;
+
+    auto M = parseBitcodeFile(Buffer->getMemBufferRef(), Ctx);
+    if (!M)
+        return M.takeError();
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyModule(**M, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Runtime library verification failed: %s",
+                                 es.str().c_str());
+
+    if (!(*M)->getDataLayout().isDefault() && (*M)->getDataLayout() != DL)
+        return createStringError(inconvertibleErrorCode(),
+                                 "Runtime library '%s' has an incompatible "
+                                 "data layout",
+                                 Buffer->getBufferIdentifier().str().c_str());
+
+    StringSet<> Inlinable;
+
+    for (const Function &F : **M)
+    {
+        if (F.isDeclaration() || F.hasLocalLinkage())
+            continue;
+
+        SmallPtrSet<const Value *, 32> Visited;
+        if (!bodyUsesInternalState(F, Visited))
+            Inlinable.insert(F.getName());
+    }
+
+    return std::make_unique<RuntimeLibrary>(std::move(Buffer),
+                                            std::move(Inlinable));
+}
+
+Error RuntimeLibrary::link(Module &module) const
+{
+    bool Needed = false;
+
+    for (const Function &F : module)
+        if (F.isDeclaration() && Inlinable.count(F.getName()))
+        {
+            Needed = true;
+            break;
+        }
+
+    if (!Needed)
+        return Error::success();
+
+    // Only the function bodies the linker pulls in are ever read.
+    auto Src = getLazyBitcodeModule(Buffer->getMemBufferRef(),
+                                    module.getContext());
+    if (!Src)
+        return Src.takeError();
+
+    (*Src)->setDataLayout(module.getDataLayout());
+    (*Src)->setTargetTriple(module.getTargetTriple());
+
+    // Whatever is not inlinable stays in the host: turn it into declarations
+    // before the linker sees it.
+    for (Function &F : **Src)
+        if (!F.isDeclaration() && !F.hasLocalLinkage() &&
+            !Inlinable.count(F.getName()))
+        {
+            F.deleteBody();
+            F.setComdat(nullptr);
+        }
+
+    for (GlobalVariable &GV : (*Src)->globals())
+        if (!GV.isDeclaration() && !GV.hasLocalLinkage())
+        {
+            GV.setInitializer(nullptr);
+            GV.setLinkage(GlobalValue::ExternalLinkage);
+            GV.setComdat(nullptr);
+        }
+
+    bool Failed = Linker::linkModules(
+        module, std::move(*Src), Linker::LinkOnlyNeeded,
+        [](Module &M, const StringSet<> &Linked) {
+            internalizeModule(M, [&Linked](const GlobalValue &GV) {
+                return !GV.hasName() || !Linked.count(GV.getName());
+            });
+        });
+
+    if (Failed)
+        return createStringError(inconvertibleErrorCode(),
+                                 "Failed to link the runtime library '%s' "
+                                 "into module '%s'",
+                                 Buffer->getBufferIdentifier().str().c_str(),
+                                 module.getName().str().c_str());
+
+    return Error::success();
+}
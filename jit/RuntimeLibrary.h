@@ -0,0 +1,47 @@
+#pragma once
+
+#include <llvm/ADT/StringSet.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <memory>
+
+/// Runtime Library
+///
+/// Bitcode of the host helpers that JIT code calls (e.g. built with
+/// clang -emit-llvm from the same sources as the host). Before a module is
+/// optimized, the definitions of the helpers it calls are linked into it as
+/// internal functions, so the optimizer can inline them into JIT loops.
+/// Calls that are not inlined still go to the private copy, not to the host.
+///
+/// Only functions that do not touch internal state of the library (static
+/// variables, directly or through static functions) are linked; the others
+/// stay external calls to the host. Global variables of the library are
+/// never copied: linked helpers refer to the host's variables by name.
+class RuntimeLibrary
+{
+
+public:
+    /// Parse and verify the library once. Its data layout, if it has one,
+    /// must be DL.
+    static llvm::Expected<std::unique_ptr<RuntimeLibrary>>
+    Create(std::unique_ptr<llvm::MemoryBuffer> Buffer, const llvm::DataLayout &DL);
+
+    /// Link the helpers module calls into it. The module's context must be
+    /// locked by the caller.
+    llvm::Error link(llvm::Module &module) const;
+
+    /// Whether Name is a helper that can be linked into JIT modules.
+    bool isInlinable(llvm::StringRef Name) const { return Inlinable.count(Name); }
+
+    RuntimeLibrary(std::unique_ptr<llvm::MemoryBuffer> Buffer,
+                   llvm::StringSet<> Inlinable)
+        : Buffer(std::move(Buffer)), Inlinable(std::move(Inlinable)) {}
+
+private:
+    std::unique_ptr<llvm::MemoryBuffer> Buffer;
+    llvm::StringSet<> Inlinable;
+
+};
@@ -0,0 +1,495 @@
+#include "SharedCode.h"
+
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/Memory.h>
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+namespace
+{
+
+enum RegionState : uint32_t
+{
+    Empty = 0,
+    Compiling,
+    Ready,
+    Failed
+};
+
+const uint64_t RegionMagic = 0x45444f4354494a53; // "SJITCODE"
+
+} // namespace
+
+/// First page of the memfd, mapped shared by every process. The fields
+/// after State are written by the exporter before it publishes the region
+/// and only read by the others after.
+struct SharedCodeRegion::Header
+{
+    uint64_t Magic;
+    std::atomic<uint32_t> State;
+    ModuleHash Hash;
+    uint64_t ObjectSize;
+    uint64_t CodeOffset;
+    uint64_t CodeSize;
+    uint64_t DataSize;
+};
+
+static size_t getPageSize() { return static_cast<size_t>(::sysconf(_SC_PAGESIZE)); }
+
+static Error makeSystemError(const char *What)
+{
+    int Errno = errno;
+    return createStringError(std::error_code(Errno, std::generic_category()),
+                             "%s: %s", What, std::strerror(Errno));
+}
+
+Expected<std::shared_ptr<SharedCodeRegion>> SharedCodeRegion::create(StringRef Name)
+{
+    int FD = ::memfd_create(Name.str().c_str(), MFD_ALLOW_SEALING);
+    if (FD < 0)
+        return makeSystemError("Cannot create the shared code region");
+
+    if (::ftruncate(FD, getPageSize()) != 0)
+    {
+        Error Err = makeSystemError("Cannot size the shared code region");
+        ::close(FD);
+        return std::move(Err);
+    }
+
+    return map(FD, true);
+}
+
+Expected<std::shared_ptr<SharedCodeRegion>> SharedCodeRegion::open(int FD)
+{
+    struct stat Stat;
+
+    if (::fstat(FD, &Stat) != 0 || Stat.st_size < (off_t)getPageSize())
+    {
+        ::close(FD);
+        return createStringError(inconvertibleErrorCode(),
+                                 "Descriptor %d is not a shared code region", FD);
+    }
+
+    return map(FD, false);
+}
+
+Expected<std::shared_ptr<SharedCodeRegion>> SharedCodeRegion::map(int FD,
+                                                                  bool Created)
+{
+    void *Page = ::mmap(nullptr, getPageSize(), PROT_READ | PROT_WRITE,
+                        MAP_SHARED, FD, 0);
+
+    if (Page == MAP_FAILED)
+    {
+        Error Err = makeSystemError("Cannot map the shared code region");
+        ::close(FD);
+        return std::move(Err);
+    }
+
+    Header *H = new (Page) Header;
+
+    if (Created)
+        H->Magic = RegionMagic;
+    else if (H->Magic != RegionMagic)
+    {
+        ::munmap(Page, getPageSize());
+        ::close(FD);
+        return createStringError(inconvertibleErrorCode(),
+                                 "Descriptor %d is not a shared code region", FD);
+    }
+
+    return std::shared_ptr<SharedCodeRegion>(new SharedCodeRegion(FD, H));
+}
+
+SharedCodeRegion::~SharedCodeRegion()
+{
+    ::munmap(H, getPageSize());
+    ::close(FD);
+}
+
+SharedCodeRegion::Role SharedCodeRegion::claim(const ModuleHash &Hash)
+{
+    uint32_t State = Empty;
+
+    if (H->State.compare_exchange_strong(State, Compiling))
+    {
+        H->Hash = Hash;
+        return Role::Export;
+    }
+
+    if (State == Ready && H->Hash == Hash)
+        return Role::Import;
+
+    return Role::Private;
+}
+
+bool SharedCodeRegion::isReady() const
+{
+    return H->State.load(std::memory_order_acquire) == Ready;
+}
+
+Error SharedCodeRegion::storeObject(MemoryBufferRef Obj)
+{
+    const size_t PageSize = getPageSize();
+    const uint64_t Size = Obj.getBufferSize();
+    const uint64_t CodeOffset = alignTo(PageSize + Size, PageSize);
+
+    if (::ftruncate(FD, CodeOffset) != 0)
+        return makeSystemError("Cannot store the shared object");
+
+    for (uint64_t Written = 0; Written < Size;)
+    {
+        ssize_t N = ::pwrite(FD, Obj.getBufferStart() + Written, Size - Written,
+                             PageSize + Written);
+
+        if (N < 0 && errno != EINTR)
+            return makeSystemError("Cannot store the shared object");
+
+        if (N > 0)
+            Written += N;
+    }
+
+    H->ObjectSize = Size;
+    H->CodeOffset = CodeOffset;
+    return Error::success();
+}
+
+Expected<std::unique_ptr<MemoryBuffer>> SharedCodeRegion::loadObject() const
+{
+    if (!isReady())
+        return createStringError(inconvertibleErrorCode(),
+                                 "The shared code region holds no module");
+
+    if (!isSealed())
+        return createStringError(inconvertibleErrorCode(),
+                                 "The shared code region is not sealed");
+
+    const uint64_t Size = H->ObjectSize;
+    auto Buffer = WritableMemoryBuffer::getNewUninitMemBuffer(Size, "<shared>");
+
+    for (uint64_t Read = 0; Read < Size;)
+    {
+        ssize_t N = ::pread(FD, Buffer->getBufferStart() + Read, Size - Read,
+                            getPageSize() + Read);
+
+        if (N == 0 || (N < 0 && errno != EINTR))
+            return makeSystemError("Cannot load the shared object");
+
+        if (N > 0)
+            Read += N;
+    }
+
+    return std::unique_ptr<MemoryBuffer>(std::move(Buffer));
+}
+
+Expected<uint64_t> SharedCodeRegion::reserveCode(uint64_t CodeSize)
+{
+    if (::ftruncate(FD, H->CodeOffset + CodeSize) != 0)
+        return makeSystemError("Cannot grow the shared code region");
+
+    return H->CodeOffset;
+}
+
+uint64_t SharedCodeRegion::getCodeOffset() const { return H->CodeOffset; }
+uint64_t SharedCodeRegion::getCodeSize() const { return H->CodeSize; }
+uint64_t SharedCodeRegion::getDataSize() const { return H->DataSize; }
+
+Error SharedCodeRegion::publish(uint64_t CodeSize, uint64_t DataSize)
+{
+    // Importers map the code pages; truncating the region under them would
+    // fault them. Sealed before Ready, so that importers can check for it.
+    if (::fcntl(FD, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0)
+        return makeSystemError("Cannot seal the shared code region");
+
+    H->CodeSize = CodeSize;
+    H->DataSize = DataSize;
+    H->State.store(Ready, std::memory_order_release);
+    return Error::success();
+}
+
+bool SharedCodeRegion::isSealed() const
+{
+    int Seals = ::fcntl(FD, F_GET_SEALS);
+    return Seals >= 0 && (Seals & F_SEAL_SHRINK);
+}
+
+void SharedCodeRegion::abandon()
+{
+    // A published region stays usable for the others.
+    uint32_t State = Compiling;
+    H->State.compare_exchange_strong(State, Failed, std::memory_order_release);
+}
+
+SharedCodeMemoryManager::~SharedCodeMemoryManager()
+{
+    if (Export && !Published)
+        Region->abandon();
+
+    unmap();
+}
+
+void SharedCodeMemoryManager::unmap()
+{
+    if (Scratch)
+        ::munmap(Scratch, CodeBytes);
+
+    if (Base)
+        ::munmap(Base, CodeBytes + DataBytes);
+
+    Scratch = nullptr;
+    Base = nullptr;
+}
+
+void SharedCodeMemoryManager::reserveAllocationSpace(
+    uintptr_t CodeSize, uint32_t CodeAlign, uintptr_t RODataSize,
+    uint32_t RODataAlign, uintptr_t RWDataSize, uint32_t RWDataAlign)
+{
+    const size_t PageSize = getPageSize();
+
+    // The linker rounds every section up to the alignment of its kind, so
+    // only the switch from read-only to writable data needs slack.
+    CodeBytes = alignTo(std::max<uintptr_t>(CodeSize, 1), PageSize);
+    DataBytes = alignTo(RODataSize + RWDataSize + RWDataAlign + 1, PageSize);
+
+    // An object that lays out differently here cannot use the shared
+    // pages: link it privately.
+    bool Shared = Export || (Region->isReady() &&
+                             CodeBytes == Region->getCodeSize() &&
+                             DataBytes == Region->getDataSize());
+
+    void *Range = ::mmap(nullptr, CodeBytes + DataBytes, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (Range == MAP_FAILED)
+    {
+        MapError = toString(makeSystemError("Cannot reserve the shared code"));
+        return;
+    }
+
+    Base = static_cast<uint8_t *>(Range);
+
+    void *Code;
+
+    if (Export)
+    {
+        auto Offset = Region->reserveCode(CodeBytes);
+
+        if (!Offset)
+        {
+            MapError = toString(Offset.takeError());
+            unmap();
+            return;
+        }
+
+        Code = ::mmap(Base, CodeBytes, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_FIXED, Region->getFD(), *Offset);
+    }
+    else if (Shared)
+    {
+        Code = ::mmap(Base, CodeBytes, PROT_READ | PROT_EXEC,
+                      MAP_SHARED | MAP_FIXED, Region->getFD(),
+                      Region->getCodeOffset());
+
+        void *Copy = ::mmap(nullptr, CodeBytes, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (Copy != MAP_FAILED)
+            Scratch = static_cast<uint8_t *>(Copy);
+    }
+    else
+    {
+        Code = ::mmap(Base, CodeBytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+
+        Region->NumPrivateFallbacks++;
+    }
+
+    void *Data = ::mmap(Base + CodeBytes, DataBytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+
+    if (Code == MAP_FAILED || Data == MAP_FAILED || (Shared && !Export && !Scratch))
+    {
+        MapError = toString(makeSystemError("Cannot map the shared code"));
+        unmap();
+    }
+}
+
+uint8_t *SharedCodeMemoryManager::allocateCodeSection(uintptr_t Size,
+                                                      unsigned Alignment,
+                                                      unsigned SectionID,
+                                                      StringRef SectionName)
+{
+    size_t Offset = alignTo(CodeUsed, std::max(Alignment, 1u));
+
+    if (!Base || Offset + Size > CodeBytes)
+        return nullptr;
+
+    CodeUsed = Offset + Size;
+
+    if (!Scratch)
+        return Base + Offset;
+
+    CodeSections.push_back(Offset);
+    return Scratch + Offset;
+}
+
+uint8_t *SharedCodeMemoryManager::allocateDataSection(uintptr_t Size,
+                                                      unsigned Alignment,
+                                                      unsigned SectionID,
+                                                      StringRef SectionName,
+                                                      bool IsReadOnly)
+{
+    size_t Offset = alignTo(DataUsed, std::max(Alignment, 1u));
+
+    if (!Base || Offset + Size > DataBytes)
+        return nullptr;
+
+    DataUsed = Offset + Size;
+    return Base + CodeBytes + Offset;
+}
+
+void SharedCodeMemoryManager::notifyObjectLoaded(RuntimeDyld &RTDyld,
+                                                 const object::ObjectFile &Obj)
+{
+    // Relocations are applied before finalization; have them computed for
+    // the shared pages while they are written to the scratch copy.
+    for (size_t Offset : CodeSections)
+        RTDyld.mapSectionAddress(Scratch + Offset,
+                                 pointerToJITTargetAddress(Base + Offset));
+}
+
+bool SharedCodeMemoryManager::finalizeMemory(std::string *ErrMsg)
+{
+    if (!Base)
+    {
+        if (ErrMsg)
+            *ErrMsg = MapError;
+        return true;
+    }
+
+    if (Scratch)
+    {
+        if (std::memcmp(Scratch, Base, CodeUsed) == 0)
+            Region->NumImports++;
+        else
+        {
+            // Replace the shared pages with a private copy, at the address
+            // the code was relocated for.
+            if (::mmap(Base, CodeBytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+            {
+                if (ErrMsg)
+                    *ErrMsg = toString(makeSystemError("Cannot map the private code"));
+                return true;
+            }
+
+            std::memcpy(Base, Scratch, CodeUsed);
+            Region->NumPrivateFallbacks++;
+        }
+
+        ::munmap(Scratch, CodeBytes);
+        Scratch = nullptr;
+    }
+
+    if (::mprotect(Base, CodeBytes, PROT_READ | PROT_EXEC) != 0)
+    {
+        if (ErrMsg)
+            *ErrMsg = toString(makeSystemError("Cannot protect the shared code"));
+        return true;
+    }
+
+    sys::Memory::InvalidateInstructionCache(Base, CodeUsed);
+
+    if (Export)
+    {
+        if (auto Err = Region->publish(CodeBytes, DataBytes))
+        {
+            if (ErrMsg)
+                *ErrMsg = toString(std::move(Err));
+            else
+                consumeError(std::move(Err));
+            return true;
+        }
+
+        Published = true;
+    }
+
+    return false;
+}
+
+/// The memory manager of the object being emitted on this thread. The
+/// base layer creates it while the object is emitted, with nothing in
+/// between.
+static thread_local std::unique_ptr<SharedCodeMemoryManager> PendingMemoryManager;
+
+void SharedObjectLayer::setRegion(VModuleKey K,
+                                  std::shared_ptr<SharedCodeRegion> Region,
+                                  bool Export)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Regions[K] = Target{std::move(Region), Export};
+}
+
+void SharedObjectLayer::forgetRegion(VModuleKey K)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    auto I = Regions.find(K);
+    if (I == Regions.end())
+        return;
+
+    if (I->second.Export)
+        I->second.Region->abandon();
+
+    Regions.erase(I);
+}
+
+void SharedObjectLayer::emit(MaterializationResponsibility R,
+                             std::unique_ptr<MemoryBuffer> O)
+{
+    Target T{nullptr, false};
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+
+        auto I = Regions.find(R.getVModuleKey());
+        if (I != Regions.end())
+        {
+            T = std::move(I->second);
+            Regions.erase(I);
+        }
+    }
+
+    if (T.Region && T.Export)
+        if (auto Err = T.Region->storeObject(O->getMemBufferRef()))
+        {
+            T.Region->abandon();
+            getExecutionSession().reportError(std::move(Err));
+            R.failMaterialization();
+            return;
+        }
+
+    if (T.Region)
+        PendingMemoryManager =
+            std::make_unique<SharedCodeMemoryManager>(std::move(T.Region), T.Export);
+
+    BaseLayer.emit(std::move(R), std::move(O));
+
+    // Not taken if the object could not be loaded
+    PendingMemoryManager.reset();
+}
+
+std::unique_ptr<SharedCodeMemoryManager> SharedObjectLayer::takeMemoryManager()
+{
+    return std::move(PendingMemoryManager);
+}
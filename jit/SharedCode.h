@@ -0,0 +1,237 @@
+#pragma once
+
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/ExecutionEngine/Orc/Layer.h>
+#include <llvm/ExecutionEngine/RTDyldMemoryManager.h>
+#include <llvm/ExecutionEngine/RuntimeDyld.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// Shared code region
+///
+/// A memfd that holds one module compiled once for all the processes of a
+/// host, so that they execute the same physical code pages. The first
+/// process to claim an empty region exports the module: it compiles it as
+/// position independent code, stores the object file in the region and
+/// links the code straight into it. The others import it: they link the
+/// stored object without compiling it, map the code pages read-only and
+/// only fill in a private copy of the data, the GOT included, with their
+/// own addresses.
+///
+/// The code reaches the data and every other symbol PC-relative or through
+/// the GOT, so it does not depend on where it is mapped as long as the data
+/// follows it at the same distance, which SharedCodeMemoryManager sees to.
+/// An importer still relocates the code into a scratch buffer and compares
+/// it with the shared pages, and keeps the scratch copy privately if they
+/// differ.
+///
+/// Regions are Linux memfds; their descriptor reaches the other processes
+/// by inheritance across fork, or over a Unix socket. The exporter seals
+/// their size when it publishes, and importers only link sealed regions,
+/// so that the pages they map cannot be truncated under them.
+class SharedCodeRegion
+{
+
+public:
+    /// Identifies a module and the target it is compiled for
+    using ModuleHash = std::array<uint8_t, 20>;
+
+    enum class Role
+    {
+        /// Compile the module and publish its code in the region
+        Export,
+
+        /// Link the code another process published in the region
+        Import,
+
+        /// The region is being exported or holds another module: compile
+        /// privately
+        Private
+    };
+
+    /// Create an empty region. Name only shows up in /proc.
+    static llvm::Expected<std::shared_ptr<SharedCodeRegion>>
+    create(llvm::StringRef Name);
+
+    /// Open the region of another process. Takes ownership of FD.
+    static llvm::Expected<std::shared_ptr<SharedCodeRegion>> open(int FD);
+
+    ~SharedCodeRegion();
+
+    SharedCodeRegion(const SharedCodeRegion &) = delete;
+    SharedCodeRegion &operator=(const SharedCodeRegion &) = delete;
+
+    int getFD() const { return FD; }
+
+    /// Decide what this process does with the module identified by Hash.
+    /// Only one process ever gets Export for a region, and Import is only
+    /// returned once that process has published the same module.
+    Role claim(const ModuleHash &Hash);
+
+    /// Whether a module has been published
+    bool isReady() const;
+
+    /// Copy of the object file published in the region
+    llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> loadObject() const;
+
+    /// Imports of this process that execute the shared pages
+    unsigned getNumImports() const { return NumImports.load(); }
+
+    /// Imports of this process whose code came out different from the
+    /// shared pages, and that run a private copy instead
+    unsigned getNumPrivateFallbacks() const { return NumPrivateFallbacks.load(); }
+
+private:
+    friend class SharedCodeMemoryManager;
+    friend class SharedObjectLayer;
+
+    struct Header;
+
+    SharedCodeRegion(int FD, Header *H) : FD(FD), H(H) {}
+
+    static llvm::Expected<std::shared_ptr<SharedCodeRegion>> map(int FD,
+                                                                 bool Created);
+
+    /// Store the object file, ahead of the code
+    llvm::Error storeObject(llvm::MemoryBufferRef Obj);
+
+    /// Make room for CodeSize bytes of code, and return their offset
+    llvm::Expected<uint64_t> reserveCode(uint64_t CodeSize);
+
+    /// Offset and size of the published code, and size of the data that
+    /// must follow it
+    uint64_t getCodeOffset() const;
+    uint64_t getCodeSize() const;
+    uint64_t getDataSize() const;
+
+    /// Seal the region's size and mark it ready
+    llvm::Error publish(uint64_t CodeSize, uint64_t DataSize);
+
+    /// Mark the region failed, unless it was published
+    void abandon();
+
+    /// Whether the region's size can no longer shrink
+    bool isSealed() const;
+
+    int FD;
+    Header *H;
+
+    std::atomic<unsigned> NumImports{0};
+    std::atomic<unsigned> NumPrivateFallbacks{0};
+};
+
+/// Memory manager of an object exported to or imported from a region
+///
+/// Lays the code sections out in one range and the data sections in a
+/// private range right after it, both bump allocated in the order the
+/// linker asks for them. That order and the sizes only depend on the object
+/// file, so every process gets the same layout. An exporter allocates the
+/// code in the region's pages; an importer maps those pages read-only and
+/// relocates its code into a scratch buffer as if it lived there.
+class SharedCodeMemoryManager : public llvm::RTDyldMemoryManager
+{
+
+public:
+    SharedCodeMemoryManager(std::shared_ptr<SharedCodeRegion> Region,
+                            bool Export)
+        : Region(std::move(Region)), Export(Export)
+    {
+    }
+
+    ~SharedCodeMemoryManager() override;
+
+    bool needsToReserveAllocationSpace() override { return true; }
+
+    void reserveAllocationSpace(uintptr_t CodeSize, uint32_t CodeAlign,
+                                uintptr_t RODataSize, uint32_t RODataAlign,
+                                uintptr_t RWDataSize,
+                                uint32_t RWDataAlign) override;
+
+    uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment,
+                                 unsigned SectionID,
+                                 llvm::StringRef SectionName) override;
+
+    uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment,
+                                 unsigned SectionID,
+                                 llvm::StringRef SectionName,
+                                 bool IsReadOnly) override;
+
+    using llvm::RTDyldMemoryManager::notifyObjectLoaded;
+
+    void notifyObjectLoaded(llvm::RuntimeDyld &RTDyld,
+                            const llvm::object::ObjectFile &Obj) override;
+
+    bool finalizeMemory(std::string *ErrMsg = nullptr) override;
+
+private:
+    std::shared_ptr<SharedCodeRegion> Region;
+    bool Export;
+    bool Published = false;
+
+    /// Code followed by data, mapped as one range of CodeBytes + DataBytes
+    uint8_t *Base = nullptr;
+    size_t CodeBytes = 0;
+    size_t DataBytes = 0;
+    size_t CodeUsed = 0;
+    size_t DataUsed = 0;
+
+    /// Where an importer links its code, and the offsets of the sections
+    uint8_t *Scratch = nullptr;
+    std::vector<size_t> CodeSections;
+
+    /// Why nothing could be mapped
+    std::string MapError;
+
+    void unmap();
+};
+
+/// Object layer in front of the engine's that links the objects of the
+/// modules registered with a region through a SharedCodeMemoryManager
+class SharedObjectLayer : public llvm::orc::ObjectLayer
+{
+
+public:
+    SharedObjectLayer(llvm::orc::ExecutionSession &ES,
+                      llvm::orc::ObjectLayer &BaseLayer)
+        : ObjectLayer(ES), BaseLayer(BaseLayer)
+    {
+    }
+
+    /// Export the object of K to Region, or import it from there.
+    void setRegion(llvm::orc::VModuleKey K,
+                   std::shared_ptr<SharedCodeRegion> Region, bool Export);
+
+    /// Drop the region of K if its object was never emitted, abandoning an
+    /// export: the other processes compile privately from then on.
+    void forgetRegion(llvm::orc::VModuleKey K);
+
+    void emit(llvm::orc::MaterializationResponsibility R,
+              std::unique_ptr<llvm::MemoryBuffer> O) override;
+
+    /// The memory manager of the object this layer is emitting on the
+    /// calling thread, or nullptr. For the base layer's memory manager
+    /// factory, which runs on the same thread while the object is emitted.
+    static std::unique_ptr<SharedCodeMemoryManager> takeMemoryManager();
+
+private:
+    llvm::orc::ObjectLayer &BaseLayer;
+
+    struct Target
+    {
+        std::shared_ptr<SharedCodeRegion> Region;
+        bool Export;
+    };
+
+    std::mutex Mutex;
+    std::map<llvm::orc::VModuleKey, Target> Regions;
+};
@@ -0,0 +1,200 @@
+#include "StreamGenerator.h"
+#include "CoroDriver.h"
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+enum StreamBufferField
+{
+    DataField = 0,
+    CapacityField,
+    HeadField,
+    TailField
+};
+
+static Value *loadField(IRBuilder<> &B, Type *BufferTy, Value *Buffer,
+                        StreamBufferField Field, const Twine &Name)
+{
+    Value *Ptr = B.CreateStructGEP(BufferTy, Buffer, Field, Name + ".ptr");
+    return B.CreateLoad(BufferTy->getStructElementType(Field), Ptr, Name);
+}
+
+/// `RetTy Name(i8* %hdl)`, calling Intrinsic on the handle
+static Function *emitHandleHelper(Module &M, const std::string &Name,
+                                  Type *RetTy, Intrinsic::ID Intrinsic)
+{
+    LLVMContext &ctx = M.getContext();
+    IRBuilder<> B(ctx);
+
+    auto signature = FunctionType::get(RetTy, Type::getInt8PtrTy(ctx), false);
+    auto fn = Function::Create(signature, Function::ExternalLinkage, Name, M);
+
+    Value *hdl = fn->arg_begin();
+    hdl->setName("hdl");
+
+    B.SetInsertPoint(BasicBlock::Create(ctx, "entry", fn));
+
+    Value *result = B.CreateCall(Intrinsic::getDeclaration(&M, Intrinsic), hdl);
+
+    if (RetTy->isVoidTy())
+        B.CreateRetVoid();
+    else
+        B.CreateRet(result);
+
+    return fn;
+}
+
+Expected<Function *> emitStreamGenerator(Module &M, StringRef Name,
+                                         Type *ElementTy, ArrayRef<Type *> Params,
+                                         StreamBodyFn Body)
+{
+    LLVMContext &ctx = M.getContext();
+    IRBuilder<> B(ctx);
+
+    Type *BufferTy = JitType<JitStreamBuffer>::get(ctx);
+
+    std::vector<Type *> paramTys{BufferTy->getPointerTo()};
+    paramTys.insert(paramTys.end(), Params.begin(), Params.end());
+
+    auto signature = FunctionType::get(Type::getInt8PtrTy(ctx), paramTys, false);
+    auto fn = Function::Create(signature, Function::ExternalLinkage, Name, M);
+
+    Function::arg_iterator args = fn->arg_begin();
+    Value *ring = args++;
+    ring->setName("buffer");
+
+    std::vector<Value *> bodyArgs;
+    for (; args != fn->arg_end(); ++args)
+        bodyArgs.push_back(&*args);
+
+    BasicBlock *entry = BasicBlock::Create(ctx, "entry", fn);
+    BasicBlock *cleanup = BasicBlock::Create(ctx, "cleanup", fn);
+    BasicBlock *suspend = BasicBlock::Create(ctx, "suspend", fn);
+    BasicBlock *trap = BasicBlock::Create(ctx, "trap", fn);
+
+    B.SetInsertPoint(entry);
+
+    // %id = call token @llvm.coro.id(i32 0, i8* null, i8* null, i8* null)
+    Value *null = ConstantPointerNull::get(Type::getInt8PtrTy(ctx));
+    Value *id = B.CreateCall(
+        Intrinsic::getDeclaration(&M, Intrinsic::coro_id),
+        {B.getInt32(0), null, null, null}, "id");
+
+    Value *alloc = emitCoroFrameAlloc(B, M, id);
+
+    // %hdl = call noalias i8* @llvm.coro.begin(token %id, i8* %alloc)
+    Value *hdl = B.CreateCall(
+        Intrinsic::getDeclaration(&M, Intrinsic::coro_begin), {id, alloc}, "hdl");
+
+    auto Yield = [&](IRBuilder<> &B, Value *Element) {
+        BasicBlock *check = BasicBlock::Create(ctx, "yield.check", fn);
+        BasicBlock *wait = BasicBlock::Create(ctx, "yield.wait", fn);
+        BasicBlock *store = BasicBlock::Create(ctx, "yield.store", fn);
+
+        B.CreateBr(check);
+
+        // The consumer moves the tail while the generator is suspended, so
+        // the fields are loaded again on every check.
+        B.SetInsertPoint(check);
+        Value *head = loadField(B, BufferTy, ring, HeadField, "head");
+        Value *tail = loadField(B, BufferTy, ring, TailField, "tail");
+        Value *capacity = loadField(B, BufferTy, ring, CapacityField, "capacity");
+        Value *full = B.CreateICmpEQ(B.CreateSub(head, tail), capacity, "full");
+        B.CreateCondBr(full, wait, store);
+
+        B.SetInsertPoint(wait);
+
+        // %s = call i8 @llvm.coro.suspend(token none, i1 false)
+        Value *s = B.CreateCall(
+            Intrinsic::getDeclaration(&M, Intrinsic::coro_suspend),
+            {ConstantTokenNone::get(ctx), B.getFalse()});
+
+        SwitchInst *swch = B.CreateSwitch(s, suspend, 2);
+        swch->addCase(B.getInt8(0), check);
+        swch->addCase(B.getInt8(1), cleanup);
+
+        B.SetInsertPoint(store);
+        Value *data = B.CreateBitCast(
+            loadField(B, BufferTy, ring, DataField, "data"),
+            ElementTy->getPointerTo(), "elements");
+        Value *index = B.CreateAnd(head, B.CreateSub(capacity, B.getInt64(1)), "index");
+        B.CreateStore(Element, B.CreateGEP(ElementTy, data, index, "slot"));
+        B.CreateStore(B.CreateAdd(head, B.getInt64(1), "head.next"),
+                      B.CreateStructGEP(BufferTy, ring, HeadField));
+    };
+
+    Body(B, bodyArgs, Yield);
+
+    // %final = call i8 @llvm.coro.suspend(token none, i1 true)
+    Value *final = B.CreateCall(
+        Intrinsic::getDeclaration(&M, Intrinsic::coro_suspend),
+        {ConstantTokenNone::get(ctx), B.getTrue()}, "final");
+
+    SwitchInst *finalSwch = B.CreateSwitch(final, suspend, 2);
+    finalSwch->addCase(B.getInt8(0), trap);
+    finalSwch->addCase(B.getInt8(1), cleanup);
+
+    B.SetInsertPoint(cleanup);
+    emitCoroFrameFree(B, M, id, hdl);
+    B.CreateBr(suspend);
+
+    B.SetInsertPoint(trap);
+    B.CreateCall(Intrinsic::getDeclaration(&M, Intrinsic::trap), {});
+    B.CreateUnreachable();
+
+    B.SetInsertPoint(suspend);
+
+    // call i1 @llvm.coro.end(i8* %hdl, i1 false)
+    B.CreateCall(Intrinsic::getDeclaration(&M, Intrinsic::coro_end),
+                 {hdl, B.getFalse()});
+    B.CreateRet(hdl);
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyFunction(*fn, &es))
+    {
+        fn->eraseFromParent();
+        return createStringError(inconvertibleErrorCode(),
+                                 "Function verification failed: %s",
+                                 es.str().c_str());
+    }
+
+    emitHandleHelper(M, Name.str() + "_resume", B.getVoidTy(), Intrinsic::coro_resume);
+    emitHandleHelper(M, Name.str() + "_done", B.getInt1Ty(), Intrinsic::coro_done);
+    emitHandleHelper(M, Name.str() + "_destroy", B.getVoidTy(), Intrinsic::coro_destroy);
+
+    return fn;
+}
+
+Expected<JitStreamFunctions> lookupStreamGenerator(JitEngine &JIT,
+                                                   orc::JITDylib &Tenant,
+                                                   StringRef Name)
+{
+    JitStreamFunctions Fns;
+
+    std::pair<JITTargetAddress *, std::string> Entries[] = {
+        {&Fns.Start, Name.str()},
+        {&Fns.Resume, Name.str() + "_resume"},
+        {&Fns.Done, Name.str() + "_done"},
+        {&Fns.Destroy, Name.str() + "_destroy"}};
+
+    for (auto &Entry : Entries)
+    {
+        auto Addr = JIT.getFunctionAddr(Tenant, Entry.second);
+        if (!Addr)
+            return Addr.takeError();
+
+        *Entry.first = *Addr;
+    }
+
+    return Fns;
+}
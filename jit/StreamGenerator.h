@@ -0,0 +1,165 @@
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ExecutionEngine/JITSymbol.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Error.h>
+
+#include "JitEngine.h"
+#include "TypeMap.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <type_traits>
+
+/// Streaming generators
+///
+/// A stream generator is a JIT coroutine that writes its elements into a
+/// ring buffer owned by the consumer and only suspends when the buffer is
+/// full, instead of handing over one element per resume through its
+/// promise. The consumer drains whole batches between resumes.
+
+/// Ring buffer shared by a generator and its consumer. Head and Tail count
+/// the elements written and read so far; the slot of an element is its
+/// position modulo Capacity, which is a power of two. The generator only
+/// runs while the consumer is blocked in a resume, so neither side needs
+/// atomics.
+struct JitStreamBuffer
+{
+    void *Data;
+    uint64_t Capacity;
+    uint64_t Head;
+    uint64_t Tail;
+};
+
+JIT_STRUCT(JitStreamBuffer,
+           JIT_FIELD(JitStreamBuffer, Data),
+           JIT_FIELD(JitStreamBuffer, Capacity),
+           JIT_FIELD(JitStreamBuffer, Head),
+           JIT_FIELD(JitStreamBuffer, Tail));
+
+/// Emitted by a generator's body to append Element to the stream. Where
+/// the buffer is full, the generator suspends until the consumer has made
+/// room. B is left at the end of a new block.
+using StreamYieldFn = std::function<void(llvm::IRBuilder<> &B, llvm::Value *Element)>;
+
+/// Emits the body of a generator at B. Args are the arguments of the
+/// generator after the buffer. The body must leave B at the end of an
+/// unterminated block, where the stream ends.
+using StreamBodyFn =
+    std::function<void(llvm::IRBuilder<> &B, llvm::ArrayRef<llvm::Value *> Args,
+                       const StreamYieldFn &Yield)>;
+
+/// Create the generator `i8* Name(JitStreamBuffer *, Params...)`, which
+/// runs until the buffer is first full or the stream ends and returns its
+/// handle. ElementTy must match the host element type, e.g. through
+/// JitType<T>::get. Three functions for the host come with it:
+/// `void Name_resume(i8*)`, `i1 Name_done(i8*)` and
+/// `void Name_destroy(i8*)`. The frame is allocated as with
+/// emitCoroFrameAlloc (see CoroDriver.h).
+llvm::Expected<llvm::Function *>
+emitStreamGenerator(llvm::Module &M, llvm::StringRef Name, llvm::Type *ElementTy,
+                    llvm::ArrayRef<llvm::Type *> Params, StreamBodyFn Body);
+
+/// Entry points of a generator
+struct JitStreamFunctions
+{
+    llvm::JITTargetAddress Start;
+    llvm::JITTargetAddress Resume;
+    llvm::JITTargetAddress Done;
+    llvm::JITTargetAddress Destroy;
+};
+
+llvm::Expected<JitStreamFunctions>
+lookupStreamGenerator(JitEngine &JIT, llvm::orc::JITDylib &Tenant,
+                      llvm::StringRef Name);
+
+/// Consumer side of a generator
+///
+/// Owns the ring buffer and the coroutine. The coroutine keeps the address
+/// of the buffer, so a stream cannot be copied or moved.
+template <typename T>
+class JitStream
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Stream elements are copied as raw memory");
+
+public:
+    /// Start the generator with room for at least Capacity elements. Args
+    /// must match the generator's parameters after the buffer.
+    template <typename... Args_t>
+    JitStream(const JitStreamFunctions &Fns, size_t Capacity, Args_t... Args)
+        : Fns(Fns)
+    {
+        uint64_t Size = 1;
+        while (Size < Capacity)
+            Size <<= 1;
+
+        Elements.reset(new T[Size]);
+        Buffer = JitStreamBuffer{Elements.get(), Size, 0, 0};
+
+        auto Start = llvm::jitTargetAddressToPointer<
+            int8_t *(*)(JitStreamBuffer *, Args_t...)>(Fns.Start);
+        Hdl = Start(&Buffer, Args...);
+    }
+
+    ~JitStream()
+    {
+        llvm::jitTargetAddressToPointer<void (*)(int8_t *)>(Fns.Destroy)(Hdl);
+    }
+
+    JitStream(const JitStream &) = delete;
+    JitStream &operator=(const JitStream &) = delete;
+
+    /// The next batch of elements, empty once the stream has ended. The
+    /// batch is consumed, and only valid, until the next call. A batch
+    /// never wraps around the end of the buffer.
+    llvm::ArrayRef<T> next()
+    {
+        Buffer.Tail += Pending;
+        Pending = 0;
+
+        if (Buffer.Head == Buffer.Tail)
+        {
+            if (done())
+                return {};
+
+            llvm::jitTargetAddressToPointer<void (*)(int8_t *)>(Fns.Resume)(Hdl);
+            NumResumes++;
+
+            if (Buffer.Head == Buffer.Tail)
+                return {};
+        }
+
+        uint64_t Begin = Buffer.Tail & (Buffer.Capacity - 1);
+        Pending = std::min(Buffer.Head - Buffer.Tail, Buffer.Capacity - Begin);
+
+        return llvm::ArrayRef<T>(Elements.get() + Begin, Pending);
+    }
+
+    /// Whether the generator has finished; elements may still be buffered.
+    bool done()
+    {
+        return llvm::jitTargetAddressToPointer<bool (*)(int8_t *)>(Fns.Done)(Hdl);
+    }
+
+    /// Resumes of the generator after its start
+    uint64_t getNumResumes() const { return NumResumes; }
+
+private:
+    JitStreamFunctions Fns;
+    std::unique_ptr<T[]> Elements;
+    JitStreamBuffer Buffer;
+    int8_t *Hdl = nullptr;
+    uint64_t NumResumes = 0;
+
+    /// Size of the batch returned last, consumed on the next call
+    uint64_t Pending = 0;
+};
@@ -0,0 +1,192 @@
+#include "SymbolCache.h"
+
+#include <llvm/ADT/Hashing.h>
+#include <llvm/Support/MathExtras.h>
+
+using namespace llvm;
+
+const size_t SymbolCache::MaxProbes;
+const size_t SymbolCache::MaxRetired;
+const size_t SymbolCache::ReaderStripes;
+
+SymbolCache::SymbolCache(size_t Capacity) :
+    Mask(NextPowerOf2(std::max<size_t>(Capacity, MaxProbes) - 1) - 1),
+    Epoch(0)
+{
+    Slots.reset(new std::atomic<Entry *>[Mask + 1]);
+    for (size_t I = 0; I <= Mask; ++I)
+        Slots[I].store(nullptr, std::memory_order_relaxed);
+}
+
+SymbolCache::~SymbolCache()
+{
+    for (size_t I = 0; I <= Mask; ++I)
+        delete Slots[I].load(std::memory_order_relaxed);
+
+    for (Entry *E : Retired)
+        delete E;
+}
+
+void SymbolCache::retire(Entry *E)
+{
+    {
+        std::lock_guard<std::mutex> Lock(RetiredMutex);
+        Retired.push_back(E);
+        NumRetired.store(Retired.size(), std::memory_order_relaxed);
+    }
+
+    reclaim();
+}
+
+void SymbolCache::reclaim()
+{
+    std::lock_guard<std::mutex> Lock(RetiredMutex);
+
+    // Every entry in the list was unlinked before this point. A reader
+    // that starts counting after a counter is seen at zero loads the slots
+    // afterwards, so it can only find their replacements.
+    for (const ReaderCount &R : Readers)
+        if (R.Count.load(std::memory_order_seq_cst))
+            return;
+
+    for (Entry *E : Retired)
+        delete E;
+
+    Retired.clear();
+    NumRetired.store(0, std::memory_order_relaxed);
+}
+
+uint64_t SymbolCache::hash(StringRef Name)
+{
+    return static_cast<uint64_t>(hash_value(Name));
+}
+
+void SymbolCache::insert(const void *Scope, StringRef Name,
+                         JITTargetAddress Addr, uint64_t LookupEpoch)
+{
+    if (!Addr)
+        return;
+
+    Entry *Unlinked;
+
+    {
+        ReadGuard Guard(*this);
+        Unlinked = insertEntry(Scope, Name, Addr, LookupEpoch);
+    }
+
+    if (Unlinked)
+        retire(Unlinked);
+    else if (NumRetired.load(std::memory_order_relaxed))
+        reclaim();
+}
+
+SymbolCache::Entry *SymbolCache::insertEntry(const void *Scope, StringRef Name,
+                                             JITTargetAddress Addr,
+                                             uint64_t LookupEpoch)
+{
+    const uint64_t Hash = hash(Name);
+    Entry *E = nullptr;
+
+    std::atomic<Entry *> *DeadSlot = nullptr;
+    Entry *Dead = nullptr;
+
+    for (size_t I = 0; I < MaxProbes && !E; ++I)
+    {
+        std::atomic<Entry *> &Slot = Slots[(Hash + I) & Mask];
+        Entry *Current = Slot.load(std::memory_order_seq_cst);
+
+        if (!Current)
+        {
+            std::unique_ptr<Entry> New(new Entry(Scope, Hash, Name));
+
+            if (Slot.compare_exchange_strong(Current, New.get(),
+                                             std::memory_order_seq_cst))
+            {
+                E = New.release();
+                break;
+            }
+            // Lost the race for this slot; Current now holds the winner.
+        }
+
+        if (Current->Hash == Hash && Current->Scope == Scope &&
+            Current->Name == Name)
+            E = Current;
+        else if (!DeadSlot && Current->DeadSince.load(std::memory_order_acquire))
+        {
+            DeadSlot = &Slot;
+            Dead = Current;
+        }
+    }
+
+    // The probe sequence is full: take over the first dead entry's slot,
+    // unless too many entries already wait for the readers to drain.
+    Entry *Unlinked = nullptr;
+
+    if (!E && DeadSlot && NumRetired.load(std::memory_order_relaxed) < MaxRetired)
+    {
+        std::unique_ptr<Entry> New(new Entry(Scope, Hash, Name));
+
+        if (DeadSlot->compare_exchange_strong(Dead, New.get(),
+                                              std::memory_order_seq_cst))
+        {
+            E = New.release();
+            Unlinked = Dead;
+        }
+    }
+
+    // Still full: leave the symbol to the slow path.
+    if (!E)
+        return Unlinked;
+
+    E->DeadSince.store(0, std::memory_order_release);
+
+    JITTargetAddress Expected = 0;
+    E->Addr.compare_exchange_strong(Expected, Addr, std::memory_order_acq_rel);
+
+    // An invalidation ran while the address was being resolved, so it may
+    // already be stale. Undo the publication; the next lookup will miss.
+    uint64_t Current = Epoch.load(std::memory_order_acquire);
+    if (Current != LookupEpoch)
+    {
+        E->Addr.compare_exchange_strong(Addr, 0, std::memory_order_acq_rel);
+        E->DeadSince.store(Current, std::memory_order_release);
+    }
+
+    return Unlinked;
+}
+
+void SymbolCache::invalidate(StringRef Name)
+{
+    const uint64_t Dead = Epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+    ReadGuard Guard(*this);
+    const uint64_t Hash = hash(Name);
+
+    for (size_t I = 0; I < MaxProbes; ++I)
+    {
+        Entry *E = Slots[(Hash + I) & Mask].load(std::memory_order_seq_cst);
+
+        if (!E)
+            return;
+
+        if (E->Hash == Hash && E->Name == Name)
+        {
+            E->Addr.store(0, std::memory_order_release);
+            E->DeadSince.store(Dead, std::memory_order_release);
+        }
+    }
+}
+
+void SymbolCache::invalidateAll()
+{
+    const uint64_t Dead = Epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+    ReadGuard Guard(*this);
+
+    for (size_t I = 0; I <= Mask; ++I)
+        if (Entry *E = Slots[I].load(std::memory_order_seq_cst))
+        {
+            E->Addr.store(0, std::memory_order_release);
+            E->DeadSince.store(Dead, std::memory_order_release);
+        }
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ExecutionEngine/JITSymbol.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// Read-mostly cache of resolved symbol addresses
+///
+/// Lookups never take a lock: the table is an open-addressing array of
+/// atomic pointers to entries that, once published, are only ever modified
+/// through their atomic address field.
+///
+/// Invalidation clears the address of every entry matching a name and
+/// tags the entry with the epoch it died in. The epoch counter closes the
+/// window between a slow-path lookup and the insertion of its result: an
+/// insertion that raced with an invalidation is rolled back.
+///
+/// A dead entry keeps its slot until an insertion finds no free slot for
+/// a different name, and then gives it up. Readers may still be looking at
+/// the entry it held, so that entry is retired rather than freed. Every
+/// access to the table is counted in one of a few per-thread reader
+/// counters, and retired entries are freed once all of them are seen at
+/// zero after the entries were unlinked. While readers keep the counters
+/// busy, at most MaxRetired entries wait, after which slots are no longer
+/// taken over.
+class SymbolCache
+{
+
+public:
+    /// Capacity is rounded up to a power of two.
+    explicit SymbolCache(size_t Capacity = 4096);
+    ~SymbolCache();
+
+    SymbolCache(const SymbolCache &) = delete;
+    SymbolCache &operator=(const SymbolCache &) = delete;
+
+    /// Return the cached address of Name in Scope, or 0 on a miss.
+    llvm::JITTargetAddress lookup(const void *Scope, llvm::StringRef Name) const
+    {
+        ReadGuard Guard(*this);
+        const uint64_t Hash = hash(Name);
+
+        for (size_t I = 0; I < MaxProbes; ++I)
+        {
+            const Entry *E = Slots[(Hash + I) & Mask].load(std::memory_order_seq_cst);
+
+            if (!E)
+                return 0;
+
+            if (E->Hash == Hash && E->Scope == Scope && E->Name == Name)
+                return E->Addr.load(std::memory_order_acquire);
+        }
+
+        return 0;
+    }
+
+    /// Read the epoch before starting a slow-path lookup, and pass it to
+    /// insert once the address is known.
+    uint64_t getEpoch() const { return Epoch.load(std::memory_order_acquire); }
+
+    void insert(const void *Scope, llvm::StringRef Name,
+                llvm::JITTargetAddress Addr, uint64_t LookupEpoch);
+
+    /// Drop Name from every scope. Used when a symbol is defined, redefined
+    /// or removed.
+    void invalidate(llvm::StringRef Name);
+
+    void invalidateAll();
+
+private:
+    struct Entry
+    {
+        Entry(const void *Scope, uint64_t Hash, llvm::StringRef Name)
+            : Scope(Scope), Hash(Hash), Name(Name), Addr(0) {}
+
+        const void *Scope;
+        uint64_t Hash;
+        std::string Name;
+        std::atomic<llvm::JITTargetAddress> Addr;
+
+        /// Epoch of the invalidation that cleared Addr, or 0 while the
+        /// entry is live (or still being inserted)
+        std::atomic<uint64_t> DeadSince{0};
+    };
+
+    /// Probe sequences are bounded so that a crowded table degrades into
+    /// misses instead of long scans.
+    static const size_t MaxProbes = 16;
+
+    /// Retired entries that may wait for the readers to drain
+    static const size_t MaxRetired = 1024;
+
+    /// Threads are spread over this many reader counters, each on a cache
+    /// line of its own, so that lookups on different threads do not
+    /// contend.
+    static const size_t ReaderStripes = 16;
+
+    struct ReaderCount
+    {
+        std::atomic<uint64_t> Count{0};
+        char Pad[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    static size_t getReaderStripe()
+    {
+        static std::atomic<size_t> NextStripe{0};
+        static thread_local size_t Stripe =
+            NextStripe.fetch_add(1, std::memory_order_relaxed) % ReaderStripes;
+        return Stripe;
+    }
+
+    /// Counts the calling thread as a reader of the table while in scope
+    class ReadGuard
+    {
+
+    public:
+        explicit ReadGuard(const SymbolCache &Cache)
+            : Count(Cache.Readers[getReaderStripe()].Count)
+        {
+            Count.fetch_add(1, std::memory_order_seq_cst);
+        }
+
+        ~ReadGuard() { Count.fetch_sub(1, std::memory_order_release); }
+
+    private:
+        std::atomic<uint64_t> &Count;
+    };
+
+    /// The hash only depends on the name, so every scope that holds a name
+    /// shares its probe sequence and invalidate does not need to scan the
+    /// whole table.
+    static uint64_t hash(llvm::StringRef Name);
+
+    std::unique_ptr<std::atomic<Entry *>[]> Slots;
+    size_t Mask;
+    std::atomic<uint64_t> Epoch;
+
+    mutable ReaderCount Readers[ReaderStripes];
+
+    /// Entries unlinked from the table, waiting for the readers to drain
+    std::mutex RetiredMutex;
+    std::vector<Entry *> Retired;
+    std::atomic<size_t> NumRetired{0};
+
+    /// Insert under a ReadGuard. Returns the entry it unlinked, if any.
+    Entry *insertEntry(const void *Scope, llvm::StringRef Name,
+                       llvm::JITTargetAddress Addr, uint64_t LookupEpoch);
+
+    /// Retire an unlinked entry, and free the retired entries if no reader
+    /// can still hold them. Must not be called under a ReadGuard.
+    void retire(Entry *E);
+    void reclaim();
+};
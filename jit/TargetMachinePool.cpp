@@ -0,0 +1,62 @@
+#include "TargetMachinePool.h"
+#include "JitDiagnostics.h"
+
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+Expected<TargetMachinePool::Lease> TargetMachinePool::acquire()
+{
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+
+        if (!Idle.empty())
+        {
+            std::unique_ptr<TargetMachine> TM = std::move(Idle.back());
+            Idle.pop_back();
+            return Lease(*this, std::move(TM));
+        }
+    }
+
+    // Created outside the lock: this is the slow part.
+    auto TM = JTMB.createTargetMachine();
+    if (!TM)
+        return TM.takeError();
+
+    NumCreated++;
+    return Lease(*this, std::move(*TM));
+}
+
+void TargetMachinePool::release(std::unique_ptr<TargetMachine> TM)
+{
+    if (!ReuseEnabled.load())
+        return;
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Idle.push_back(std::move(TM));
+}
+
+void TargetMachinePool::setReuseEnabled(bool Enabled)
+{
+    ReuseEnabled.store(Enabled);
+
+    if (!Enabled)
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Idle.clear();
+    }
+}
+
+Expected<std::unique_ptr<MemoryBuffer>> PooledIRCompiler::operator()(Module &M)
+{
+    auto TM = Pool->acquire();
+    if (!TM)
+        return TM.takeError();
+
+    // Code generation passes would be timed along with a timed optimization.
+    std::shared_lock<std::shared_timed_mutex> Lock(JitDiagnostics::getPipelineLock());
+
+    SimpleCompiler Compile(**TM);
+    return Compile(M);
+}
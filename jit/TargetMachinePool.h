@@ -0,0 +1,96 @@
+#pragma once
+
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// Target machine pool
+///
+/// Creating a TargetMachine (target lookup, subtarget and option setup) is
+/// a fixed cost of every compilation that dominates for small modules. The
+/// pool keeps the target machines of finished compilations and hands them
+/// out again, one compilation at a time each, so there are never more of
+/// them than compilations ever ran concurrently.
+///
+/// With reuse disabled, every compilation gets a target machine of its own
+/// that is dropped afterwards, as with ConcurrentIRCompiler. Thread safe.
+class TargetMachinePool
+{
+
+public:
+    explicit TargetMachinePool(llvm::orc::JITTargetMachineBuilder JTMB)
+        : JTMB(std::move(JTMB))
+    {
+    }
+
+    /// Target machine of one compilation, returned to the pool when
+    /// destroyed
+    class Lease
+    {
+
+    public:
+        Lease(TargetMachinePool &Pool, std::unique_ptr<llvm::TargetMachine> TM)
+            : Pool(Pool), TM(std::move(TM))
+        {
+        }
+
+        Lease(Lease &&Other) : Pool(Other.Pool), TM(std::move(Other.TM)) {}
+
+        ~Lease()
+        {
+            if (TM)
+                Pool.release(std::move(TM));
+        }
+
+        llvm::TargetMachine &operator*() const { return *TM; }
+        llvm::TargetMachine *operator->() const { return TM.get(); }
+
+    private:
+        TargetMachinePool &Pool;
+        std::unique_ptr<llvm::TargetMachine> TM;
+    };
+
+    llvm::Expected<Lease> acquire();
+
+    /// On by default. Turning it off drops the idle target machines.
+    void setReuseEnabled(bool Enabled);
+    bool isReuseEnabled() const { return ReuseEnabled.load(); }
+
+    /// Number of target machines created so far
+    unsigned getNumCreated() const { return NumCreated.load(); }
+
+private:
+    llvm::orc::JITTargetMachineBuilder JTMB;
+
+    std::atomic<bool> ReuseEnabled{true};
+    std::atomic<unsigned> NumCreated{0};
+
+    std::mutex Mutex;
+    std::vector<std::unique_ptr<llvm::TargetMachine>> Idle;
+
+    void release(std::unique_ptr<llvm::TargetMachine> TM);
+};
+
+/// Compile function for IRCompileLayer that generates code with target
+/// machines from a pool. Copies share the pool.
+class PooledIRCompiler
+{
+
+public:
+    explicit PooledIRCompiler(std::shared_ptr<TargetMachinePool> Pool)
+        : Pool(std::move(Pool))
+    {
+    }
+
+    llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> operator()(llvm::Module &M);
+
+private:
+    std::shared_ptr<TargetMachinePool> Pool;
+};
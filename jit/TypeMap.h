@@ -0,0 +1,379 @@
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Type.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <climits>
+#include <cstddef>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/// C++ to LLVM type mapping
+///
+/// JitType<T>::get(Context) returns the LLVM type with the same memory
+/// representation as the C++ type T, so that JIT code can work on host data
+/// in place. Supported are integers, bool, enums, float, double, void,
+/// pointers, arrays, functions and structs registered with JIT_STRUCT:
+///
+///     struct Point { int32_t x; int32_t y; };
+///     JIT_STRUCT(Point, JIT_FIELD(Point, x), JIT_FIELD(Point, y));
+///
+///     llvm::StructType *pointTy = JitType<Point>::get(ctx);
+///     llvm::Function *fn = declareFunction<int32_t(Point[4])>(module, "sum");
+///
+/// Function parameters decay as they do in C++, so the function above takes
+/// a Point pointer. Structs map to literal LLVM struct types, which are
+/// uniqued by structure.
+///
+/// The mapping assumes the natural C layout. verifyLayout checks that
+/// assumption against the engine's data layout (sizes, alignments and field
+/// offsets, recursively), and verifySignature checks that a function built
+/// by hand matches the C++ signature it will be called through.
+
+template <typename T, typename Enable = void>
+struct JitType;
+
+/// Struct registration; specialized by JIT_STRUCT.
+template <typename T>
+struct JitStruct;
+
+template <typename FieldT, size_t Offset>
+struct JitField
+{
+    using Type = FieldT;
+    static constexpr size_t offset = Offset;
+};
+
+template <typename... Fields>
+struct JitFields {};
+
+#define JIT_FIELD(Struct, Member) \
+    JitField<decltype(Struct::Member), offsetof(Struct, Member)>
+
+#define JIT_STRUCT(Struct, ...)                                  \
+    template <>                                                  \
+    struct JitStruct<Struct>                                     \
+    {                                                            \
+        static const char *name() { return #Struct; }            \
+        using Fields = JitFields<__VA_ARGS__>;                   \
+    }
+
+template <>
+struct JitType<void>
+{
+    static llvm::Type *get(llvm::LLVMContext &C) { return llvm::Type::getVoidTy(C); }
+};
+
+template <>
+struct JitType<bool>
+{
+    static llvm::IntegerType *get(llvm::LLVMContext &C) { return llvm::Type::getInt1Ty(C); }
+};
+
+template <typename T>
+using JitUnqualified = std::is_same<T, typename std::remove_cv<T>::type>;
+
+template <typename T>
+struct JitType<T, typename std::enable_if<std::is_integral<T>::value &&
+                                          JitUnqualified<T>::value &&
+                                          !std::is_same<T, bool>::value>::type>
+{
+    static llvm::IntegerType *get(llvm::LLVMContext &C)
+    {
+        return llvm::Type::getIntNTy(C, sizeof(T) * CHAR_BIT);
+    }
+};
+
+template <typename T>
+struct JitType<T, typename std::enable_if<std::is_enum<T>::value &&
+                                          JitUnqualified<T>::value>::type>
+{
+    static llvm::IntegerType *get(llvm::LLVMContext &C)
+    {
+        return JitType<typename std::underlying_type<T>::type>::get(C);
+    }
+};
+
+template <>
+struct JitType<float>
+{
+    static llvm::Type *get(llvm::LLVMContext &C) { return llvm::Type::getFloatTy(C); }
+};
+
+template <>
+struct JitType<double>
+{
+    static llvm::Type *get(llvm::LLVMContext &C) { return llvm::Type::getDoubleTy(C); }
+};
+
+template <typename T>
+struct JitType<T, typename std::enable_if<!JitUnqualified<T>::value &&
+                                          !std::is_array<T>::value>::type>
+{
+    static auto get(llvm::LLVMContext &C)
+        -> decltype(JitType<typename std::remove_cv<T>::type>::get(C))
+    {
+        return JitType<typename std::remove_cv<T>::type>::get(C);
+    }
+};
+
+template <typename T>
+struct JitType<T *>
+{
+    /// void * is i8 *, as in clang.
+    static llvm::PointerType *get(llvm::LLVMContext &C)
+    {
+        using Pointee = typename std::remove_cv<T>::type;
+
+        if (std::is_void<Pointee>::value)
+            return llvm::Type::getInt8PtrTy(C);
+
+        return llvm::PointerType::getUnqual(JitType<Pointee>::get(C));
+    }
+};
+
+template <typename T, size_t N>
+struct JitType<T[N]>
+{
+    static llvm::ArrayType *get(llvm::LLVMContext &C)
+    {
+        return llvm::ArrayType::get(JitType<T>::get(C), N);
+    }
+};
+
+template <typename R, typename... Args>
+struct JitType<R(Args...)>
+{
+    static llvm::FunctionType *get(llvm::LLVMContext &C)
+    {
+        std::vector<llvm::Type *> Params{
+            JitType<typename std::decay<Args>::type>::get(C)...};
+
+        return llvm::FunctionType::get(JitType<R>::get(C), Params, false);
+    }
+};
+
+namespace jit_detail {
+
+template <typename Fields>
+struct FieldList;
+
+template <typename... Fs>
+struct FieldList<JitFields<Fs...>>
+{
+    static std::vector<llvm::Type *> types(llvm::LLVMContext &C)
+    {
+        return {JitType<typename Fs::Type>::get(C)...};
+    }
+
+    static std::vector<size_t> offsets() { return {Fs::offset...}; }
+};
+
+} // end namespace jit_detail
+
+template <typename T>
+struct JitType<T, typename std::enable_if<std::is_class<T>::value &&
+                                          JitUnqualified<T>::value>::type>
+{
+    static llvm::StructType *get(llvm::LLVMContext &C)
+    {
+        using Fields = jit_detail::FieldList<typename JitStruct<T>::Fields>;
+        return llvm::StructType::get(C, Fields::types(C), false);
+    }
+};
+
+template <typename T>
+llvm::Error verifyLayout(const llvm::DataLayout &DL, llvm::LLVMContext &C);
+
+namespace jit_detail {
+
+inline std::string printType(llvm::Type *Ty)
+{
+    std::string buffer;
+    llvm::raw_string_ostream os(buffer);
+    Ty->print(os);
+    return os.str();
+}
+
+inline llvm::Error checkSizeAndAlignment(const llvm::DataLayout &DL,
+                                         llvm::Type *Ty, size_t Size,
+                                         size_t Align)
+{
+    if (DL.getTypeAllocSize(Ty) != Size)
+        return llvm::createStringError(
+            llvm::inconvertibleErrorCode(),
+            "Type %s has size %llu in the data layout but %zu in C++",
+            printType(Ty).c_str(),
+            (unsigned long long)DL.getTypeAllocSize(Ty), Size);
+
+    if (DL.getABITypeAlignment(Ty) != Align)
+        return llvm::createStringError(
+            llvm::inconvertibleErrorCode(),
+            "Type %s has alignment %u in the data layout but %zu in C++",
+            printType(Ty).c_str(), DL.getABITypeAlignment(Ty), Align);
+
+    return llvm::Error::success();
+}
+
+template <typename T, typename Enable = void>
+struct LayoutChecker
+{
+    static llvm::Error verify(const llvm::DataLayout &DL, llvm::LLVMContext &C)
+    {
+        return checkSizeAndAlignment(DL, JitType<T>::get(C), sizeof(T),
+                                     alignof(T));
+    }
+};
+
+template <>
+struct LayoutChecker<void>
+{
+    static llvm::Error verify(const llvm::DataLayout &, llvm::LLVMContext &)
+    {
+        return llvm::Error::success();
+    }
+};
+
+template <typename T>
+struct LayoutChecker<T, typename std::enable_if<!JitUnqualified<T>::value &&
+                                                !std::is_array<T>::value>::type>
+{
+    static llvm::Error verify(const llvm::DataLayout &DL, llvm::LLVMContext &C)
+    {
+        return verifyLayout<typename std::remove_cv<T>::type>(DL, C);
+    }
+};
+
+template <typename T>
+struct LayoutChecker<T *>
+{
+    /// JIT code reads and writes what the pointer points to as well.
+    static llvm::Error verify(const llvm::DataLayout &DL, llvm::LLVMContext &C)
+    {
+        if (auto Err = checkSizeAndAlignment(DL, JitType<T *>::get(C),
+                                             sizeof(T *), alignof(T *)))
+            return Err;
+
+        return verifyLayout<typename std::remove_cv<T>::type>(DL, C);
+    }
+};
+
+template <typename R, typename... Args>
+struct LayoutChecker<R(Args...)>
+{
+    /// Every value crossing the boundary must have a matching layout.
+    static llvm::Error verify(const llvm::DataLayout &DL, llvm::LLVMContext &C)
+    {
+        llvm::Error Err = verifyLayout<R>(DL, C);
+
+        using expand = int[];
+        (void)expand{0, (Err = llvm::joinErrors(
+                             std::move(Err),
+                             verifyLayout<typename std::decay<Args>::type>(DL, C)),
+                         0)...};
+
+        return Err;
+    }
+};
+
+template <typename T, size_t N>
+struct LayoutChecker<T[N]>
+{
+    static llvm::Error verify(const llvm::DataLayout &DL, llvm::LLVMContext &C)
+    {
+        if (auto Err = verifyLayout<T>(DL, C))
+            return Err;
+
+        return checkSizeAndAlignment(DL, JitType<T[N]>::get(C), sizeof(T[N]),
+                                     alignof(T[N]));
+    }
+};
+
+template <typename... Fs>
+llvm::Error verifyFields(const llvm::DataLayout &DL, llvm::LLVMContext &C,
+                         JitFields<Fs...>)
+{
+    llvm::Error Err = llvm::Error::success();
+
+    using expand = int[];
+    (void)expand{0, (Err = llvm::joinErrors(
+                         std::move(Err), verifyLayout<typename Fs::Type>(DL, C)),
+                     0)...};
+
+    return Err;
+}
+
+template <typename T>
+struct LayoutChecker<T, typename std::enable_if<std::is_class<T>::value &&
+                                                JitUnqualified<T>::value>::type>
+{
+    static llvm::Error verify(const llvm::DataLayout &DL, llvm::LLVMContext &C)
+    {
+        using Fields = typename JitStruct<T>::Fields;
+
+        if (auto Err = verifyFields(DL, C, Fields()))
+            return Err;
+
+        llvm::StructType *Ty = JitType<T>::get(C);
+        const llvm::StructLayout *SL = DL.getStructLayout(Ty);
+        std::vector<size_t> Offsets = FieldList<Fields>::offsets();
+
+        for (unsigned I = 0; I < Offsets.size(); I++)
+            if (SL->getElementOffset(I) != Offsets[I])
+                return llvm::createStringError(
+                    llvm::inconvertibleErrorCode(),
+                    "Field %u of struct %s is at offset %llu in the data "
+                    "layout but at %zu in C++",
+                    I, JitStruct<T>::name(),
+                    (unsigned long long)SL->getElementOffset(I), Offsets[I]);
+
+        return checkSizeAndAlignment(DL, Ty, sizeof(T), alignof(T));
+    }
+};
+
+} // end namespace jit_detail
+
+/// Check that T has the same size, alignment and (for structs) field
+/// offsets in DL as in the host compiler. The types pointers point to are
+/// checked as well; cv-qualifiers are ignored.
+template <typename T>
+llvm::Error verifyLayout(const llvm::DataLayout &DL, llvm::LLVMContext &C)
+{
+    return jit_detail::LayoutChecker<T>::verify(DL, C);
+}
+
+/// Check that F has exactly the type JitType<Signature_t> maps to.
+template <typename Signature_t>
+llvm::Error verifySignature(const llvm::Function &F)
+{
+    llvm::FunctionType *Expected = JitType<Signature_t>::get(F.getContext());
+
+    if (F.getFunctionType() == Expected)
+        return llvm::Error::success();
+
+    return llvm::createStringError(
+        llvm::inconvertibleErrorCode(),
+        "Function '%s' has type %s, but is used as %s",
+        F.getName().str().c_str(),
+        jit_detail::printType(F.getFunctionType()).c_str(),
+        jit_detail::printType(Expected).c_str());
+}
+
+/// Create a function whose type is derived from Signature_t, so that it
+/// matches the signature used to retrieve it with JitEngine::getFunction.
+template <typename Signature_t>
+llvm::Function *declareFunction(llvm::Module &M, llvm::StringRef Name,
+                                llvm::Function::LinkageTypes Linkage =
+                                    llvm::Function::ExternalLinkage)
+{
+    return llvm::Function::Create(JitType<Signature_t>::get(M.getContext()),
+                                  Linkage, Name, M);
+}
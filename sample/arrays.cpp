@@ -18,6 +18,7 @@
 #include <iostream>
 
 #include "JitEngine.h"
+#include "TypeMap.h"
 
 using namespace llvm;
 
@@ -26,6 +27,10 @@ struct Point {
     int32_t y;
 };
 
+JIT_STRUCT(Point, JIT_FIELD(Point, x), JIT_FIELD(Point, y));
+
+using SumArray = int32_t(struct Point [4]);
+
 /**
  * 
  * The following function generates the code of a function equivalent to this one:
@@ -53,16 +58,12 @@ Expected<std::string> codegenIR(Module &module)
     IRBuilder<> B(ctx);
 
     auto name = "sum_array";
-    auto returnTy = Type::getInt32Ty(ctx);
 
-    auto pointStr = StructType::create(ctx, 
-        { Type::getInt32Ty(ctx), Type::getInt32Ty(ctx) }, "pointStr", true );
+    // Both the struct type and the signature are derived from the C++
+    // declarations, so the host can pass its array without conversion
+    auto pointStr = JitType<Point>::get(ctx);
 
-    auto argTy = PointerType::get(pointStr, 0);
-    auto signature = FunctionType::get(returnTy, argTy, false);
-    auto linkage = Function::ExternalLinkage;
-
-    auto fn = Function::Create(signature, linkage, name, module);
+    auto fn = declareFunction<SumArray>(module, name);
 
     Function::arg_iterator args = fn->arg_begin();
     Value *pArray = args;
@@ -169,13 +170,17 @@ int main(int argc, char **argv)
     auto module = std::make_unique<Module>("MyFirstJIT", TheJIT->getContext());
     module->setDataLayout(TheJIT->getDataLayout());
 
+    // Make sure the target lays out Point the way the host compiler does
+    ExitOnErr(verifyLayout<SumArray>(TheJIT->getDataLayout(),
+                                     module->getContext()));
+
     std::string JitedFnName = ExitOnErr(codegenIR(*module));
 
     ExitOnErr(TheJIT->addModule(std::move(module)));
 
     // Request function; this compiles to machine code and links.
     auto sum_array =
-        ExitOnErr(TheJIT->getFunction<int32_t(struct Point [4])>(JitedFnName));
+        ExitOnErr(TheJIT->getFunction<SumArray>(JitedFnName));
 
     struct Point test[] = {{2,0}, {3,1}, {8,0}, {173,1}};
 
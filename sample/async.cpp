@@ -0,0 +1,173 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "JitEngine.h"
+
+using namespace llvm;
+using namespace llvm::orc;
+
+/**
+ * Asynchronous compilation
+ *
+ * An event loop queues a batch of modules for background compilation and,
+ * while they compile, asks for one function at interactive priority. The
+ * loop never blocks: it polls the futures between "events" and reports
+ * each result as it becomes ready.
+ */
+
+static const unsigned NumModules = 16;
+
+/// int32_t poly<i>(int32_t x) = x * x * i + i
+Expected<std::string> codegenIR(Module &module, unsigned i)
+{
+
+    LLVMContext &ctx = module.getContext();
+    IRBuilder<> B(ctx);
+
+    std::string name = "poly" + std::to_string(i);
+    auto signature = FunctionType::get(Type::getInt32Ty(ctx),
+                                       Type::getInt32Ty(ctx), false);
+
+    auto fn = Function::Create(signature, Function::ExternalLinkage, name,
+                               module);
+
+    Value *x = fn->arg_begin();
+    x->setName("x");
+
+    B.SetInsertPoint(BasicBlock::Create(ctx, "entry", fn));
+
+    Value *k = ConstantInt::get(Type::getInt32Ty(ctx), i);
+    Value *sq = B.CreateMul(x, x, "sq");
+    B.CreateRet(B.CreateAdd(B.CreateMul(sq, k), k));
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyModule(module, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Module verification failed: %s",
+                                 es.str().c_str());
+
+    return name;
+}
+
+std::unique_ptr<JitEngine> TheJIT;
+static ExitOnError ExitOnErr;
+
+template <typename T>
+static bool isReady(const std::future<T> &F)
+{
+    return F.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+int main(int argc, char **argv)
+{
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+
+    PassRegistry &Registry = *PassRegistry::getPassRegistry();
+    initializeCoroutines(Registry);
+
+    TheJIT = ExitOnErr(JitEngine::Create());
+
+    // Two compile threads; room for fewer modules than the batch, so some
+    // background submissions are refused
+    ExitOnErr(TheJIT->setCompileQueue(2, NumModules / 2));
+
+    JITDylib &Tenant = TheJIT->getDefaultTenant();
+
+    std::vector<std::future<Error>> Pending;
+
+    for (unsigned i = 1; i <= NumModules; i++)
+    {
+        // Each module has its own context, so they compile in parallel
+        auto Ctx = std::make_unique<LLVMContext>();
+        auto module = std::make_unique<Module>("poly" + std::to_string(i), *Ctx);
+        module->setDataLayout(TheJIT->getDataLayout());
+
+        ExitOnErr(codegenIR(*module, i).takeError());
+
+        ThreadSafeModule TSM(std::move(module), std::move(Ctx));
+        Pending.push_back(TheJIT->addModuleAsync(
+            Tenant, std::move(TSM), TheJIT->createModuleKey()));
+    }
+
+    // Jumps ahead of the background batch still in the queue
+    auto module = std::make_unique<Module>("interactive", TheJIT->getContext());
+    module->setDataLayout(TheJIT->getDataLayout());
+    std::string Name = ExitOnErr(codegenIR(*module, 0));
+
+    ExitOnErr(TheJIT->addModule(Tenant, std::move(module)));
+    auto Interactive = TheJIT->getFunctionAsync<int32_t(int32_t)>(Name);
+
+    unsigned Ticks = 0;
+    unsigned Done = 0;
+
+    // Index of a module that compiled, as the refused ones were not added
+    unsigned Compiled = 0;
+    bool InteractiveDone = false;
+
+    while (Done < Pending.size() || !InteractiveDone)
+    {
+        // ... handle other events here ...
+        Ticks++;
+
+        if (!InteractiveDone && isReady(Interactive))
+        {
+            auto poly0 = ExitOnErr(Interactive.get());
+            std::cout << "tick " << Ticks << ": poly0(7) = " << poly0(7)
+                      << std::endl;
+            InteractiveDone = true;
+        }
+
+        for (unsigned i = 0; i < Pending.size(); i++)
+        {
+            if (!Pending[i].valid() || !isReady(Pending[i]))
+                continue;
+
+            if (Error Err = Pending[i].get())
+                std::cout << "tick " << Ticks << ": poly" << i + 1 << ": "
+                          << toString(std::move(Err)) << std::endl;
+            else
+            {
+                std::cout << "tick " << Ticks << ": poly" << i + 1
+                          << " compiled" << std::endl;
+                Compiled = i + 1;
+            }
+
+            Done++;
+        }
+
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    if (Compiled)
+    {
+        std::string Last = "poly" + std::to_string(Compiled);
+        auto poly = ExitOnErr(TheJIT->getFunction<int32_t(int32_t)>(Tenant, Last));
+        std::cout << Last << "(2) = " << poly(2) << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <iostream>
+#include <vector>
+
+#include "BatchWrapper.h"
+#include "JitEngine.h"
+
+using namespace llvm;
+
+/**
+ * Batch wrappers
+ *
+ * Generates the scalar
+ *
+ *     int32_t mul_add(int32_t x, int32_t y, int32_t z) { return x * y + z; }
+ *
+ * and has the engine compile its batch wrapper
+ *
+ *     void mul_add_batch(const int32_t *x, const int32_t *y, const int32_t *z,
+ *                        int32_t *out, size_t n)
+ *
+ * Then times mul_add over columns of NumRows rows, called once per row
+ * through std::function, and once for all rows through the wrapper.
+ */
+
+static const size_t NumRows = 1 << 24;
+
+Error codegenIR(Module &module)
+{
+
+    LLVMContext &ctx = module.getContext();
+    IRBuilder<> B(ctx);
+
+    auto i32 = Type::getInt32Ty(ctx);
+
+    auto fn = Function::Create(FunctionType::get(i32, {i32, i32, i32}, false),
+                               Function::ExternalLinkage, "mul_add", module);
+
+    Function::arg_iterator args = fn->arg_begin();
+    Value *x = args++;
+    x->setName("x");
+    Value *y = args++;
+    y->setName("y");
+    Value *z = args++;
+    z->setName("z");
+
+    B.SetInsertPoint(BasicBlock::Create(ctx, "entry", fn));
+    B.CreateRet(B.CreateAdd(B.CreateMul(x, y), z));
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyModule(module, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Module verification failed: %s",
+                                 es.str().c_str());
+
+    return Error::success();
+}
+
+std::unique_ptr<JitEngine> TheJIT;
+static ExitOnError ExitOnErr;
+
+template <typename Fn_t>
+double timeMs(Fn_t Fn)
+{
+    auto Begin = std::chrono::steady_clock::now();
+    Fn();
+    std::chrono::duration<double, std::milli> Elapsed =
+        std::chrono::steady_clock::now() - Begin;
+    return Elapsed.count();
+}
+
+int main(int argc, char **argv)
+{
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+
+    TheJIT = ExitOnErr(JitEngine::Create());
+
+    // The wrapper is built from the IR of mul_add's module
+    TheJIT->setRetainIR(true);
+
+    auto module = std::make_unique<Module>("BatchJIT", TheJIT->getContext());
+    module->setDataLayout(TheJIT->getDataLayout());
+
+    ExitOnErr(codegenIR(*module));
+    ExitOnErr(TheJIT->addModule(std::move(module)));
+
+    auto mul_add = ExitOnErr(
+        TheJIT->getFunction<int32_t(int32_t, int32_t, int32_t)>("mul_add"));
+
+    auto mul_add_batch = ExitOnErr(
+        getBatchFunction<int32_t(int32_t, int32_t, int32_t)>(
+            *TheJIT, TheJIT->getDefaultTenant(), "mul_add",
+            TheJIT->createModuleKey()));
+
+    std::vector<int32_t> Xs(NumRows), Ys(NumRows), Zs(NumRows);
+    std::vector<int32_t> RowOut(NumRows), BatchOut(NumRows);
+
+    for (size_t i = 0; i < NumRows; i++)
+    {
+        Xs[i] = int32_t(i % 1000);
+        Ys[i] = int32_t(i % 7) - 3;
+        Zs[i] = int32_t(i);
+    }
+
+    double RowMs = timeMs([&]() {
+        for (size_t i = 0; i < NumRows; i++)
+            RowOut[i] = mul_add(Xs[i], Ys[i], Zs[i]);
+    });
+
+    double BatchMs = timeMs([&]() {
+        mul_add_batch(Xs.data(), Ys.data(), Zs.data(), BatchOut.data(), NumRows);
+    });
+
+    std::cout << "per row: " << RowMs << " ms, batch: " << BatchMs << " ms, "
+              << (RowOut == BatchOut ? "same results" : "DIFFERENT results")
+              << std::endl;
+
+    return RowOut == BatchOut ? 0 : 1;
+}
@@ -0,0 +1,157 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "JitEngine.h"
+
+using namespace llvm;
+
+/**
+ * Lookup throughput benchmark
+ *
+ * Compiles a module with NumFunctions trivial functions and then resolves
+ * them by name from an increasing number of threads, with and without the
+ * engine's symbol cache. With the cache, throughput should scale linearly
+ * with the number of threads; without it every lookup goes through the
+ * execution session lock.
+ */
+
+static const unsigned NumFunctions = 256;
+static const unsigned LookupsPerThread = 200000;
+
+Error codegenIR(Module &module, std::vector<std::string> &Names)
+{
+
+    LLVMContext &ctx = module.getContext();
+    IRBuilder<> B(ctx);
+
+    auto signature = FunctionType::get(Type::getInt32Ty(ctx), {}, false);
+
+    for (unsigned i = 0; i < NumFunctions; i++)
+    {
+        std::string name = "fn" + std::to_string(i);
+
+        auto fn = Function::Create(signature, Function::ExternalLinkage,
+                                   name, module);
+
+        B.SetInsertPoint(BasicBlock::Create(ctx, "entry", fn));
+        B.CreateRet(ConstantInt::get(Type::getInt32Ty(ctx), i));
+
+        Names.push_back(name);
+    }
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyModule(module, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Module verification failed: %s",
+                                 es.str().c_str());
+
+    return Error::success();
+}
+
+double runLookups(JitEngine &JIT, const std::vector<std::string> &Names,
+                  unsigned NumThreads)
+{
+    std::atomic<bool> Start(false);
+    std::atomic<unsigned> Failures(0);
+    std::vector<std::thread> Threads;
+
+    for (unsigned t = 0; t < NumThreads; t++)
+    {
+        Threads.emplace_back([&, t]() {
+            while (!Start.load(std::memory_order_acquire))
+                std::this_thread::yield();
+
+            for (unsigned i = 0; i < LookupsPerThread; i++)
+            {
+                const std::string &Name = Names[(i + t) % Names.size()];
+                auto F = JIT.getFunction<int32_t()>(Name);
+                if (!F)
+                {
+                    consumeError(F.takeError());
+                    Failures++;
+                }
+            }
+        });
+    }
+
+    auto Begin = std::chrono::steady_clock::now();
+    Start.store(true, std::memory_order_release);
+
+    for (auto &T : Threads)
+        T.join();
+
+    std::chrono::duration<double> Elapsed =
+        std::chrono::steady_clock::now() - Begin;
+
+    if (Failures)
+        std::cerr << Failures << " lookups failed" << std::endl;
+
+    return (double)NumThreads * LookupsPerThread / Elapsed.count();
+}
+
+std::unique_ptr<JitEngine> TheJIT;
+static ExitOnError ExitOnErr;
+
+int main(int argc, char **argv)
+{
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+
+    PassRegistry &Registry = *PassRegistry::getPassRegistry();
+    initializeCoroutines(Registry);
+
+    TheJIT = ExitOnErr(JitEngine::Create());
+
+    auto module = std::make_unique<Module>("LookupBench", TheJIT->getContext());
+    module->setDataLayout(TheJIT->getDataLayout());
+
+    std::vector<std::string> Names;
+    ExitOnErr(codegenIR(*module, Names));
+
+    ExitOnErr(TheJIT->addModule(std::move(module)));
+
+    // Materialize everything up front so that only lookups are measured.
+    for (const std::string &Name : Names)
+        ExitOnErr(TheJIT->getFunction<int32_t()>(Name));
+
+    unsigned MaxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::cout << "threads\tcached (lookups/s)\tuncached (lookups/s)" << std::endl;
+
+    for (unsigned NumThreads = 1; NumThreads <= MaxThreads; NumThreads *= 2)
+    {
+        TheJIT->setSymbolCacheEnabled(true);
+        double Cached = runLookups(*TheJIT, Names, NumThreads);
+
+        TheJIT->setSymbolCacheEnabled(false);
+        double Uncached = runLookups(*TheJIT, Names, NumThreads);
+
+        std::cout << NumThreads << "\t" << (uint64_t)Cached << "\t\t\t"
+                  << (uint64_t)Uncached << std::endl;
+    }
+
+    return 0;
+}
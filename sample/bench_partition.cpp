@@ -0,0 +1,156 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "JitEngine.h"
+
+using namespace llvm;
+
+/**
+ * Partitioned compilation benchmark
+ *
+ * Generates one large module of NumFunctions functions, each a loop over a
+ * chain of arithmetic, and measures how long it takes to compile all of it
+ * with the module split into as many partitions as there are compile
+ * threads. Every function calls the next one, so that partitions have to
+ * link against each other.
+ */
+
+static const unsigned NumFunctions = 2048;
+static const unsigned ChainLength = 64;
+
+Error codegenIR(Module &module)
+{
+
+    LLVMContext &ctx = module.getContext();
+    IRBuilder<> B(ctx);
+
+    auto i64 = Type::getInt64Ty(ctx);
+    auto signature = FunctionType::get(i64, {i64}, false);
+
+    std::vector<Function *> Fns;
+
+    for (unsigned i = 0; i < NumFunctions; i++)
+        Fns.push_back(Function::Create(signature, Function::ExternalLinkage,
+                                       "fn" + std::to_string(i), module));
+
+    for (unsigned i = 0; i < NumFunctions; i++)
+    {
+        Function *fn = Fns[i];
+        Value *n = fn->arg_begin();
+
+        auto entry = BasicBlock::Create(ctx, "entry", fn);
+        auto loop = BasicBlock::Create(ctx, "loop", fn);
+        auto exit = BasicBlock::Create(ctx, "exit", fn);
+
+        B.SetInsertPoint(entry);
+        B.CreateBr(loop);
+
+        B.SetInsertPoint(loop);
+        PHINode *iv = B.CreatePHI(i64, 2, "iv");
+        PHINode *acc = B.CreatePHI(i64, 2, "acc");
+
+        Value *v = acc;
+        for (unsigned j = 0; j < ChainLength; j++)
+        {
+            v = B.CreateMul(v, ConstantInt::get(i64, 2 * j + 3));
+            v = B.CreateXor(v, B.CreateLShr(v, ConstantInt::get(i64, j % 7 + 1)));
+            v = B.CreateAdd(v, iv);
+        }
+
+        Value *next = B.CreateAdd(iv, ConstantInt::get(i64, 1));
+        iv->addIncoming(ConstantInt::get(i64, 0), entry);
+        iv->addIncoming(next, loop);
+        acc->addIncoming(ConstantInt::get(i64, i), entry);
+        acc->addIncoming(v, loop);
+        B.CreateCondBr(B.CreateICmpULT(next, n), loop, exit);
+
+        B.SetInsertPoint(exit);
+        if (i + 1 < NumFunctions)
+            v = B.CreateAdd(v, B.CreateCall(Fns[i + 1], {ConstantInt::get(i64, 1)}));
+        B.CreateRet(v);
+    }
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyModule(module, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Module verification failed: %s",
+                                 es.str().c_str());
+
+    return Error::success();
+}
+
+static ExitOnError ExitOnErr;
+
+double compileModule(unsigned NumThreads)
+{
+    auto JIT = ExitOnErr(JitEngine::Create());
+
+    ExitOnErr(JIT->setCompileThreads(NumThreads));
+    JIT->setModulePartitioning(NumThreads, 0);
+
+    auto module = std::make_unique<Module>("PartitionBench", JIT->getContext());
+    module->setDataLayout(JIT->getDataLayout());
+
+    ExitOnErr(codegenIR(*module));
+
+    auto Begin = std::chrono::steady_clock::now();
+
+    auto K = JIT->createModuleKey();
+    ExitOnErr(JIT->addModule(JIT->getDefaultTenant(), std::move(module), K));
+    ExitOnErr(JIT->compileModule(K));
+
+    std::chrono::duration<double> Elapsed =
+        std::chrono::steady_clock::now() - Begin;
+
+    auto fn0 = ExitOnErr(JIT->getFunction<int64_t(int64_t)>("fn0"));
+    fn0(1);
+
+    return Elapsed.count();
+}
+
+int main(int argc, char **argv)
+{
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+
+    unsigned MaxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::cout << "threads\tcompile (s)\tspeedup" << std::endl;
+
+    double Serial = 0;
+
+    for (unsigned NumThreads = 1; NumThreads <= MaxThreads; NumThreads *= 2)
+    {
+        double Seconds = compileModule(NumThreads);
+
+        if (NumThreads == 1)
+            Serial = Seconds;
+
+        std::cout << NumThreads << "\t" << Seconds << "\t\t"
+                  << Serial / Seconds << std::endl;
+    }
+
+    return 0;
+}
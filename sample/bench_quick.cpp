@@ -0,0 +1,162 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "JitEngine.h"
+
+using namespace llvm;
+
+/**
+ * Quick compile benchmark
+ *
+ * Compiles and runs once a query of increasing size, a loop over an array
+ * with a chain of arithmetic per element, in the optimized and in the quick
+ * compile mode. For small queries over little data, compiling dominates
+ * and the quick mode should win; as the data grows, optimized code pays
+ * for itself.
+ */
+
+static const unsigned ChainLengths[] = {16, 128, 1024, 8192};
+static const unsigned NumRows = 4096;
+
+Error codegenIR(Module &module, StringRef name, unsigned ChainLength)
+{
+
+    LLVMContext &ctx = module.getContext();
+    IRBuilder<> B(ctx);
+
+    auto i64 = Type::getInt64Ty(ctx);
+    auto signature = FunctionType::get(i64, {i64->getPointerTo(), i64}, false);
+
+    auto fn = Function::Create(signature, Function::ExternalLinkage, name, module);
+
+    Function::arg_iterator args = fn->arg_begin();
+    Value *data = args++;
+    data->setName("data");
+    Value *n = args++;
+    n->setName("n");
+
+    BasicBlock *entry = BasicBlock::Create(ctx, "entry", fn);
+    BasicBlock *loop = BasicBlock::Create(ctx, "loop", fn);
+    BasicBlock *exit = BasicBlock::Create(ctx, "exit", fn);
+
+    B.SetInsertPoint(entry);
+    B.CreateBr(loop);
+
+    B.SetInsertPoint(loop);
+    PHINode *i = B.CreatePHI(i64, 2, "i");
+    PHINode *acc = B.CreatePHI(i64, 2, "acc");
+
+    Value *v = B.CreateLoad(B.CreateGEP(data, i));
+    for (unsigned j = 0; j < ChainLength; j++)
+    {
+        v = B.CreateMul(v, ConstantInt::get(i64, 2 * j + 3));
+        v = B.CreateXor(v, B.CreateLShr(v, ConstantInt::get(i64, j % 7 + 1)));
+    }
+
+    Value *sum = B.CreateAdd(acc, v, "sum");
+    Value *next = B.CreateAdd(i, ConstantInt::get(i64, 1), "next");
+
+    i->addIncoming(ConstantInt::get(i64, 0), entry);
+    i->addIncoming(next, loop);
+    acc->addIncoming(ConstantInt::get(i64, 0), entry);
+    acc->addIncoming(sum, loop);
+    B.CreateCondBr(B.CreateICmpULT(next, n), loop, exit);
+
+    B.SetInsertPoint(exit);
+    B.CreateRet(sum);
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyModule(module, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Module verification failed: %s",
+                                 es.str().c_str());
+
+    return Error::success();
+}
+
+std::unique_ptr<JitEngine> TheJIT;
+static ExitOnError ExitOnErr;
+
+/// Milliseconds to compile and run the query once
+double runOnce(unsigned ChainLength, CompileMode Mode,
+               const std::vector<int64_t> &Rows)
+{
+    static unsigned NextId = 0;
+    std::string Name = "query" + std::to_string(NextId++);
+
+    auto module = std::make_unique<Module>(Name, TheJIT->getContext());
+    module->setDataLayout(TheJIT->getDataLayout());
+
+    ExitOnErr(codegenIR(*module, Name, ChainLength));
+
+    auto Begin = std::chrono::steady_clock::now();
+
+    auto K = TheJIT->createModuleKey();
+    ExitOnErr(TheJIT->addModule(TheJIT->getDefaultTenant(), std::move(module),
+                                K, Mode));
+
+    auto Query = ExitOnErr(
+        TheJIT->getFunction<int64_t(const int64_t *, int64_t)>(Name));
+    volatile int64_t Result = Query(Rows.data(), Rows.size());
+    (void)Result;
+
+    std::chrono::duration<double, std::milli> Elapsed =
+        std::chrono::steady_clock::now() - Begin;
+
+    ExitOnErr(TheJIT->removeModule(K));
+
+    return Elapsed.count();
+}
+
+int main(int argc, char **argv)
+{
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+
+    PassRegistry &Registry = *PassRegistry::getPassRegistry();
+    initializeCoroutines(Registry);
+
+    TheJIT = ExitOnErr(JitEngine::Create());
+
+    std::vector<int64_t> Rows(NumRows);
+    for (unsigned i = 0; i < NumRows; i++)
+        Rows[i] = i;
+
+    // Warm up the code generator
+    runOnce(ChainLengths[0], CompileMode::Optimized, Rows);
+    runOnce(ChainLengths[0], CompileMode::Quick, Rows);
+
+    std::cout << "chain\toptimized (ms)\tquick (ms)" << std::endl;
+
+    for (unsigned ChainLength : ChainLengths)
+    {
+        double Optimized = runOnce(ChainLength, CompileMode::Optimized, Rows);
+        double Quick = runOnce(ChainLength, CompileMode::Quick, Rows);
+
+        std::cout << ChainLength << "\t" << Optimized << "\t\t" << Quick
+                  << std::endl;
+    }
+
+    return 0;
+}
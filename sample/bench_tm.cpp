@@ -0,0 +1,122 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <memory>
+#include <iostream>
+#include <string>
+
+#include "JitEngine.h"
+
+using namespace llvm;
+
+/**
+ * Target machine reuse benchmark
+ *
+ * Adds and compiles, one at a time, many small modules of a single
+ *
+ *     int64_t f_<i>(int64_t x) { return x * i + 1; }
+ *
+ * with a new target machine per module and with pooled target machines,
+ * and reports the mean latency per module. For modules this small,
+ * creating the target machine is a good part of compiling them.
+ */
+
+static const unsigned NumModules = 500;
+
+Error codegenIR(Module &module, unsigned i)
+{
+
+    LLVMContext &ctx = module.getContext();
+    IRBuilder<> B(ctx);
+
+    auto i64 = Type::getInt64Ty(ctx);
+
+    auto fn = Function::Create(FunctionType::get(i64, {i64}, false),
+                               Function::ExternalLinkage,
+                               "f_" + std::to_string(i), module);
+
+    Value *x = fn->arg_begin();
+    x->setName("x");
+
+    B.SetInsertPoint(BasicBlock::Create(ctx, "entry", fn));
+    B.CreateRet(B.CreateAdd(B.CreateMul(x, B.getInt64(i)), B.getInt64(1)));
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyModule(module, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Module verification failed: %s",
+                                 es.str().c_str());
+
+    return Error::success();
+}
+
+std::unique_ptr<JitEngine> TheJIT;
+static ExitOnError ExitOnErr;
+
+/// Add and compile module i, and return how long it took
+double compileOne(unsigned i)
+{
+    auto module = std::make_unique<Module>("TMJIT" + std::to_string(i),
+                                           TheJIT->getContext());
+    module->setDataLayout(TheJIT->getDataLayout());
+
+    ExitOnErr(codegenIR(*module, i));
+
+    auto K = TheJIT->createModuleKey();
+    auto Begin = std::chrono::steady_clock::now();
+
+    ExitOnErr(TheJIT->addModule(TheJIT->getDefaultTenant(), std::move(module), K));
+    ExitOnErr(TheJIT->compileModule(K));
+
+    std::chrono::duration<double, std::micro> Elapsed =
+        std::chrono::steady_clock::now() - Begin;
+
+    ExitOnErr(TheJIT->removeModule(K));
+    return Elapsed.count();
+}
+
+int main(int argc, char **argv)
+{
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+
+    TheJIT = ExitOnErr(JitEngine::Create());
+
+    unsigned Next = 0;
+
+    for (bool Reuse : {false, true})
+    {
+        TheJIT->setTargetMachineReuse(Reuse);
+
+        // Warm up the caches and, with reuse, the pool
+        compileOne(Next++);
+
+        unsigned Created = TheJIT->getNumTargetMachines();
+        double Total = 0;
+
+        for (unsigned i = 0; i < NumModules; i++)
+            Total += compileOne(Next++);
+
+        std::cout << (Reuse ? "pooled" : "per module") << ": "
+                  << Total / NumModules << " us per module, "
+                  << TheJIT->getNumTargetMachines() - Created
+                  << " target machines created" << std::endl;
+    }
+
+    return 0;
+}
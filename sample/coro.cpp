@@ -17,6 +17,7 @@
 #include <fstream>
 #include <iostream>
 
+#include "CoroDriver.h"
 #include "JitEngine.h"
 
 using namespace llvm;
@@ -148,15 +149,8 @@ Expected<std::string> codegenIR(Module &module)
     Value * id = B.CreateCall(Intrinsic::getDeclaration(
         &module, Intrinsic::coro_id), coro_id_args, "id");
     
-    // %size = call i32 @llvm.coro.size.i32()
-    Value * size = B.CreateCall(Intrinsic::getDeclaration(
-        &module, Intrinsic::coro_size, Type::getInt32Ty(ctx)), {}, "size");
-
-    // %alloc = call i8* @malloc(i32 %size)
-    Value * alloc = B.CreateCall(
-    module.getOrInsertFunction("malloc",
-      FunctionType::get(
-          Type::getInt8PtrTy(ctx), Type::getInt32Ty(ctx), false)), size, "alloc");
+    // Allocate the frame with malloc, unless the caller has elided it
+    Value * alloc = emitCoroFrameAlloc(B, module, id);
 
     // %hdl = call noalias i8* @llvm.coro.begin(token %id, i8* %alloc)
     Value * hdl =
@@ -210,15 +204,8 @@ Expected<std::string> codegenIR(Module &module)
     // Start introducing instructions into the "cleanup" basic block
     B.SetInsertPoint(cleanup);
 
-    // %mem = call i8 * @llvm.coro.free()
-    Value * mem = B.CreateCall(Intrinsic::getDeclaration(
-        &module, Intrinsic::coro_free), {id, hdl}, "mem");
-
-    // call void @free(i8* %mem)
-    B.CreateCall(
-    module.getOrInsertFunction("free",
-      FunctionType::get(
-          Type::getVoidTy(ctx), Type::getInt8PtrTy(ctx), false)), mem);
+    // call void @free(i8* @llvm.coro.free(token %id, i8* %hdl))
+    emitCoroFrameFree(B, module, id, hdl);
 
     // br label %suspend
     B.CreateBr(suspend);
@@ -270,6 +257,10 @@ int main(int argc, char **argv)
 
     TheJIT = ExitOnErr(JitEngine::Create());
 
+    // The only libc functions the JIT code calls, besides those code
+    // generation may introduce; anything else is an error
+    ExitOnErr(TheJIT->setHostSymbolTable({"malloc", "free"}));
+
     // Add local absolute symbol
     TheJIT->defineAbsolute("print",
         JITEvaluatedSymbol((JITTargetAddress)print, JITSymbolFlags::Exported));
@@ -281,6 +272,15 @@ int main(int argc, char **argv)
 
     std::string JitedFnName = ExitOnErr(codegenIR(*module));
 
+    // JIT compiled loop that drives coro_inc; its frame can live on the stack
+    ExitOnErr(emitCoroDriver(*module, *module->getFunction(JitedFnName),
+                             "coro_run"));
+
+    TheJIT->setCoroElisionHandler([](const CoroElisionReport &Report) {
+        std::cout << Report.Driver << ": frame of " << Report.Coroutine
+                  << (Report.Elided ? " elided" : " on the heap") << std::endl;
+    });
+
     ExitOnErr(TheJIT->addModule(std::move(module)));
 
     // Request function; this compiles to machine code and links.
@@ -299,6 +299,11 @@ int main(int argc, char **argv)
         coro_resume(hdl);
     }
     coro_destroy(hdl);  
+
+    auto coro_run =
+        ExitOnErr(TheJIT->getFunction<void (int32_t)>("coro_run"));
+
+    coro_run(16384);
     
     return 0;
 }
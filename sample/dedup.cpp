@@ -0,0 +1,202 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstdint>
+#include <memory>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include "JitEngine.h"
+
+using namespace llvm;
+using namespace llvm::orc;
+
+/**
+ * Function deduplication across module removal
+ *
+ * Modules A, B and C each define the same two functions under their own
+ * names:
+ *
+ *     int64_t poly_<m>(int64_t x) { return helper(x) * x * 3 + 7; }
+ *     int64_t mix_<m>(int64_t x)  { return ((x * x) ^ (x >> 3)) + 11; }
+ *
+ * where helper comes from a module of its own. B is reduced to thunks to
+ * A's code. Then helper is replaced, so C's poly must be compiled afresh,
+ * while its mix still shares A's code. A is removed while B and C still
+ * jump to its code, which is only freed once they are removed too.
+ */
+
+/// Counts the objects whose code is freed
+class FreeListener : public JITEventListener
+{
+
+public:
+    void notifyObjectLoaded(ObjectKey, const object::ObjectFile &,
+                            const RuntimeDyld::LoadedObjectInfo &) override {}
+
+    void notifyFreeingObject(ObjectKey K) override
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Freed.insert(K);
+    }
+
+    bool isFreed(ObjectKey K)
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        return Freed.count(K);
+    }
+
+private:
+    std::mutex Mutex;
+    std::set<ObjectKey> Freed;
+};
+
+/// int64_t helper(int64_t x) { return x + Offset; }
+void codegenHelper(Module &module, int64_t Offset)
+{
+
+    LLVMContext &ctx = module.getContext();
+    IRBuilder<> B(ctx);
+
+    auto i64 = Type::getInt64Ty(ctx);
+    auto fn = Function::Create(FunctionType::get(i64, {i64}, false),
+                               Function::ExternalLinkage, "helper", module);
+
+    B.SetInsertPoint(BasicBlock::Create(ctx, "entry", fn));
+    B.CreateRet(B.CreateAdd(fn->arg_begin(), B.getInt64(Offset)));
+}
+
+/// poly_<Suffix> and mix_<Suffix>
+Error codegenIR(Module &module, StringRef Suffix)
+{
+
+    LLVMContext &ctx = module.getContext();
+    IRBuilder<> B(ctx);
+
+    auto i64 = Type::getInt64Ty(ctx);
+    auto signature = FunctionType::get(i64, {i64}, false);
+
+    FunctionCallee helper = module.getOrInsertFunction("helper", signature);
+
+    auto poly = Function::Create(signature, Function::ExternalLinkage,
+                                 "poly_" + Suffix, module);
+    Value *x = poly->arg_begin();
+
+    B.SetInsertPoint(BasicBlock::Create(ctx, "entry", poly));
+    Value *h = B.CreateCall(helper, {x});
+    B.CreateRet(B.CreateAdd(B.CreateMul(B.CreateMul(h, x), B.getInt64(3)),
+                            B.getInt64(7)));
+
+    auto mix = Function::Create(signature, Function::ExternalLinkage,
+                                "mix_" + Suffix, module);
+    x = mix->arg_begin();
+
+    B.SetInsertPoint(BasicBlock::Create(ctx, "entry", mix));
+    B.CreateRet(B.CreateAdd(B.CreateXor(B.CreateMul(x, x),
+                                        B.CreateAShr(x, B.getInt64(3))),
+                            B.getInt64(11)));
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyModule(module, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Module verification failed: %s",
+                                 es.str().c_str());
+
+    return Error::success();
+}
+
+std::unique_ptr<JitEngine> TheJIT;
+static ExitOnError ExitOnErr;
+
+static VModuleKey addHelper(int64_t Offset)
+{
+    auto module = std::make_unique<Module>("helper", TheJIT->getContext());
+    module->setDataLayout(TheJIT->getDataLayout());
+    codegenHelper(*module, Offset);
+
+    VModuleKey K = TheJIT->createModuleKey();
+    ExitOnErr(TheJIT->addModule(TheJIT->getDefaultTenant(), std::move(module), K));
+    return K;
+}
+
+/// Add the module of Suffix, and call both its functions with 5.
+static VModuleKey addAndCall(StringRef Suffix)
+{
+    auto module = std::make_unique<Module>(Suffix, TheJIT->getContext());
+    module->setDataLayout(TheJIT->getDataLayout());
+    ExitOnErr(codegenIR(*module, Suffix));
+
+    VModuleKey K = TheJIT->createModuleKey();
+    ExitOnErr(TheJIT->addModule(TheJIT->getDefaultTenant(), std::move(module), K));
+
+    auto poly = ExitOnErr(TheJIT->getFunction<int64_t(int64_t)>("poly_" + Suffix.str()));
+    auto mix = ExitOnErr(TheJIT->getFunction<int64_t(int64_t)>("mix_" + Suffix.str()));
+
+    std::cout << "poly_" << Suffix.str() << "(5) = " << poly(5) << ", mix_"
+              << Suffix.str() << "(5) = " << mix(5) << ", deduplicated so far: "
+              << TheJIT->getDeduplicator().getNumDeduplicated() << std::endl;
+
+    return K;
+}
+
+int main(int argc, char **argv)
+{
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+
+    TheJIT = ExitOnErr(JitEngine::Create());
+
+    FreeListener Listener;
+    TheJIT->addEventListener(Listener);
+
+    FunctionDeduplicator &Dedup = TheJIT->getDeduplicator();
+    Dedup.setEnabled(true);
+    Dedup.setMinInstructions(4);
+
+    VModuleKey Helper = addHelper(1);
+
+    VModuleKey A = addAndCall("a");
+
+    // Both functions become thunks to A's code.
+    VModuleKey B = addAndCall("b");
+
+    // A and B now call a helper that is gone, and are not called again.
+    ExitOnErr(TheJIT->removeModule(Helper));
+    addHelper(100);
+
+    // poly is compiled against the new helper; mix is still A's.
+    VModuleKey C = addAndCall("c");
+
+    ExitOnErr(TheJIT->removeModule(A));
+    std::cout << "A removed, its code freed: " << Listener.isFreed(A) << std::endl;
+
+    auto mix_b = ExitOnErr(TheJIT->getFunction<int64_t(int64_t)>("mix_b"));
+    std::cout << "mix_b(6) = " << mix_b(6) << std::endl;
+
+    ExitOnErr(TheJIT->removeModule(B));
+    std::cout << "B removed, A's code freed: " << Listener.isFreed(A) << std::endl;
+
+    ExitOnErr(TheJIT->removeModule(C));
+    std::cout << "C removed, A's code freed: " << Listener.isFreed(A) << std::endl;
+
+    TheJIT->removeEventListener(Listener);
+
+    return 0;
+}
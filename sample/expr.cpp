@@ -0,0 +1,64 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <functional>
+#include <memory>
+#include <iostream>
+
+#include "ExpressionCache.h"
+#include "JitEngine.h"
+
+using namespace llvm;
+
+std::unique_ptr<JitEngine> TheJIT;
+static ExitOnError ExitOnErr;
+
+int main(int argc, char **argv)
+{
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+
+    PassRegistry &Registry = *PassRegistry::getPassRegistry();
+    initializeCoroutines(Registry);
+
+    TheJIT = ExitOnErr(JitEngine::Create());
+
+    ExpressionCache Cache(*TheJIT, 2, 32);
+
+    // The same mul_add as sample/simple.cpp, written three different ways:
+    // only the first one is compiled.
+    auto mul_add = ExitOnErr(Cache.get<int32_t(int32_t, int32_t, int32_t)>(
+        "x * y + z", {"x", "y", "z"}));
+    auto mul_add2 = ExitOnErr(Cache.get<int32_t(int32_t, int32_t, int32_t)>(
+        "c + b * a", {"b", "a", "c"}));
+    auto mul_add3 = ExitOnErr(Cache.get<int32_t(int32_t, int32_t, int32_t)>(
+        "(x * y) + (z + 2 - 2)", {"x", "y", "z"}));
+
+    std::cout << "23 * 80 + 90 = " << mul_add(23, 80, 90) << std::endl;
+    std::cout << "23 * 80 + 90 = " << mul_add2(23, 80, 90) << std::endl;
+    std::cout << "23 * 80 + 90 = " << mul_add3(23, 80, 90) << std::endl;
+
+    // Two more expressions overflow the capacity of two and unload the
+    // least recently used one.
+    auto sq = ExitOnErr(Cache.get<int32_t(int32_t)>("x * x", {"x"}));
+    auto lin = ExitOnErr(Cache.get<int32_t(int32_t)>("3 * x - 1", {"x"}));
+
+    std::cout << "7 * 7 = " << sq(7) << std::endl;
+    std::cout << "3 * 7 - 1 = " << lin(7) << std::endl;
+
+    std::cout << "hits: " << Cache.getNumHits()
+              << ", misses: " << Cache.getNumMisses()
+              << ", cached: " << Cache.size() << std::endl;
+
+    // Nothing is materializing here, so every eviction unloads its module.
+    ExitOnErr(Cache.takeEvictionError());
+
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <iostream>
+#include <vector>
+
+#include "ArrayKernels.h"
+#include "JitEngine.h"
+
+using namespace llvm;
+
+struct Point {
+    int32_t x;
+    int32_t y;
+};
+
+/**
+ * 
+ * The following function generates three kernels over runtime-length
+ * arrays of points:
+ * 
+ * int32_t sum_x(const struct Point *points, uint64_t n);
+ *
+ * void dist(const struct Point *points, int32_t *out, uint64_t n);
+ *     out[i] = |points[i].x - points[i].y|
+ *
+ * uint64_t above(void *const *columns, uint64_t *indices, uint64_t n);
+ *     Indices of the points with x > y, with the points stored as two
+ *     columns (SoA).
+ */ 
+
+Error codegenIR(Module &module)
+{
+
+    LLVMContext &ctx = module.getContext();
+
+    auto pointStr = StructType::create(ctx, 
+        { Type::getInt32Ty(ctx), Type::getInt32Ty(ctx) }, "pointStr");
+
+    ArrayKernelBuilder AoS(module, RecordLayout::aos(pointStr));
+
+    auto sum_x = AoS.createReduce("sum_x", Type::getInt32Ty(ctx),
+        ArrayKernelBuilder::Add,
+        [](IRBuilder<> &B, ArrayRef<Value *> Fields) { return Fields[0]; });
+
+    if (!sum_x)
+        return sum_x.takeError();
+
+    auto dist = AoS.createMap("dist", Type::getInt32Ty(ctx),
+        [](IRBuilder<> &B, ArrayRef<Value *> Fields) {
+            Value * diff = B.CreateSub(Fields[0], Fields[1]);
+            Value * neg = B.CreateNeg(diff);
+            return B.CreateSelect(B.CreateICmpSLT(diff, neg), neg, diff);
+        });
+
+    if (!dist)
+        return dist.takeError();
+
+    ArrayKernelBuilder SoA(module, RecordLayout::soa(pointStr));
+    SoA.setAlignment(32);
+
+    auto above = SoA.createFilter("above",
+        [](IRBuilder<> &B, ArrayRef<Value *> Fields) {
+            return B.CreateICmpSGT(Fields[0], Fields[1]);
+        });
+
+    if (!above)
+        return above.takeError();
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyModule(module, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Module verification failed: %s",
+                                 es.str().c_str());
+
+    return Error::success();
+}
+
+std::unique_ptr<JitEngine> TheJIT;
+static ExitOnError ExitOnErr;
+
+int main(int argc, char **argv)
+{
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+
+    PassRegistry &Registry = *PassRegistry::getPassRegistry();
+    initializeCoroutines(Registry);
+
+    TheJIT = ExitOnErr(JitEngine::Create());
+
+    // Record what the optimizer did to the kernels
+    TheJIT->getDiagnostics().setRemarksEnabled(true);
+    TheJIT->getDiagnostics().setPassTimingEnabled(true);
+
+    auto module = std::make_unique<Module>("Kernels", TheJIT->getContext());
+    module->setDataLayout(TheJIT->getDataLayout());
+
+    ExitOnErr(codegenIR(*module));
+
+    ExitOnErr(TheJIT->addModule(std::move(module)));
+
+    auto sum_x =
+        ExitOnErr(TheJIT->getFunction<int32_t(const Point *, uint64_t)>("sum_x"));
+    auto dist =
+        ExitOnErr(TheJIT->getFunction<void(const Point *, int32_t *, uint64_t)>("dist"));
+    auto above =
+        ExitOnErr(TheJIT->getFunction<uint64_t(void *const *, uint64_t *, uint64_t)>("above"));
+
+    // An odd length exercises the remainder loop.
+    const uint64_t n = 1000003;
+
+    std::vector<Point> points(n);
+    for (uint64_t i = 0; i < n; i++)
+        points[i] = { (int32_t)(i % 17), (int32_t)(i % 11) };
+
+    std::vector<int32_t> d(n);
+    dist(points.data(), d.data(), n);
+
+    std::cout << "sum_x = " << sum_x(points.data(), n) << std::endl;
+    std::cout << "dist[16] = " << d[16] << std::endl;
+
+    int32_t * xs = static_cast<int32_t *>(aligned_alloc(32, (n * 4 + 31) & ~31));
+    int32_t * ys = static_cast<int32_t *>(aligned_alloc(32, (n * 4 + 31) & ~31));
+    for (uint64_t i = 0; i < n; i++) {
+        xs[i] = points[i].x;
+        ys[i] = points[i].y;
+    }
+
+    void * columns[] = { xs, ys };
+    std::vector<uint64_t> indices(n);
+
+    std::cout << "above = " << above(columns, indices.data(), n) << std::endl;
+
+    free(xs);
+    free(ys);
+
+    std::error_code EC;
+    raw_fd_ostream diagnostics("kernels-diagnostics.json", EC);
+
+    if (!EC)
+        TheJIT->getDiagnostics().writeJSON(diagnostics);
+
+    return 0;
+}
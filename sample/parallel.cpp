@@ -0,0 +1,173 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <memory>
+#include <iostream>
+#include <vector>
+
+#include "JitEngine.h"
+#include "ParallelFor.h"
+
+using namespace llvm;
+
+/**
+ * Parallel loops
+ *
+ * Generates
+ *
+ *     void   scale(double *data, uint64_t n, double k, uint64_t grain)
+ *     double sum_squares(const double *data, uint64_t n, uint64_t grain)
+ *
+ * whose loops run on the parallel-for runtime, and times them with a grain
+ * of n, which runs the whole loop on the calling thread, and with a grain
+ * small enough to spread it over every core.
+ */
+
+static const uint64_t N = 1 << 25;
+static const uint64_t Grain = 1 << 14;
+
+Error codegenIR(Module &module)
+{
+
+    LLVMContext &ctx = module.getContext();
+    IRBuilder<> B(ctx);
+
+    auto i64 = Type::getInt64Ty(ctx);
+    auto dbl = Type::getDoubleTy(ctx);
+
+    // void scale(double *data, uint64_t n, double k, uint64_t grain)
+    auto scale = Function::Create(
+        FunctionType::get(B.getVoidTy(), {dbl->getPointerTo(), i64, dbl, i64},
+                          false),
+        Function::ExternalLinkage, "scale", module);
+
+    Function::arg_iterator args = scale->arg_begin();
+    Value *data = args++;
+    Value *n = args++;
+    Value *k = args++;
+    Value *grain = args++;
+
+    B.SetInsertPoint(BasicBlock::Create(ctx, "entry", scale));
+
+    // data[i] = data[i] * k
+    auto Scale = [&](IRBuilder<> &B, Value *I, ArrayRef<Value *> Captured) {
+        Value *ptr = B.CreateGEP(Captured[0], I);
+        B.CreateStore(B.CreateFMul(B.CreateLoad(ptr), Captured[1]), ptr);
+    };
+
+    if (auto Err = emitParallelFor(B, "scale.body", B.getInt64(0), n, grain,
+                                   {data, k}, Scale).takeError())
+        return Err;
+
+    B.CreateRetVoid();
+
+    // double sum_squares(const double *data, uint64_t n, uint64_t grain)
+    auto sumSquares = Function::Create(
+        FunctionType::get(dbl, {dbl->getPointerTo(), i64, i64}, false),
+        Function::ExternalLinkage, "sum_squares", module);
+
+    args = sumSquares->arg_begin();
+    data = args++;
+    n = args++;
+    grain = args++;
+
+    B.SetInsertPoint(BasicBlock::Create(ctx, "entry", sumSquares));
+
+    // acc + data[i] * data[i]
+    auto Square = [&](IRBuilder<> &B, Value *I, Value *Acc,
+                      ArrayRef<Value *> Captured) {
+        Value *x = B.CreateLoad(B.CreateGEP(Captured[0], I));
+        return B.CreateFAdd(Acc, B.CreateFMul(x, x));
+    };
+
+    auto Add = [](IRBuilder<> &B, Value *L, Value *R) {
+        return B.CreateFAdd(L, R);
+    };
+
+    auto sum = emitParallelReduce(B, "sum_squares.body", B.getInt64(0), n, grain,
+                                  {data}, ConstantFP::get(dbl, 0.0), Square, Add);
+    if (!sum)
+        return sum.takeError();
+
+    B.CreateRet(*sum);
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyModule(module, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Module verification failed: %s",
+                                 es.str().c_str());
+
+    return Error::success();
+}
+
+std::unique_ptr<JitEngine> TheJIT;
+static ExitOnError ExitOnErr;
+
+template <typename Fn_t>
+double timeMs(Fn_t Fn)
+{
+    auto Begin = std::chrono::steady_clock::now();
+    Fn();
+    std::chrono::duration<double, std::milli> Elapsed =
+        std::chrono::steady_clock::now() - Begin;
+    return Elapsed.count();
+}
+
+int main(int argc, char **argv)
+{
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+
+    PassRegistry &Registry = *PassRegistry::getPassRegistry();
+    initializeCoroutines(Registry);
+
+    TheJIT = ExitOnErr(JitEngine::Create());
+
+    ExitOnErr(defineParallelFor(*TheJIT));
+
+    auto module = std::make_unique<Module>("ParallelJIT", TheJIT->getContext());
+    module->setDataLayout(TheJIT->getDataLayout());
+
+    ExitOnErr(codegenIR(*module));
+    ExitOnErr(TheJIT->addModule(std::move(module)));
+
+    auto scale = ExitOnErr(
+        TheJIT->getFunction<void(double *, uint64_t, double, uint64_t)>("scale"));
+    auto sum_squares = ExitOnErr(
+        TheJIT->getFunction<double(const double *, uint64_t, uint64_t)>(
+            "sum_squares"));
+
+    std::vector<double> Data(N, 1.0);
+
+    std::cout << "workers: " << ParallelForPool::getDefault().getNumThreads()
+              << " + caller" << std::endl;
+
+    double Sum = 0;
+
+    for (uint64_t G : {N, Grain})
+    {
+        double ScaleMs = timeMs([&]() { scale(Data.data(), N, 0.5, G); });
+        double SumMs = timeMs([&]() { Sum = sum_squares(Data.data(), N, G); });
+
+        std::cout << "grain " << G << ": scale " << ScaleMs << " ms, "
+                  << "sum_squares " << SumMs << " ms (" << Sum << ")"
+                  << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <iostream>
+
+#include "JitEngine.h"
+#include "JitProfiler.h"
+
+using namespace llvm;
+
+/**
+ * Sampling profiler
+ *
+ * Generates two functions of the same body
+ *
+ *     int64_t hot(int64_t n)  { int64_t s = 0; for (i = 0; i < n; i++) s += i * i % 7; return s; }
+ *     int64_t cold(int64_t n) { ... }
+ *
+ * and calls hot with ten times the n of cold for about a second of CPU
+ * time while the profiler samples, then prints the hottest functions.
+ */
+
+static const int64_t ColdIterations = 100000;
+
+void codegenLoop(Module &module, StringRef Name)
+{
+
+    LLVMContext &ctx = module.getContext();
+    IRBuilder<> B(ctx);
+
+    auto i64 = Type::getInt64Ty(ctx);
+
+    auto fn = Function::Create(FunctionType::get(i64, {i64}, false),
+                               Function::ExternalLinkage, Name, module);
+
+    Value *n = fn->arg_begin();
+    n->setName("n");
+
+    BasicBlock *entry = BasicBlock::Create(ctx, "entry", fn);
+    BasicBlock *loop = BasicBlock::Create(ctx, "loop", fn);
+    BasicBlock *exit = BasicBlock::Create(ctx, "exit", fn);
+
+    B.SetInsertPoint(entry);
+    B.CreateCondBr(B.CreateICmpSGT(n, B.getInt64(0)), loop, exit);
+
+    B.SetInsertPoint(loop);
+    PHINode *i = B.CreatePHI(i64, 2, "i");
+    PHINode *s = B.CreatePHI(i64, 2, "s");
+    i->addIncoming(B.getInt64(0), entry);
+    s->addIncoming(B.getInt64(0), entry);
+
+    Value *next_s = B.CreateAdd(s, B.CreateSRem(B.CreateMul(i, i), B.getInt64(7)));
+    Value *next_i = B.CreateAdd(i, B.getInt64(1));
+    i->addIncoming(next_i, loop);
+    s->addIncoming(next_s, loop);
+    B.CreateCondBr(B.CreateICmpSLT(next_i, n), loop, exit);
+
+    B.SetInsertPoint(exit);
+    PHINode *result = B.CreatePHI(i64, 2, "result");
+    result->addIncoming(B.getInt64(0), entry);
+    result->addIncoming(next_s, loop);
+    B.CreateRet(result);
+}
+
+Error codegenIR(Module &module)
+{
+    codegenLoop(module, "hot");
+    codegenLoop(module, "cold");
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyModule(module, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Module verification failed: %s",
+                                 es.str().c_str());
+
+    return Error::success();
+}
+
+std::unique_ptr<JitEngine> TheJIT;
+static ExitOnError ExitOnErr;
+
+int main(int argc, char **argv)
+{
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+
+    TheJIT = ExitOnErr(JitEngine::Create());
+
+    // The profiler only knows the code loaded after it is registered
+    JitProfiler Profiler(TheJIT->getDataLayout().getGlobalPrefix());
+    TheJIT->addEventListener(Profiler);
+
+    auto module = std::make_unique<Module>("ProfileJIT", TheJIT->getContext());
+    module->setDataLayout(TheJIT->getDataLayout());
+
+    ExitOnErr(codegenIR(*module));
+    ExitOnErr(TheJIT->addModule(std::move(module)));
+
+    auto hot = ExitOnErr(TheJIT->getFunction<int64_t(int64_t)>("hot"));
+    auto cold = ExitOnErr(TheJIT->getFunction<int64_t(int64_t)>("cold"));
+
+    ExitOnErr(Profiler.start());
+
+    int64_t Sum = 0;
+    auto Begin = std::chrono::steady_clock::now();
+
+    while (std::chrono::steady_clock::now() - Begin < std::chrono::seconds(1))
+    {
+        Sum += hot(10 * ColdIterations);
+        Sum += cold(ColdIterations);
+    }
+
+    Profiler.stop();
+
+    std::cout << "checksum " << Sum << ", " << Profiler.getNumSamples()
+              << " samples, " << Profiler.getNumDropped() << " dropped"
+              << std::endl;
+
+    for (const JitProfiler::HotFunction &F : Profiler.getHotFunctions(10))
+        std::cout << "  " << F.Name << " (module " << F.Key << "): "
+                  << F.Samples << " samples" << std::endl;
+
+    TheJIT->removeEventListener(Profiler);
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstdint>
+#include <memory>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "JitEngine.h"
+
+using namespace llvm;
+using namespace llvm::orc;
+
+/**
+ * Context rotation
+ *
+ * The engine retires its context every two modules. Each round, a module
+ * is built in a handle to the current context but only added in the next
+ * round, after the context has been retired; meanwhile two modules are
+ * added in the current context, which retires it. All the functions added
+ * so far are looked up and called every round, and all the modules are
+ * removed at the end.
+ */
+
+static const unsigned Rounds = 4;
+
+/// int64_t <Name>(int64_t x) { return x * Factor + Offset; }
+Error codegenIR(Module &module, StringRef Name, int64_t Factor, int64_t Offset)
+{
+
+    LLVMContext &ctx = module.getContext();
+    IRBuilder<> B(ctx);
+
+    auto i64 = Type::getInt64Ty(ctx);
+    auto fn = Function::Create(FunctionType::get(i64, {i64}, false),
+                               Function::ExternalLinkage, Name, module);
+    Value *x = fn->arg_begin();
+
+    B.SetInsertPoint(BasicBlock::Create(ctx, "entry", fn));
+    B.CreateRet(B.CreateAdd(B.CreateMul(x, B.getInt64(Factor)),
+                            B.getInt64(Offset)));
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyModule(module, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Module verification failed: %s",
+                                 es.str().c_str());
+
+    return Error::success();
+}
+
+std::unique_ptr<JitEngine> TheJIT;
+static ExitOnError ExitOnErr;
+
+/// A module built in a context handle, waiting to be added
+struct PendingModule
+{
+    ContextHandle Handle;
+    std::unique_ptr<Module> M;
+};
+
+static std::unique_ptr<Module> buildModule(LLVMContext &Ctx, StringRef Name,
+                                           int64_t Factor, int64_t Offset)
+{
+    auto module = std::make_unique<Module>(Name, Ctx);
+    module->setDataLayout(TheJIT->getDataLayout());
+    ExitOnErr(codegenIR(*module, Name, Factor, Offset));
+    return module;
+}
+
+static PendingModule buildLate(unsigned Round)
+{
+    ContextHandle Handle = TheJIT->getThreadSafeContext();
+
+    // Modules of the same context may be compiling on other threads.
+    auto Lock = Handle.getLock();
+    auto module = buildModule(*Handle.getContext(),
+                              "late_" + std::to_string(Round), Round + 1, 100);
+
+    return PendingModule{std::move(Handle), std::move(module)};
+}
+
+int main(int argc, char **argv)
+{
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+
+    TheJIT = ExitOnErr(JitEngine::Create());
+    TheJIT->setContextRotation(2);
+
+    JITDylib &Tenant = TheJIT->getDefaultTenant();
+
+    std::vector<VModuleKey> Keys;
+    std::vector<std::string> Names;
+    std::set<LLVMContext *> Contexts;
+
+    std::unique_ptr<PendingModule> Late;
+
+    for (unsigned Round = 0; Round < Rounds; ++Round)
+    {
+        auto Next = std::make_unique<PendingModule>(buildLate(Round));
+        Contexts.insert(&Next->M->getContext());
+
+        // The second one retires the context Next was built in.
+        for (unsigned I = 0; I < 2; ++I)
+        {
+            std::string Name = "now_" + std::to_string(Round) + "_" + std::to_string(I);
+            auto module = buildModule(TheJIT->getContext(), Name, Round + 1, I);
+            Contexts.insert(&module->getContext());
+
+            VModuleKey K = TheJIT->createModuleKey();
+            ExitOnErr(TheJIT->addModule(Tenant, std::move(module), K));
+            Keys.push_back(K);
+            Names.push_back(Name);
+        }
+
+        // Built in a context retired a round ago; releasing the handle lets
+        // that context go once the module is compiled.
+        if (Late)
+        {
+            std::string Name = Late->M->getName().str();
+
+            VModuleKey K = TheJIT->createModuleKey();
+            ExitOnErr(TheJIT->addModule(Tenant, std::move(Late->M), K));
+            Late.reset();
+            Keys.push_back(K);
+            Names.push_back(Name);
+        }
+
+        Late = std::move(Next);
+
+        int64_t Sum = 0;
+        for (const std::string &Name : Names)
+            Sum += ExitOnErr(TheJIT->getFunction<int64_t(int64_t)>(Name))(3);
+
+        std::cout << "round " << Round << ": " << Names.size()
+                  << " functions, sum at 3 = " << Sum << std::endl;
+    }
+
+    // The last late module is added in a retired context as well.
+    std::string Name = Late->M->getName().str();
+    VModuleKey K = TheJIT->createModuleKey();
+    ExitOnErr(TheJIT->addModule(Tenant, std::move(Late->M), K));
+    Late.reset();
+    Keys.push_back(K);
+    Names.push_back(Name);
+
+    std::cout << Name << "(3) = "
+              << ExitOnErr(TheJIT->getFunction<int64_t(int64_t)>(Name))(3)
+              << ", contexts used: " << Contexts.size() << std::endl;
+
+    for (VModuleKey Key : Keys)
+        ExitOnErr(TheJIT->removeModule(Key));
+
+    std::cout << "removed " << Keys.size() << " modules" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,170 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "JitEngine.h"
+#include "SharedCode.h"
+
+using namespace llvm;
+
+/**
+ * Shared code across processes
+ *
+ * Creates a shared code region and forks one worker, which compiles
+ *
+ *     int64_t poly(int64_t x) { return host_scale(x) * ++calls + 1; }
+ *
+ * into it, and then a few more, which find the module there and run the
+ * same code pages without compiling. calls is a global of the module, of
+ * which every worker has its own copy.
+ */
+
+static const int NumImporters = 3;
+
+extern "C" int64_t host_scale(int64_t x) { return 3 * x; }
+
+Error codegenIR(Module &module)
+{
+
+    LLVMContext &ctx = module.getContext();
+    IRBuilder<> B(ctx);
+
+    auto i64 = Type::getInt64Ty(ctx);
+
+    auto calls = new GlobalVariable(module, i64, false,
+                                    GlobalValue::ExternalLinkage,
+                                    B.getInt64(0), "calls");
+
+    auto hostScale = Function::Create(FunctionType::get(i64, {i64}, false),
+                                      Function::ExternalLinkage, "host_scale",
+                                      module);
+
+    auto poly = Function::Create(FunctionType::get(i64, {i64}, false),
+                                 Function::ExternalLinkage, "poly", module);
+
+    Value *x = poly->arg_begin();
+    x->setName("x");
+
+    B.SetInsertPoint(BasicBlock::Create(ctx, "entry", poly));
+
+    Value *n = B.CreateAdd(B.CreateLoad(calls), B.getInt64(1));
+    B.CreateStore(n, calls);
+
+    Value *scaled = B.CreateCall(hostScale, {x});
+    B.CreateRet(B.CreateAdd(B.CreateMul(scaled, n), B.getInt64(1)));
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyModule(module, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Module verification failed: %s",
+                                 es.str().c_str());
+
+    return Error::success();
+}
+
+static ExitOnError ExitOnErr;
+
+static const char *getRoleName(SharedCodeRegion::Role Role)
+{
+    switch (Role)
+    {
+    case SharedCodeRegion::Role::Export:
+        return "exported";
+    case SharedCodeRegion::Role::Import:
+        return "imported";
+    default:
+        return "compiled privately";
+    }
+}
+
+/// Body of a worker process
+static int runWorker(std::shared_ptr<SharedCodeRegion> Region)
+{
+    auto TheJIT = ExitOnErr(JitEngine::Create());
+
+    ExitOnErr(TheJIT->defineAbsolute(
+        "host_scale", JITEvaluatedSymbol(pointerToJITTargetAddress(&host_scale),
+                                         JITSymbolFlags::Exported)));
+
+    auto module = std::make_unique<Module>("SharedJIT", TheJIT->getContext());
+    module->setDataLayout(TheJIT->getDataLayout());
+
+    ExitOnErr(codegenIR(*module));
+
+    auto Role = ExitOnErr(TheJIT->addSharedModule(
+        TheJIT->getDefaultTenant(), std::move(module),
+        TheJIT->createModuleKey(), Region));
+
+    auto poly = ExitOnErr(TheJIT->getFunction<int64_t(int64_t)>("poly"));
+
+    int64_t First = poly(7);
+    int64_t Second = poly(7);
+
+    std::cout << "worker " << getpid() << ": " << getRoleName(Role)
+              << ", poly(7) = " << First << ", " << Second
+              << " (shared imports: " << Region->getNumImports()
+              << ", private fallbacks: " << Region->getNumPrivateFallbacks()
+              << ")" << std::endl;
+
+    return First == 22 && Second == 43 ? 0 : 1;
+}
+
+static pid_t forkWorker(std::shared_ptr<SharedCodeRegion> Region)
+{
+    pid_t Pid = fork();
+
+    if (Pid == 0)
+        exit(runWorker(std::move(Region)));
+
+    return Pid;
+}
+
+static bool waitWorker(pid_t Pid)
+{
+    int Status;
+    return waitpid(Pid, &Status, 0) == Pid && WIFEXITED(Status) &&
+           WEXITSTATUS(Status) == 0;
+}
+
+int main(int argc, char **argv)
+{
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+
+    auto Region = ExitOnErr(SharedCodeRegion::create("SharedJIT"));
+
+    // The first worker compiles; the others start once the code is there.
+    bool Ok = waitWorker(forkWorker(Region));
+
+    pid_t Importers[NumImporters];
+
+    for (pid_t &Pid : Importers)
+        Pid = forkWorker(Region);
+
+    for (pid_t Pid : Importers)
+        Ok = waitWorker(Pid) && Ok;
+
+    return Ok ? 0 : 1;
+}
@@ -18,6 +18,7 @@
 #include <iostream>
 
 #include "JitEngine.h"
+#include "JitSpecializer.h"
 
 using namespace llvm;
 
@@ -85,6 +86,9 @@ int main(int argc, char **argv)
 
     TheJIT = ExitOnErr(JitEngine::Create());
 
+    // Keep the IR of mul_add around so that it can be specialized below.
+    TheJIT->setRetainIR(true);
+
     auto module = std::make_unique<Module>("MyFirstJIT", TheJIT->getContext());
     module->setDataLayout(TheJIT->getDataLayout());
 
@@ -100,5 +104,14 @@ int main(int argc, char **argv)
 
     std::cout << "23 * 80 + 90 = " << ret << std::endl;
 
+    // Same function with y fixed to 80; the value passed for y is ignored.
+    JitSpecializer Specializer(*TheJIT, 8);
+
+    auto mul80_add = ExitOnErr(Specializer.get<int32_t(int32_t, int32_t, int32_t)>(
+        JitedFnName, {BoundArgument::bind<int32_t>(1, 80)}));
+
+    std::cout << "23 * 80 + 90 = " << mul80_add(23, 0, 90)
+              << " (specialized)" << std::endl;
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,122 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <memory>
+#include <iostream>
+
+#include "JitEngine.h"
+#include "StreamGenerator.h"
+
+using namespace llvm;
+
+/**
+ * Streaming generator
+ *
+ * The JIT coroutine `squares` yields i * i for i in [0, n) into a ring
+ * buffer of the host, and only suspends when the buffer is full. The host
+ * sums the stream batch by batch, with one resume per batch instead of one
+ * per element.
+ */
+
+Error codegenIR(Module &module)
+{
+
+    LLVMContext &ctx = module.getContext();
+    Type *i64 = JitType<int64_t>::get(ctx);
+
+    auto Body = [&](IRBuilder<> &B, ArrayRef<Value *> Args,
+                    const StreamYieldFn &Yield) {
+        Value *n = Args[0];
+        Function *fn = B.GetInsertBlock()->getParent();
+
+        BasicBlock *entry = B.GetInsertBlock();
+        BasicBlock *loop = BasicBlock::Create(ctx, "loop", fn);
+        BasicBlock *exit = BasicBlock::Create(ctx, "exit", fn);
+
+        B.CreateCondBr(B.CreateICmpEQ(n, B.getInt64(0)), exit, loop);
+
+        B.SetInsertPoint(loop);
+        PHINode *i = B.CreatePHI(i64, 2, "i");
+        i->addIncoming(B.getInt64(0), entry);
+
+        // May suspend; the loop goes on in the block Yield leaves B in
+        Yield(B, B.CreateMul(i, i, "square"));
+
+        Value *next = B.CreateAdd(i, B.getInt64(1), "next");
+        i->addIncoming(next, B.GetInsertBlock());
+        B.CreateCondBr(B.CreateICmpULT(next, n), loop, exit);
+
+        B.SetInsertPoint(exit);
+    };
+
+    if (auto Err = emitStreamGenerator(module, "squares", i64, {i64}, Body)
+                       .takeError())
+        return Err;
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyModule(module, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Module verification failed: %s",
+                                 es.str().c_str());
+
+    return Error::success();
+}
+
+std::unique_ptr<JitEngine> TheJIT;
+static ExitOnError ExitOnErr;
+
+int main(int argc, char **argv)
+{
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+
+    PassRegistry &Registry = *PassRegistry::getPassRegistry();
+    initializeCoroutines(Registry);
+
+    TheJIT = ExitOnErr(JitEngine::Create());
+
+    auto module = std::make_unique<Module>("StreamJIT", TheJIT->getContext());
+    module->setDataLayout(TheJIT->getDataLayout());
+
+    ExitOnErr(codegenIR(*module));
+    ExitOnErr(TheJIT->addModule(std::move(module)));
+
+    JitStreamFunctions Squares = ExitOnErr(
+        lookupStreamGenerator(*TheJIT, TheJIT->getDefaultTenant(), "squares"));
+
+    const int64_t N = 1000000;
+
+    JitStream<int64_t> Stream(Squares, 4096, N);
+
+    int64_t Sum = 0;
+    uint64_t Batches = 0;
+
+    for (ArrayRef<int64_t> Batch = Stream.next(); !Batch.empty();
+         Batch = Stream.next())
+    {
+        for (int64_t Square : Batch)
+            Sum += Square;
+
+        Batches++;
+    }
+
+    std::cout << "sum of squares below " << N << " = " << Sum << " ("
+              << Batches << " batches, " << Stream.getNumResumes()
+              << " resumes)" << std::endl;
+
+    return 0;
+}
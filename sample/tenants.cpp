@@ -0,0 +1,122 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "JitEngine.h"
+
+using namespace llvm;
+using namespace llvm::orc;
+
+/**
+ * Tenants
+ *
+ * Two tenants, alpha and beta, each add a module that defines
+ *
+ *     int64_t score(int64_t x) { return host_scale(x) + Bias; }
+ *
+ * with a Bias of their own. host_scale is a host function defined once in
+ * the runtime dylib, which both tenants resolve it from. Looking up score
+ * in either tenant must find that tenant's definition, and the default
+ * tenant, which defines none, must not find one.
+ */
+
+extern "C" int64_t host_scale(int64_t x) { return 3 * x; }
+
+Error codegenIR(Module &module, int64_t Bias)
+{
+
+    LLVMContext &ctx = module.getContext();
+    IRBuilder<> B(ctx);
+
+    auto i64 = Type::getInt64Ty(ctx);
+    auto signature = FunctionType::get(i64, {i64}, false);
+
+    auto hostScale = Function::Create(signature, Function::ExternalLinkage,
+                                      "host_scale", module);
+
+    auto score = Function::Create(signature, Function::ExternalLinkage,
+                                  "score", module);
+    Value *x = score->arg_begin();
+
+    B.SetInsertPoint(BasicBlock::Create(ctx, "entry", score));
+    B.CreateRet(B.CreateAdd(B.CreateCall(hostScale, {x}), B.getInt64(Bias)));
+
+    std::string buffer;
+    raw_string_ostream es(buffer);
+
+    if (verifyModule(module, &es))
+        return createStringError(inconvertibleErrorCode(),
+                                 "Module verification failed: %s",
+                                 es.str().c_str());
+
+    return Error::success();
+}
+
+std::unique_ptr<JitEngine> TheJIT;
+static ExitOnError ExitOnErr;
+
+/// Create the tenant Name and add its score module.
+static JITDylib &createTenant(StringRef Name, int64_t Bias)
+{
+    JITDylib &Tenant = ExitOnErr(TheJIT->createTenant(Name));
+
+    auto module = std::make_unique<Module>(Name, TheJIT->getContext());
+    module->setDataLayout(TheJIT->getDataLayout());
+    ExitOnErr(codegenIR(*module, Bias));
+
+    ExitOnErr(TheJIT->addModule(Tenant, std::move(module)));
+    return Tenant;
+}
+
+int main(int argc, char **argv)
+{
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+
+    TheJIT = ExitOnErr(JitEngine::Create());
+
+    ExitOnErr(TheJIT->defineAbsolute(
+        "host_scale", JITEvaluatedSymbol(pointerToJITTargetAddress(&host_scale),
+                                         JITSymbolFlags::Exported)));
+
+    JITDylib &Alpha = createTenant("alpha", 10);
+    JITDylib &Beta = createTenant("beta", 20);
+
+    auto AlphaScore = ExitOnErr(TheJIT->getFunction<int64_t(int64_t)>(Alpha, "score"));
+    auto BetaScore = ExitOnErr(TheJIT->getFunction<int64_t(int64_t)>(Beta, "score"));
+
+    int64_t A = AlphaScore(2), B = BetaScore(2);
+
+    std::cout << "alpha: score(2) = " << A << std::endl;
+    std::cout << "beta: score(2) = " << B << std::endl;
+
+    bool Ok = A == host_scale(2) + 10 && B == host_scale(2) + 20;
+
+    // The default tenant sees the runtime dylib, but neither tenant.
+    auto Default = TheJIT->getFunctionAddr(TheJIT->getDefaultTenant(), "score");
+    if (Default)
+        Ok = false;
+    else
+        std::cout << "default tenant: " << toString(Default.takeError()) << std::endl;
+
+    std::cout << (Ok ? "each tenant has its own score" : "tenants are not isolated")
+              << std::endl;
+
+    return Ok ? 0 : 1;
+}